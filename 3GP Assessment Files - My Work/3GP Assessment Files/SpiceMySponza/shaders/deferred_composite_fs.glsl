@@ -0,0 +1,11 @@
+#version 330
+
+//The finished lighting, copied out to the window's framebuffer
+uniform sampler2D light_accumulation;
+
+out vec4 fragment_colour;
+
+void main(void)
+{
+	fragment_colour = texelFetch(light_accumulation, ivec2(gl_FragCoord.xy), 0);
+}
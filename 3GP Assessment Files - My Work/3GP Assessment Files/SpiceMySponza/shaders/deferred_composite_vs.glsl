@@ -0,0 +1,9 @@
+#version 330
+
+//One triangle that covers the whole viewport, generated from the vertex id
+//so no buffers are needed
+void main(void)
+{
+	vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(corner * 2.0 - 1.0, 0.0, 1.0);
+}
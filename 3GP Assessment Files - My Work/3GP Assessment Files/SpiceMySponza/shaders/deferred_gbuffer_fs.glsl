@@ -0,0 +1,81 @@
+#version 330
+
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
+
+//Materials are compiled into one std140 array (see MaterialTable) and each
+//instance picks its own by index, texture layers below zero mean no texture
+struct Material
+{
+	vec3 ambient_colour;
+	float shininess;
+	vec3 diffuse_colour;
+	int diffuse_layer;
+	vec3 specular_colour;
+	int specular_layer;
+};
+const int kMaxMaterials = 256;
+layout(std140) uniform MaterialBlock
+{
+	Material materials[kMaxMaterials];
+};
+
+//Every material's textures are layers of one array, bound once per frame
+uniform sampler2DArray material_textures;
+
+//Streamed from sponza_vs.glsl, which the G-buffer pass shares with the
+//forward renderer
+in vec3 varying_position;
+in vec3 varying_normal;
+in vec2 varying_texture_coordinates;
+flat in int varying_material_index;
+
+//Shininess is stored as a fraction of this, must match deferred_light_fs.glsl
+const float kMaxShininess = 255.0;
+
+layout(location = 0) out vec4 gbuffer_albedo;
+layout(location = 1) out vec2 gbuffer_normal;
+layout(location = 2) out vec4 gbuffer_specular;
+layout(location = 3) out vec4 light_accumulation;
+
+//Folds the unit sphere onto an octahedron and unfolds it onto a square, so a
+//normal fits in two channels with nearly even precision in every direction
+vec2 encodeNormal(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	if (n.z < 0.0)
+	{
+		vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+		n.xy = (1.0 - abs(n.yx)) * signs;
+	}
+	return n.xy * 0.5 + 0.5;
+}
+
+void main(void)
+{
+	Material mat = materials[varying_material_index];
+
+	vec3 albedo = mat.diffuse_colour;
+	if (mat.diffuse_layer >= 0)
+		albedo *= texture(material_textures, vec3(varying_texture_coordinates, mat.diffuse_layer)).rgb;
+
+	vec3 specular = mat.specular_colour;
+	if (mat.specular_layer >= 0)
+		specular *= texture(material_textures, vec3(varying_texture_coordinates, mat.specular_layer)).rgb;
+
+	//Alpha keeps the material index, which fits in eight bits as there are
+	//at most 256 materials, for the spotlight's untextured diffuse colour
+	gbuffer_albedo = vec4(albedo, float(varying_material_index) / 255.0);
+	gbuffer_normal = encodeNormal(normalize(varying_normal));
+	gbuffer_specular = vec4(specular, clamp(mat.shininess / kMaxShininess, 0.0, 1.0));
+
+	//Ambient light needs no light volume, it starts the accumulation off
+	light_accumulation = vec4(mat.ambient_colour * scene_ambient_light, 1.0);
+}
@@ -0,0 +1,122 @@
+#version 330
+
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
+
+//Turns window depth back into a world position (see DeferredView)
+layout(std140) uniform LightPassBlock
+{
+	mat4 inverse_combined_matrix;
+};
+
+struct Light
+{
+	vec3 position;
+	float range;
+	vec3 colour;
+	float cone_angle;
+	vec3 cone_direction;
+};
+const int kMaxLights = 256;
+layout(std140) uniform LightBlock
+{
+	Light light_sources[kMaxLights];
+};
+
+//Only the diffuse colour is read, for the spotlight (see MaterialTable)
+struct Material
+{
+	vec3 ambient_colour;
+	float shininess;
+	vec3 diffuse_colour;
+	int diffuse_layer;
+	vec3 specular_colour;
+	int specular_layer;
+};
+const int kMaxMaterials = 256;
+layout(std140) uniform MaterialBlock
+{
+	Material materials[kMaxMaterials];
+};
+
+uniform sampler2D gbuffer_albedo;
+uniform sampler2D gbuffer_normal;
+uniform sampler2D gbuffer_specular;
+uniform sampler2D gbuffer_depth;
+
+flat in int varying_light_index;
+
+//Must match deferred_gbuffer_fs.glsl
+const float kMaxShininess = 255.0;
+
+out vec4 fragment_colour;
+
+vec3 decodeNormal(vec2 encoded)
+{
+	vec2 f = encoded * 2.0 - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.x += n.x >= 0.0 ? -t : t;
+	n.y += n.y >= 0.0 ? -t : t;
+	return normalize(n);
+}
+
+void main(void)
+{
+	//The volume is drawn where its back faces are behind the scene, which
+	//still includes pixels in front of the light, so range is checked here
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gbuffer_depth, texel, 0).r;
+	if (depth == 1.0)
+		discard;
+
+	vec2 ndc_xy = gl_FragCoord.xy / vec2(textureSize(gbuffer_depth, 0)) * 2.0 - 1.0;
+	vec4 world = inverse_combined_matrix * vec4(ndc_xy, depth * 2.0 - 1.0, 1.0);
+	vec3 position = world.xyz / world.w;
+
+	Light light = light_sources[varying_light_index];
+	float dist = distance(position, light.position);
+	if (dist >= light.range)
+		discard;
+
+	vec4 albedo_material = texelFetch(gbuffer_albedo, texel, 0);
+	vec3 albedo = albedo_material.rgb;
+	vec3 normal = decodeNormal(texelFetch(gbuffer_normal, texel, 0).rg);
+	vec4 specular = texelFetch(gbuffer_specular, texel, 0);
+
+	vec3 light_vector = (light.position - position) / dist;
+	float attenuation = smoothstep(light.range, light.range / 2, dist);
+	float diffuse_intensity = max(0.0, dot(light_vector, normal));
+
+	//Spotlights light diffusely only and with the material's colour alone,
+	//leaving out its texture, as in the forward renderer
+	if (light.cone_angle > 0.0)
+	{
+		int material_index = int(albedo_material.a * 255.0 + 0.5);
+		float cone = smoothstep(cos(0.5 * radians(light.cone_angle)), 1.0,
+			dot(-light_vector, normalize(light.cone_direction)));
+		vec3 spot_diffuse = materials[material_index].diffuse_colour * diffuse_intensity;
+		fragment_colour = vec4(light.colour * spot_diffuse * attenuation * cone, 0.0);
+		return;
+	}
+
+	vec3 diffuse = albedo * diffuse_intensity;
+
+	float shininess = specular.a * kMaxShininess;
+	vec3 reflected = vec3(0.0);
+	if (shininess > 0.0)
+	{
+		vec3 camera_direction = normalize(camera_position - position);
+		vec3 reflected_light = reflect(-light_vector, normal);
+		reflected = specular.rgb * pow(max(0.0, dot(camera_direction, reflected_light)), shininess);
+	}
+
+	fragment_colour = vec4(light.colour * (diffuse + reflected) * attenuation, 0.0);
+}
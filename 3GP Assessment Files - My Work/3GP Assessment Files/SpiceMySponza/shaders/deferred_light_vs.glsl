@@ -0,0 +1,40 @@
+#version 330
+
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
+
+//The lights being drawn, one instance of the volume per light (see LightGL)
+struct Light
+{
+	vec3 position;
+	float range;
+	vec3 colour;
+	float cone_angle;
+	vec3 cone_direction;
+};
+const int kMaxLights = 256;
+layout(std140) uniform LightBlock
+{
+	Light light_sources[kMaxLights];
+};
+
+//A sphere of radius one that encloses the unit sphere
+in vec3 vertex_position;
+
+flat out int varying_light_index;
+
+void main(void)
+{
+	Light light = light_sources[gl_InstanceID];
+	varying_light_index = gl_InstanceID;
+
+	vec3 world_position = light.position + vertex_position * light.range;
+	gl_Position = combined_matrix * vec4(world_position, 1.0);
+}
@@ -0,0 +1,6 @@
+#version 330
+
+//Only depth is written in the pre-pass, colour writes are masked off
+void main(void)
+{
+}
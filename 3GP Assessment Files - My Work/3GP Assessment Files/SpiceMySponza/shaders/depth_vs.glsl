@@ -0,0 +1,27 @@
+#version 330
+
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
+
+//Only positions are streamed for the depth pre-pass
+in vec3 vertex_position;
+
+//Per-instance attributes, these advance once per instance of a draw
+in mat4x3 instance_world_matrix;
+
+//Must be computed exactly as in sponza_vs.glsl, the shading pass tests
+//its depths for equality against the ones written here
+invariant gl_Position;
+
+void main(void)
+{
+	vec3 world_position = instance_world_matrix * vec4(vertex_position, 1.0);
+	gl_Position = combined_matrix * vec4(world_position, 1.0);
+}
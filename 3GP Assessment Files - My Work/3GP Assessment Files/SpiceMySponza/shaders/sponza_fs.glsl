@@ -1,6 +1,17 @@
 #version 330
 
-//Create structure for light sources and pass in uniform array of instances
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
+
+//Create structure for light sources, the scene's lights come from a buffer
+//texture of three texels per light laid out as LightGL
 struct Light
 {
 	vec3 position;
@@ -9,43 +20,66 @@ struct Light
 	float cone_angle;
 	vec3 cone_direction;
 };
-const int kNoOfLights = 22;
-uniform Light light_sources[kNoOfLights];
+uniform samplerBuffer light_data;
+
+//The view is split into froxels, screen tiles by depth slices spaced
+//exponentially, and each lists the lights that reach it (see LightClusters).
+//cluster_table holds each froxel's first index and count in light_indices.
+//With instance_light_lists set the froxels are not filled and each fragment
+//uses its instance's list into instance_light_indices instead
+layout(std140) uniform ClusterBlock
+{
+	vec2 cluster_tile_scale;
+	float cluster_slice_scale;
+	float cluster_slice_bias;
+	float near_plane_distance;
+	float far_plane_distance;
+	ivec2 cluster_grid;
+	int cluster_slices;
+	int instance_light_lists;
+};
+uniform usamplerBuffer cluster_table;
+uniform usamplerBuffer cluster_light_indices;
+uniform usamplerBuffer instance_light_indices;
 
-//Create structure for materials and pass in uniform instance
+//Materials are compiled into one std140 array (see MaterialTable) and each
+//instance picks its own by index, texture layers below zero mean no texture
 struct Material
 {
 	vec3 ambient_colour;
+	float shininess;
 	vec3 diffuse_colour;
-	bool has_diffuse_texture;
-	sampler2D diff_texture;
+	int diffuse_layer;
 	vec3 specular_colour;
-	bool has_specular_texture;
-	sampler2D spec_texture;
-	float shininess;
-	bool is_shiny;
+	int specular_layer;
+};
+const int kMaxMaterials = 256;
+layout(std140) uniform MaterialBlock
+{
+	Material materials[kMaxMaterials];
 };
-uniform Material mat;
 
-uniform vec3 scene_ambient_light;
-uniform vec3 camera_position;
+//Every material's textures are layers of one array, bound once per frame
+uniform sampler2DArray material_textures;
 
 //Add in variables for each of the streamed attributes
 in vec3 varying_position;
 in vec3 varying_normal;
 in vec2 varying_texture_coordinates;
+flat in int varying_material_index;
+flat in uvec2 varying_light_list;
 
 out vec4 fragment_colour;
 
 //Function to calculate diffuse values for the lights in Lambert reflection
-vec3 DiffuseLightSource(Light light_)
+vec3 DiffuseLightSource(Light light_, Material mat)
 {
 	vec3 diffuse_colour;
 
 	//Check if material has diffuse texture
-	if (mat.has_diffuse_texture)
+	if (mat.diffuse_layer >= 0)
 	{
-		vec3 tex_colour = texture(mat.diff_texture, varying_texture_coordinates).rgb;
+		vec3 tex_colour = texture(material_textures, vec3(varying_texture_coordinates, mat.diffuse_layer)).rgb;
 		diffuse_colour = mat.diffuse_colour * tex_colour;
 	}
 	else
@@ -66,14 +100,14 @@ vec3 DiffuseLightSource(Light light_)
 }
 
 //Function to calculate specular values for the lights in Phong reflection
-vec3 SpecularLightSource(Light light_)
+vec3 SpecularLightSource(Light light_, Material mat)
 {
 	vec3 specular_colour;
 
 	//Check if material has specular texture
-	if (mat.has_specular_texture)
+	if (mat.specular_layer >= 0)
 	{
-		vec3 tex_colour = texture(mat.spec_texture, varying_texture_coordinates).rgb;
+		vec3 tex_colour = texture(material_textures, vec3(varying_texture_coordinates, mat.specular_layer)).rgb;
 		specular_colour = mat.specular_colour * tex_colour;
 	}
 	else
@@ -98,7 +132,7 @@ vec3 SpecularLightSource(Light light_)
 }
 
 //Diffuse lighting for a spotlight
-vec3 SpotlightLightSource(Light spotlight_)
+vec3 SpotlightLightSource(Light spotlight_, Material mat)
 {
 	vec3 light_vector = normalize(spotlight_.position - varying_position);
 	float light_to_surface_angle = smoothstep(cos(0.5f * radians(spotlight_.cone_angle)), 1, dot(-light_vector, normalize(spotlight_.cone_direction)));
@@ -109,8 +143,33 @@ vec3 SpotlightLightSource(Light spotlight_)
 	return diffuse_intensity * mat.diffuse_colour * attenuation * light_to_surface_angle * spotlight_.colour;
 }
 
+Light fetchLight(int index)
+{
+	vec4 position_range = texelFetch(light_data, index * 3);
+	vec4 colour_cone = texelFetch(light_data, index * 3 + 1);
+	Light light;
+	light.position = position_range.xyz;
+	light.range = position_range.w;
+	light.colour = colour_cone.rgb;
+	light.cone_angle = colour_cone.a;
+	light.cone_direction = texelFetch(light_data, index * 3 + 2).xyz;
+	return light;
+}
+
+//Must find the froxel the same way LightClusters divides the view
+int clusterIndex()
+{
+	float ndc_depth = gl_FragCoord.z * 2.0 - 1.0;
+	float view_depth = 2.0 * near_plane_distance * far_plane_distance
+		/ (far_plane_distance + near_plane_distance - ndc_depth * (far_plane_distance - near_plane_distance));
+	ivec2 tile = min(ivec2(gl_FragCoord.xy * cluster_tile_scale), cluster_grid - 1);
+	int slice = clamp(int(floor(log(view_depth) * cluster_slice_scale + cluster_slice_bias)), 0, cluster_slices - 1);
+	return (slice * cluster_grid.y + tile.y) * cluster_grid.x + tile.x;
+}
+
 void main(void)
 {
+	Material mat = materials[varying_material_index];
 	vec3 intensity_to_eye = vec3(0.f, 0.f, 0.f);
 
 	//Create instance of a spotlight and assign values to the variables
@@ -121,15 +180,22 @@ void main(void)
 	spotlight.cone_angle = 25.f;
 	spotlight.cone_direction = vec3(0.f, -1.f, 0.f);
 	
-	intensity_to_eye += SpotlightLightSource(spotlight);
+	intensity_to_eye += SpotlightLightSource(spotlight, mat);
 
-	//Apply Lambert reflection to all lights and Phong where material is shiny
-	for (int i = 0; i < kNoOfLights; i++)
+	//Apply Lambert reflection to the lights reaching this froxel or
+	//instance and Phong where material is shiny
+	bool instance_lights = instance_light_lists != 0;
+	uvec2 light_list = instance_lights ? varying_light_list : texelFetch(cluster_table, clusterIndex()).rg;
+	for (uint i = 0u; i < light_list.y; i++)
 	{
-		intensity_to_eye += DiffuseLightSource(light_sources[i]);
-
-		if (mat.is_shiny)
-			intensity_to_eye += SpecularLightSource(light_sources[i]);
+		int list_entry = int(light_list.x + i);
+		uint light_index = instance_lights ? texelFetch(instance_light_indices, list_entry).r
+			: texelFetch(cluster_light_indices, list_entry).r;
+		Light light = fetchLight(int(light_index));
+		intensity_to_eye += DiffuseLightSource(light, mat);
+
+		if (mat.shininess > 0)
+			intensity_to_eye += SpecularLightSource(light, mat);
 	}
 	intensity_to_eye += (mat.ambient_colour * scene_ambient_light);
 
@@ -1,25 +1,44 @@
 #version 330
 
-//Add uniforms to take in the matrix
-uniform mat4 combined_matrix;
-uniform mat4 world_matrix;
+//Per-frame values, shared with the fragment shader through one std140
+//uniform buffer (see FrameBlockGL in ShaderBlocks.hpp)
+layout(std140) uniform FrameBlock
+{
+	mat4 combined_matrix;
+	vec3 camera_position;
+	int light_count;
+	vec3 scene_ambient_light;
+};
 
 //Add in variables for each of the streamed attributes
 in vec3 vertex_position;
 in vec3 vertex_normal;
 in vec2 texture_coordinates;
 
+//Per-instance attributes, these advance once per instance of a draw
+in mat4x3 instance_world_matrix;
+in int instance_material_index;
+in uvec2 instance_light_list;
+
 //Specify out variables to be varied to the FS
 out vec3 varying_position;
 out vec3 varying_normal;
 out vec2 varying_texture_coordinates;
+flat out int varying_material_index;
+flat out uvec2 varying_light_list;
+
+//The depth pre-pass computes the same position in depth_vs.glsl, invariance
+//makes both give bit-identical depths so GL_EQUAL passes
+invariant gl_Position;
 
 void main(void)
 {
 	//Transform the in variables to world space and pass to FS
-	varying_position = mat4x3(world_matrix) * vec4(vertex_position, 1.0);
-	varying_normal = mat3(world_matrix) * vertex_normal;
+	varying_position = instance_world_matrix * vec4(vertex_position, 1.0);
+	varying_normal = mat3(instance_world_matrix) * vertex_normal;
 	varying_texture_coordinates = (texture_coordinates + 1) / 2;
+	varying_material_index = instance_material_index;
+	varying_light_list = instance_light_list;
 
-	gl_Position = combined_matrix * world_matrix * vec4(vertex_position, 1.0);
+	gl_Position = combined_matrix * vec4(varying_position, 1.0);
 }
@@ -0,0 +1,1225 @@
+#include "Benchmark.hpp"
+#include "CommandList.hpp"
+#include "DrawList.hpp"
+#include "FrustumCuller.hpp"
+#include "InstanceLights.hpp"
+#include "LightClusters.hpp"
+#include "OcclusionCuller.hpp"
+#include <sponza/sponza.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	bool isSameVector(const sponza::Vector3& a, const sponza::Vector3& b)
+	{
+		return a.x == b.x && a.y == b.y && a.z == b.z;
+	}
+
+	bool isSameMatrix(const sponza::Matrix4x3& a, const sponza::Matrix4x3& b)
+	{
+		const float * pa = &a.m00;
+		const float * pb = &b.m00;
+		return std::equal(pa, pa + 12, pb);
+	}
+
+	//Compares the animated state of two scenes exactly, not within a tolerance
+	bool isSameSceneState(const sponza::Context& a, const sponza::Context& b)
+	{
+		const auto& lights_a = a.getAllLights();
+		const auto& lights_b = b.getAllLights();
+		if (lights_a.size() != lights_b.size())
+			return false;
+
+		for (size_t i = 0; i < lights_a.size(); i++)
+		{
+			if (!isSameVector(lights_a[i].getPosition(), lights_b[i].getPosition())
+				|| !isSameVector(lights_a[i].getIntensity(), lights_b[i].getIntensity())
+				|| lights_a[i].getRange() != lights_b[i].getRange())
+				return false;
+		}
+
+		const auto& instances_a = a.getAllInstances();
+		const auto& instances_b = b.getAllInstances();
+		if (instances_a.size() != instances_b.size())
+			return false;
+
+		for (size_t i = 0; i < instances_a.size(); i++)
+		{
+			if (!isSameMatrix(instances_a[i].getTransformationMatrix(),
+				instances_b[i].getTransformationMatrix()))
+				return false;
+		}
+		return true;
+	}
+
+	bool isLightTouchingBox(const sponza::Light& light, const sponza::Aabb& box)
+	{
+		const auto p = light.getPosition();
+		const float dx = std::max(std::max(box.min.x - p.x, 0.f), p.x - box.max.x);
+		const float dy = std::max(std::max(box.min.y - p.y, 0.f), p.y - box.max.y);
+		const float dz = std::max(std::max(box.min.z - p.z, 0.f), p.z - box.max.z);
+		return dx * dx + dy * dy + dz * dz <= light.getRange() * light.getRange();
+	}
+
+	//A point projected into a buffer's pixels, w is its view distance
+	struct ScreenVertex
+	{
+		float x, y, w;
+	};
+
+	//False for points too near or behind the camera to project
+	bool projectToScreen(const float * pv, float x, float y, float z, int width, int height, ScreenVertex& out)
+	{
+		const float clip_x = pv[0] * x + pv[4] * y + pv[8] * z + pv[12];
+		const float clip_y = pv[1] * x + pv[5] * y + pv[9] * z + pv[13];
+		out.w = pv[3] * x + pv[7] * y + pv[11] * z + pv[15];
+		if (out.w < 1e-3f)
+			return false;
+		out.x = (clip_x / out.w * 0.5f + 0.5f) * width;
+		out.y = (clip_y / out.w * 0.5f + 0.5f) * height;
+		return true;
+	}
+
+	//Calls visit(x, y, w) for every pixel whose centre is inside the
+	//triangle, or within tolerance pixels of it, with the triangle's exact
+	//perspective correct depth there
+	template<typename Visit>
+	void rasteriseReferenceTriangle(const ScreenVertex * v, int width, int height, float tolerance, Visit visit)
+	{
+		const float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+		if (area == 0.f)
+			return;
+		const float sign = area > 0.f ? 1.f : -1.f;
+		float edge_length[3];
+		for (int e = 0; e < 3; e++)
+		{
+			const ScreenVertex& a = v[(e + 1) % 3];
+			const ScreenVertex& b = v[(e + 2) % 3];
+			edge_length[e] = std::sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y));
+		}
+
+		const float x_min = std::min(v[0].x, std::min(v[1].x, v[2].x)) - tolerance;
+		const float x_max = std::max(v[0].x, std::max(v[1].x, v[2].x)) + tolerance;
+		const float y_min = std::min(v[0].y, std::min(v[1].y, v[2].y)) - tolerance;
+		const float y_max = std::max(v[0].y, std::max(v[1].y, v[2].y)) + tolerance;
+		const int x_begin = (int)std::max(0.f, std::ceil(x_min - 0.5f));
+		const int x_end = (int)std::min((float)width, std::floor(x_max - 0.5f) + 1.f);
+		const int y_begin = (int)std::max(0.f, std::ceil(y_min - 0.5f));
+		const int y_end = (int)std::min((float)height, std::floor(y_max - 0.5f) + 1.f);
+		for (int y = y_begin; y < y_end; y++)
+		{
+			for (int x = x_begin; x < x_end; x++)
+			{
+				const float px = x + 0.5f;
+				const float py = y + 0.5f;
+				float weight[3];
+				bool inside = true;
+				for (int e = 0; e < 3 && inside; e++)
+				{
+					//Twice the signed area facing vertex e, positive inside
+					const ScreenVertex& a = v[(e + 1) % 3];
+					const ScreenVertex& b = v[(e + 2) % 3];
+					const float edge = sign * ((b.x - a.x) * (py - a.y) - (px - a.x) * (b.y - a.y));
+					inside = edge >= -tolerance * edge_length[e];
+					weight[e] = edge / (sign * area);
+				}
+				if (!inside)
+					continue;
+				//1 / w is linear in screen space
+				const float inverse_w = weight[0] / v[0].w + weight[1] / v[1].w + weight[2] / v[2].w;
+				if (inverse_w > 0.f)
+					visit(x, y, 1.f / inverse_w);
+			}
+		}
+	}
+
+	//The occluders' nearest depth at every pixel centre, infinite where none
+	//covers it. Triangles reaching behind the near plane are left out, as
+	//the culler leaves them out. Coverage is grown by a hundredth of a pixel
+	//so centres on an edge the culler counted as covered are not missed
+	void rasteriseReferenceDepth(const float * projection_view,
+		const std::vector<std::pair<const sponza::Mesh *, sponza::Matrix4x3>>& occluders,
+		int width,
+		int height,
+		std::vector<float>& depth)
+	{
+		depth.assign(width * height, std::numeric_limits<float>::infinity());
+		for (const auto& occluder : occluders)
+		{
+			const auto& positions = occluder.first->getPositionArray();
+			const auto& elements = occluder.first->getElementArray();
+			const sponza::Matrix4x3& m = occluder.second;
+			for (size_t e = 0; e + 2 < elements.size(); e += 3)
+			{
+				ScreenVertex triangle[3];
+				bool projectable = true;
+				for (int k = 0; k < 3 && projectable; k++)
+				{
+					const sponza::Vector3& p = positions[elements[e + k]];
+					projectable = projectToScreen(projection_view,
+						m.m00 * p.x + m.m10 * p.y + m.m20 * p.z + m.m30,
+						m.m01 * p.x + m.m11 * p.y + m.m21 * p.z + m.m31,
+						m.m02 * p.x + m.m12 * p.y + m.m22 * p.z + m.m32,
+						width, height, triangle[k]);
+				}
+				if (!projectable)
+					continue;
+				rasteriseReferenceTriangle(triangle, width, height, 0.01f, [&](int x, int y, float w)
+				{
+					float& pixel = depth[y * width + x];
+					pixel = std::min(pixel, w);
+				});
+			}
+		}
+	}
+
+	//Whether any pixel centre sees the box's world bounds, the box the
+	//culler tests, in front of the reference depth. Its twelve faces are
+	//rasterised exactly and the depths compared with a little slack for
+	//rounding. Boxes reaching behind the camera count as visible
+	bool isBoxVisibleInReference(const float * projection_view,
+		const OcclusionCuller::Box& box,
+		int width,
+		int height,
+		const std::vector<float>& depth)
+	{
+		const sponza::Vector3 c = box.bounds.centre();
+		const float lx = 0.5f * (box.bounds.max.x - box.bounds.min.x);
+		const float ly = 0.5f * (box.bounds.max.y - box.bounds.min.y);
+		const float lz = 0.5f * (box.bounds.max.z - box.bounds.min.z);
+		const sponza::Matrix4x3& m = box.world;
+		const float centre[3] = {
+			m.m00 * c.x + m.m10 * c.y + m.m20 * c.z + m.m30,
+			m.m01 * c.x + m.m11 * c.y + m.m21 * c.z + m.m31,
+			m.m02 * c.x + m.m12 * c.y + m.m22 * c.z + m.m32 };
+		const float half[3] = {
+			std::fabs(m.m00) * lx + std::fabs(m.m10) * ly + std::fabs(m.m20) * lz,
+			std::fabs(m.m01) * lx + std::fabs(m.m11) * ly + std::fabs(m.m21) * lz,
+			std::fabs(m.m02) * lx + std::fabs(m.m12) * ly + std::fabs(m.m22) * lz };
+
+		//Corner k has the high x, y and z of the box where bits 0, 1 and 2 are set
+		ScreenVertex corners[8];
+		for (int k = 0; k < 8; k++)
+		{
+			if (!projectToScreen(projection_view,
+				centre[0] + ((k & 1) ? half[0] : -half[0]),
+				centre[1] + ((k & 2) ? half[1] : -half[1]),
+				centre[2] + ((k & 4) ? half[2] : -half[2]),
+				width, height, corners[k]))
+				return true;
+		}
+
+		const int faces[6][4] = {
+			{ 0, 2, 6, 4 }, { 1, 3, 7, 5 }, { 0, 1, 5, 4 },
+			{ 2, 3, 7, 6 }, { 0, 1, 3, 2 }, { 4, 5, 7, 6 } };
+		bool visible = false;
+		for (const auto& face : faces)
+		{
+			for (int t = 0; t < 2 && !visible; t++)
+			{
+				const ScreenVertex triangle[3] = { corners[face[0]], corners[face[t + 1]], corners[face[t + 2]] };
+				rasteriseReferenceTriangle(triangle, width, height, 0.f, [&](int x, int y, float w)
+				{
+					if (w < depth[y * width + x] * (1.f - 1e-4f))
+						visible = true;
+				});
+			}
+		}
+		return visible;
+	}
+
+	//The scene camera's view matrix, built as the views build it
+	glm::mat4 cameraView(const sponza::Context& scene)
+	{
+		const auto& camera = scene.getCamera();
+		const auto eye = camera.getPosition();
+		const auto direction = camera.getDirection();
+		const auto up = scene.getUpDirection();
+		const glm::vec3 eye_position(eye.x, eye.y, eye.z);
+		return glm::lookAt(eye_position,
+			eye_position + glm::vec3(direction.x, direction.y, direction.z),
+			glm::vec3(up.x, up.y, up.z));
+	}
+
+	//The scene camera's projection * view
+	glm::mat4 cameraProjectionView(const sponza::Context& scene, float aspect_ratio)
+	{
+		const auto& camera = scene.getCamera();
+		const glm::mat4 projection = glm::perspective(glm::radians(camera.getVerticalFieldOfViewInDegrees()),
+			aspect_ratio, camera.getNearPlaneDistance(), camera.getFarPlaneDistance());
+		return projection * cameraView(scene);
+	}
+}
+
+void runUpdateScalingBenchmark(std::ostream& out)
+{
+	sponza::SceneSettings settings;
+	settings.animated_instance_copies = 100000;
+	settings.orb_light_count = 10000;
+
+	const int warmup_frames = 10;
+	const int timed_frames = 100;
+	const double frame_step = 1.0 / 60.0;
+	const unsigned int max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	out << "Context::update scaling: "
+		<< settings.animated_instance_copies << " animated instances, "
+		<< settings.orb_light_count << " lights, "
+		<< timed_frames << " frames" << std::endl;
+	out << std::setw(8) << "threads"
+		<< std::setw(12) << "ms/frame"
+		<< std::setw(10) << "speedup"
+		<< std::setw(12) << "identical" << std::endl;
+
+	std::unique_ptr<sponza::Context> serial_scene;
+	double serial_ms = 0;
+
+	for (unsigned int threads = 1; threads <= max_threads; threads++)
+	{
+		sponza::JobSystem jobs(threads - 1);
+		auto scene = std::make_unique<sponza::Context>(
+			std::make_unique<sponza::FixedStepClock>(frame_step), settings);
+		scene->setJobSystem(&jobs);
+
+		for (int f = 0; f < warmup_frames; f++)
+			scene->update();
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int f = 0; f < timed_frames; f++)
+			scene->update();
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		const double ms = std::chrono::duration<double, std::milli>(elapsed).count()
+			/ timed_frames;
+
+		//Point the finished scene back at the shared pool, the local one is about to go
+		scene->setJobSystem(nullptr);
+
+		if (threads == 1)
+		{
+			serial_ms = ms;
+			serial_scene = std::move(scene);
+		}
+
+		const bool identical = (threads == 1) || isSameSceneState(*serial_scene, *scene);
+
+		out << std::setw(8) << threads
+			<< std::setw(12) << std::fixed << std::setprecision(3) << ms
+			<< std::setw(10) << std::setprecision(2) << serial_ms / ms
+			<< std::setw(12) << (identical ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runLightQueryBenchmark(std::ostream& out)
+{
+	const unsigned int light_counts[] = { 20, 200, 2000, 20000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+
+	out << "Light queries against each instance's bounds, "
+		<< frames << " frames" << std::endl;
+	out << std::setw(8) << "lights"
+		<< std::setw(12) << "hits/query"
+		<< std::setw(12) << "grid us"
+		<< std::setw(12) << "brute us"
+		<< std::setw(12) << "identical" << std::endl;
+
+	for (const unsigned int light_count : light_counts)
+	{
+		sponza::SceneSettings settings;
+		settings.animated_instance_copies = 1000;
+		settings.orb_light_count = light_count;
+
+		sponza::Context scene(
+			std::make_unique<sponza::FixedStepClock>(frame_step), settings);
+
+		std::vector<sponza::LightId> grid_hits;
+		std::vector<sponza::LightId> brute_hits;
+		double grid_us = 0;
+		double brute_us = 0;
+		size_t hit_count = 0;
+		size_t query_count = 0;
+		bool identical = true;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& lights = scene.getAllLights();
+
+			for (const auto& instance : scene.getAllInstances())
+			{
+				const auto box = scene.getInstanceBoundsById(instance.getId());
+
+				grid_hits.clear();
+				const auto grid_start = std::chrono::steady_clock::now();
+				scene.findLightsInAabb(box, grid_hits);
+				const auto grid_end = std::chrono::steady_clock::now();
+
+				brute_hits.clear();
+				for (const auto& light : lights)
+				{
+					if (isLightTouchingBox(light, box))
+						brute_hits.push_back(light.getId());
+				}
+				const auto brute_end = std::chrono::steady_clock::now();
+
+				grid_us += std::chrono::duration<double, std::micro>(grid_end - grid_start).count();
+				brute_us += std::chrono::duration<double, std::micro>(brute_end - grid_end).count();
+
+				std::sort(grid_hits.begin(), grid_hits.end());
+				std::sort(brute_hits.begin(), brute_hits.end());
+				identical = identical && grid_hits == brute_hits;
+				hit_count += grid_hits.size();
+				query_count++;
+			}
+		}
+
+		out << std::setw(8) << light_count + 2
+			<< std::setw(12) << std::fixed << std::setprecision(1)
+			<< (double)hit_count / query_count
+			<< std::setw(12) << std::setprecision(3) << grid_us / query_count
+			<< std::setw(12) << brute_us / query_count
+			<< std::setw(12) << (identical ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runInstanceLightBenchmark(std::ostream& out)
+{
+	const unsigned int light_counts[] = { 20, 200, 2000, 20000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+	const int max_lights = InstanceLights::kMaxLightsPerInstance;
+
+	out << "Instance light lists of at most " << max_lights << " lights against every light, "
+		<< frames << " frames" << std::endl;
+	out << std::setw(8) << "lights"
+		<< std::setw(14) << "lights/inst"
+		<< std::setw(12) << "truncated"
+		<< std::setw(12) << "assign us"
+		<< std::setw(12) << "brute us"
+		<< std::setw(10) << "correct" << std::endl;
+
+	for (const unsigned int light_count : light_counts)
+	{
+		sponza::SceneSettings settings;
+		settings.animated_instance_copies = 1000;
+		settings.orb_light_count = light_count;
+
+		sponza::Context scene(
+			std::make_unique<sponza::FixedStepClock>(frame_step), settings);
+
+		InstanceLights instance_lights;
+		std::vector<InstanceLights::Box> boxes;
+		std::vector<unsigned int> listed;
+		std::vector<unsigned int> touching;
+		double assign_us = 0;
+		double brute_us = 0;
+		size_t index_total = 0;
+		size_t truncated_total = 0;
+		size_t instance_total = 0;
+		bool correct = true;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& lights = scene.getAllLights();
+			boxes.clear();
+			for (const auto& instance : scene.getAllInstances())
+			{
+				InstanceLights::Box box;
+				box.bounds = scene.getMeshBoundsById(instance.getMeshId());
+				box.world = instance.getTransformationMatrix();
+				boxes.push_back(box);
+			}
+
+			const auto assign_start = std::chrono::steady_clock::now();
+			instance_lights.setLights(lights);
+			instance_lights.assign(boxes);
+			const auto assign_end = std::chrono::steady_clock::now();
+			assign_us += std::chrono::duration<double, std::micro>(assign_end - assign_start).count();
+
+			const auto& table = instance_lights.getInstanceTable();
+			const auto& indices = instance_lights.getLightIndices();
+			for (size_t i = 0; i < boxes.size(); i++)
+			{
+				//Every light tested against the same world box
+				const auto brute_start = std::chrono::steady_clock::now();
+				const sponza::Aabb box = InstanceLights::getWorldBounds(boxes[i]);
+				touching.clear();
+				for (size_t l = 0; l < lights.size(); l++)
+				{
+					if (isLightTouchingBox(lights[l], box))
+						touching.push_back((unsigned int)l);
+				}
+				brute_us += std::chrono::duration<double, std::micro>(
+					std::chrono::steady_clock::now() - brute_start).count();
+
+				listed.assign(indices.begin() + table[2 * i], indices.begin() + table[2 * i] + table[2 * i + 1]);
+				std::sort(listed.begin(), listed.end());
+				if (touching.size() <= (size_t)max_lights)
+				{
+					correct = correct && listed == touching;
+					continue;
+				}
+
+				//Past the limit the list must be kMaxLightsPerInstance of the
+				//touching lights, none dimmer at the box than any left out
+				truncated_total++;
+				auto brightnessAtBox = [&](unsigned int l)
+				{
+					const auto p = lights[l].getPosition();
+					const auto intensity = lights[l].getIntensity();
+					const float dx = std::max(0.f, std::max(box.min.x - p.x, p.x - box.max.x));
+					const float dy = std::max(0.f, std::max(box.min.y - p.y, p.y - box.max.y));
+					const float dz = std::max(0.f, std::max(box.min.z - p.z, p.z - box.max.z));
+					const float falloff = 1.f - std::sqrt(dx * dx + dy * dy + dz * dz) / lights[l].getRange();
+					return std::max(intensity.x, std::max(intensity.y, intensity.z)) * falloff;
+				};
+				correct = correct && listed.size() == (size_t)max_lights
+					&& std::adjacent_find(listed.begin(), listed.end()) == listed.end()
+					&& std::includes(touching.begin(), touching.end(), listed.begin(), listed.end());
+				float dimmest_listed = std::numeric_limits<float>::max();
+				for (const auto l : listed)
+					dimmest_listed = std::min(dimmest_listed, brightnessAtBox(l));
+				for (const auto l : touching)
+				{
+					if (!std::binary_search(listed.begin(), listed.end(), l))
+						correct = correct && brightnessAtBox(l) <= dimmest_listed;
+				}
+			}
+			index_total += indices.size();
+			instance_total += boxes.size();
+		}
+
+		out << std::setw(8) << light_count + 2
+			<< std::setw(14) << std::fixed << std::setprecision(1) << (double)index_total / instance_total
+			<< std::setw(12) << truncated_total / frames
+			<< std::setw(12) << assign_us / frames
+			<< std::setw(12) << brute_us / frames
+			<< std::setw(10) << (correct ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runLightClusterBenchmark(std::ostream& out)
+{
+	const unsigned int light_counts[] = { 20, 200, 2000, 20000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+	const float aspect_ratio = 16.f / 9.f;
+
+	out << "Light clusters, " << LightClusters::kClusterCount << " froxels against every light, "
+		<< frames << " frames" << std::endl;
+	out << std::setw(8) << "lights"
+		<< std::setw(10) << "visible"
+		<< std::setw(12) << "indices"
+		<< std::setw(12) << "assign us"
+		<< std::setw(12) << "brute us"
+		<< std::setw(10) << "correct" << std::endl;
+
+	for (const unsigned int light_count : light_counts)
+	{
+		sponza::SceneSettings settings;
+		settings.animated_instance_copies = 1000;
+		settings.orb_light_count = light_count;
+
+		sponza::Context scene(
+			std::make_unique<sponza::FixedStepClock>(frame_step), settings);
+
+		LightClusters clusters;
+		std::vector<LightClusters::Sphere> spheres;
+		std::vector<std::vector<unsigned int>> box_lists(LightClusters::kClusterCount);
+		std::vector<std::vector<unsigned int>> froxel_lists(LightClusters::kClusterCount);
+		double assign_us = 0;
+		double brute_us = 0;
+		size_t visible_total = 0;
+		size_t index_total = 0;
+		bool correct = true;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& lights = scene.getAllLights();
+			spheres.resize(lights.size());
+			for (size_t l = 0; l < lights.size(); l++)
+			{
+				spheres[l].centre = lights[l].getPosition();
+				spheres[l].radius = lights[l].getRange();
+			}
+
+			const auto& camera = scene.getCamera();
+			const glm::mat4 view = cameraView(scene);
+			const float fovy = glm::radians(camera.getVerticalFieldOfViewInDegrees());
+			const float near_plane = camera.getNearPlaneDistance();
+			const float far_plane = camera.getFarPlaneDistance();
+			clusters.setView(glm::value_ptr(view), fovy, aspect_ratio, near_plane, far_plane);
+			const auto assign_start = std::chrono::steady_clock::now();
+			clusters.assign(spheres);
+			const auto assign_end = std::chrono::steady_clock::now();
+
+			//Every light against every froxel's box, with none of the depth
+			//or tile ranges that narrow the search, into the same view space
+			const float * v = glm::value_ptr(view);
+			const double tan_half_y = std::tan(fovy * 0.5);
+			const double tan_half_x = tan_half_y * aspect_ratio;
+			for (int cluster = 0; cluster < LightClusters::kClusterCount; cluster++)
+			{
+				box_lists[cluster].clear();
+				froxel_lists[cluster].clear();
+			}
+			for (size_t l = 0; l < spheres.size(); l++)
+			{
+				const auto& c = spheres[l].centre;
+				const float centre[3] = {
+					v[0] * c.x + v[4] * c.y + v[8] * c.z + v[12],
+					v[1] * c.x + v[5] * c.y + v[9] * c.z + v[13],
+					-(v[2] * c.x + v[6] * c.y + v[10] * c.z + v[14]) };
+				const float radius_squared = spheres[l].radius * spheres[l].radius;
+				for (int cluster = 0; cluster < LightClusters::kClusterCount; cluster++)
+				{
+					const LightClusters::Bounds& bounds = clusters.getClusterBounds(cluster);
+					float distance_squared = 0.f;
+					for (int axis = 0; axis < 3; axis++)
+					{
+						const float nearest = std::max(bounds.min[axis], std::min(centre[axis], bounds.max[axis]));
+						distance_squared += (centre[axis] - nearest) * (centre[axis] - nearest);
+					}
+					if (distance_squared > radius_squared)
+						continue;
+					box_lists[cluster].push_back((unsigned int)l);
+
+					//The froxel itself is narrower than its box. At each depth it
+					//is a rectangle, and the distance to the nearest rectangle is
+					//convex in depth, so a ternary search finds the true distance
+					const int x = cluster % LightClusters::kTilesX;
+					const int y = cluster / LightClusters::kTilesX % LightClusters::kTilesY;
+					const double x0 = (-1.0 + 2.0 * x / LightClusters::kTilesX) * tan_half_x;
+					const double x1 = (-1.0 + 2.0 * (x + 1) / LightClusters::kTilesX) * tan_half_x;
+					const double y0 = (-1.0 + 2.0 * y / LightClusters::kTilesY) * tan_half_y;
+					const double y1 = (-1.0 + 2.0 * (y + 1) / LightClusters::kTilesY) * tan_half_y;
+					auto distanceSquaredAt = [&](double z)
+					{
+						const double dx = centre[0] - std::max(x0 * z, std::min((double)centre[0], x1 * z));
+						const double dy = centre[1] - std::max(y0 * z, std::min((double)centre[1], y1 * z));
+						return dx * dx + dy * dy + (centre[2] - z) * (centre[2] - z);
+					};
+					double z_near = bounds.min[2];
+					double z_far = bounds.max[2];
+					for (int i = 0; i < 100; i++)
+					{
+						const double a = z_near + (z_far - z_near) / 3.0;
+						const double b = z_far - (z_far - z_near) / 3.0;
+						if (distanceSquaredAt(a) < distanceSquaredAt(b))
+							z_far = b;
+						else
+							z_near = a;
+					}
+					//Lights that only graze the froxel may fall either way
+					if (distanceSquaredAt(0.5 * (z_near + z_far)) < radius_squared * (1.0 - 1e-4))
+						froxel_lists[cluster].push_back((unsigned int)l);
+				}
+			}
+			const auto brute_end = std::chrono::steady_clock::now();
+
+			assign_us += std::chrono::duration<double, std::micro>(assign_end - assign_start).count();
+			brute_us += std::chrono::duration<double, std::micro>(brute_end - assign_end).count();
+
+			//The tile and depth ranges may leave out lights that touch only
+			//the box, but never one that reaches the froxel. All three lists
+			//are in light order
+			const auto& table = clusters.getClusterTable();
+			const auto& indices = clusters.getLightIndices();
+			for (int cluster = 0; cluster < LightClusters::kClusterCount; cluster++)
+			{
+				const auto first = indices.begin() + table[2 * cluster];
+				const auto last = first + table[2 * cluster + 1];
+				correct = correct && std::is_sorted(first, last)
+					&& std::includes(first, last, froxel_lists[cluster].begin(), froxel_lists[cluster].end())
+					&& std::includes(box_lists[cluster].begin(), box_lists[cluster].end(), first, last);
+			}
+			visible_total += clusters.getStatistics().visible_lights;
+			index_total += indices.size();
+		}
+
+		out << std::setw(8) << light_count + 2
+			<< std::setw(10) << visible_total / frames
+			<< std::setw(12) << index_total / frames
+			<< std::setw(12) << std::fixed << std::setprecision(1) << assign_us / frames
+			<< std::setw(12) << brute_us / frames
+			<< std::setw(10) << (correct ? "yes" : "NO") << std::endl;
+	}
+}
+
+sponza::SceneSettings makeStressSceneSettings(unsigned int instance_count,
+	unsigned int light_count,
+	unsigned int seed)
+{
+	//The stock instance count comes from the data file so load it once
+	static const size_t stock_instance_count = sponza::Context(
+		std::make_unique<sponza::FixedStepClock>(1.0)).getAllInstances().size();
+
+	const unsigned int replicas = std::max(1u,
+		(unsigned int)((instance_count + stock_instance_count - 1) / stock_instance_count));
+
+	sponza::SceneSettings settings;
+	settings.replica_rows = std::max(1u, (unsigned int)std::sqrt((double)replicas));
+	settings.replica_columns = (replicas + settings.replica_rows - 1) / settings.replica_rows;
+	settings.orb_light_count = light_count > 2 ? light_count - 2 : 0;
+	settings.seed = seed;
+	return settings;
+}
+
+void runSceneScalingBenchmark(std::ostream& out)
+{
+	const unsigned int scales[][2] = {
+		{ 100, 22 }, { 1000, 100 }, { 10000, 1000 }, { 100000, 10000 } };
+	const int frames = 30;
+	const size_t max_queries_per_frame = 1000;
+	const double frame_step = 1.0 / 60.0;
+
+	out << "Generated scene scaling, " << frames << " frames each" << std::endl;
+	out << std::setw(10) << "instances"
+		<< std::setw(8) << "lights"
+		<< std::setw(12) << "build ms"
+		<< std::setw(12) << "update ms"
+		<< std::setw(14) << "sphere us"
+		<< std::setw(14) << "lights us" << std::endl;
+
+	for (const auto& scale : scales)
+	{
+		const auto settings = makeStressSceneSettings(scale[0], scale[1], 1);
+
+		const auto build_start = std::chrono::steady_clock::now();
+		sponza::Context scene(
+			std::make_unique<sponza::FixedStepClock>(frame_step), settings);
+		const auto build_end = std::chrono::steady_clock::now();
+
+		double update_ms = 0;
+		double sphere_us = 0;
+		double lights_us = 0;
+		size_t query_count = 0;
+		std::vector<sponza::InstanceId> instance_hits;
+		std::vector<sponza::LightId> light_hits;
+
+		for (int f = 0; f < frames; f++)
+		{
+			const auto update_start = std::chrono::steady_clock::now();
+			scene.update();
+			const auto update_end = std::chrono::steady_clock::now();
+			update_ms += std::chrono::duration<double, std::milli>(update_end - update_start).count();
+
+			//Sample instances evenly so large scenes take the same number of queries
+			const auto& instances = scene.getAllInstances();
+			const size_t stride = std::max<size_t>(1, instances.size() / max_queries_per_frame);
+			for (size_t i = 0; i < instances.size(); i += stride)
+			{
+				const auto box = scene.getInstanceBoundsById(instances[i].getId());
+				const auto centre = box.centre();
+
+				instance_hits.clear();
+				const auto sphere_start = std::chrono::steady_clock::now();
+				scene.findInstancesInSphere(centre, 20.f, instance_hits);
+				const auto sphere_end = std::chrono::steady_clock::now();
+
+				light_hits.clear();
+				scene.findLightsInAabb(box, light_hits);
+				const auto lights_end = std::chrono::steady_clock::now();
+
+				sphere_us += std::chrono::duration<double, std::micro>(sphere_end - sphere_start).count();
+				lights_us += std::chrono::duration<double, std::micro>(lights_end - sphere_end).count();
+				query_count++;
+			}
+		}
+
+		out << std::setw(10) << scene.getAllInstances().size()
+			<< std::setw(8) << settings.orb_light_count + 2
+			<< std::setw(12) << std::fixed << std::setprecision(1)
+			<< std::chrono::duration<double, std::milli>(build_end - build_start).count()
+			<< std::setw(12) << std::setprecision(3) << update_ms / frames
+			<< std::setw(14) << sphere_us / query_count
+			<< std::setw(14) << lights_us / query_count << std::endl;
+	}
+}
+
+void runDrawOrderBenchmark(std::ostream& out)
+{
+	const unsigned int instance_counts[] = { 100, 1000, 10000, 100000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+
+	out << "Draw order, " << frames << " frames each" << std::endl;
+	out << std::setw(10) << "instances"
+		<< std::setw(14) << "scene order"
+		<< std::setw(10) << "sorted"
+		<< std::setw(12) << "radix us"
+		<< std::setw(12) << "stable us"
+		<< std::setw(10) << "same" << std::endl;
+
+	for (const auto count : instance_counts)
+	{
+		sponza::Context scene(std::make_unique<sponza::FixedStepClock>(frame_step),
+			makeStressSceneSettings(count, 22, 1));
+
+		//Materials are numbered as the view numbers them
+		std::map<sponza::MaterialId, int> index_by_material;
+		for (const auto& material : scene.getAllMaterials())
+		{
+			const int material_index = (int)index_by_material.size();
+			index_by_material[material.getId()] = material_index;
+		}
+
+		//Meshes are numbered as the view numbers them, in builder order
+		std::vector<sponza::MeshId> mesh_ids;
+		for (const auto& instance : scene.getAllInstances())
+			mesh_ids.push_back(instance.getMeshId());
+		std::sort(mesh_ids.begin(), mesh_ids.end());
+		mesh_ids.erase(std::unique(mesh_ids.begin(), mesh_ids.end()), mesh_ids.end());
+
+		DrawList list;
+		DrawStateChanges unsorted;
+		DrawStateChanges sorted;
+		double radix_us = 0;
+		double stable_us = 0;
+		bool same = true;
+		std::vector<DrawList::Item> reference;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& camera = scene.getCamera();
+			const auto eye = camera.getPosition();
+			const auto direction = camera.getDirection();
+
+			list.clear();
+			for (size_t m = 0; m < mesh_ids.size(); m++)
+			{
+				for (const auto id : scene.getInstancesByMeshId(mesh_ids[m]))
+				{
+					const auto& instance = scene.getInstanceById(id);
+					const auto xform = instance.getTransformationMatrix();
+					const float depth = (xform.m30 - eye.x) * direction.x
+						+ (xform.m31 - eye.y) * direction.y
+						+ (xform.m32 - eye.z) * direction.z;
+					list.add(DrawList::makeKey(DrawList::kOpaquePass, 0,
+						DrawList::kNoTextureSet, index_by_material[instance.getMaterialId()], (int)m,
+						DrawList::quantizeDepth(depth, camera.getNearPlaneDistance(), camera.getFarPlaneDistance())),
+						(unsigned int)list.items().size());
+				}
+			}
+
+			unsorted = list.countStateChanges();
+			reference = list.items();
+
+			const auto radix_start = std::chrono::steady_clock::now();
+			list.sort();
+			const auto radix_end = std::chrono::steady_clock::now();
+			std::stable_sort(reference.begin(), reference.end(),
+				[](const DrawList::Item& a, const DrawList::Item& b) { return a.key < b.key; });
+			const auto stable_end = std::chrono::steady_clock::now();
+
+			radix_us += std::chrono::duration<double, std::micro>(radix_end - radix_start).count();
+			stable_us += std::chrono::duration<double, std::micro>(stable_end - radix_end).count();
+			sorted = list.countStateChanges();
+
+			//Both sorts are stable so the payloads must come out identically
+			for (size_t i = 0; same && i < reference.size(); i++)
+				same = reference[i].key == list.items()[i].key && reference[i].payload == list.items()[i].payload;
+		}
+
+		out << std::setw(10) << scene.getAllInstances().size()
+			<< std::setw(14) << unsorted.total()
+			<< std::setw(10) << sorted.total()
+			<< std::setw(12) << std::fixed << std::setprecision(1) << radix_us / frames
+			<< std::setw(12) << stable_us / frames
+			<< std::setw(10) << (same ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runOcclusionBenchmark(std::ostream& out)
+{
+	const unsigned int instance_counts[] = { 1000, 10000, 100000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+
+	//The same buffer size, occluder meshes and budget as MyView
+	const int buffer_width = 256;
+	const int buffer_height = 128;
+	const int max_occluder_mesh_triangles = 1024;
+	const int occluder_triangle_budget = 16384;
+	const float aspect_ratio = 16.f / 9.f;
+
+	out << "Occlusion culling, " << frames << " frames each. Correct is NO if a box"
+		<< " culled is seen in front of an exact per-pixel raster of the same occluders" << std::endl;
+	out << std::setw(10) << "instances"
+		<< std::setw(12) << "in frustum"
+		<< std::setw(10) << "occluded"
+		<< std::setw(12) << "occluders"
+		<< std::setw(12) << "draw us"
+		<< std::setw(12) << "test us"
+		<< std::setw(10) << "correct" << std::endl;
+
+	for (const auto count : instance_counts)
+	{
+		sponza::Context scene(std::make_unique<sponza::FixedStepClock>(frame_step),
+			makeStressSceneSettings(count, 22, 1));
+
+		OcclusionCuller occlusion;
+		occlusion.resize(buffer_width, buffer_height);
+		std::map<sponza::MeshId, int> occluder_by_mesh;
+		std::map<sponza::MeshId, const sponza::Mesh *> mesh_by_id;
+		sponza::GeometryBuilder builder;
+		for (const auto& mesh : builder.getAllMeshes())
+		{
+			mesh_by_id[mesh.getId()] = &mesh;
+			if ((int)mesh.getElementArray().size() / 3 <= max_occluder_mesh_triangles)
+				occluder_by_mesh[mesh.getId()] = occlusion.addOccluderMesh(mesh.getPositionArray(), mesh.getElementArray());
+		}
+
+		FrustumCuller frustum;
+		std::vector<OcclusionCuller::Box> boxes;
+		std::vector<unsigned int> visible;
+		std::vector<std::pair<float, unsigned int>> candidates;
+		std::vector<std::pair<const sponza::Mesh *, sponza::Matrix4x3>> occluders;
+		std::vector<unsigned int> in_frustum_list;
+		std::vector<unsigned char> kept;
+		std::vector<float> reference_depth;
+		bool correct = true;
+		size_t in_frustum = 0;
+		size_t occluded = 0;
+		size_t occluder_triangles = 0;
+		double draw_us = 0;
+		double test_us = 0;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& camera = scene.getCamera();
+			const auto eye = camera.getPosition();
+			const auto direction = camera.getDirection();
+			const glm::mat4 projection_view = cameraProjectionView(scene, aspect_ratio);
+
+			const auto& instances = scene.getAllInstances();
+			frustum.clear();
+			frustum.setFrustum(glm::value_ptr(projection_view));
+			boxes.resize(instances.size());
+			for (size_t i = 0; i < instances.size(); i++)
+			{
+				boxes[i].bounds = scene.getMeshBoundsById(instances[i].getMeshId());
+				boxes[i].world = instances[i].getTransformationMatrix();
+				frustum.add(boxes[i].bounds, boxes[i].world);
+			}
+			frustum.cull(visible);
+			in_frustum += visible.size();
+
+			occlusion.beginFrame(glm::value_ptr(projection_view));
+			candidates.clear();
+			occluders.clear();
+			for (const auto index : visible)
+			{
+				if (occluder_by_mesh.count(instances[index].getMeshId()) == 0)
+					continue;
+				const auto& xform = boxes[index].world;
+				candidates.push_back(std::make_pair((xform.m30 - eye.x) * direction.x
+					+ (xform.m31 - eye.y) * direction.y
+					+ (xform.m32 - eye.z) * direction.z, index));
+			}
+			std::sort(candidates.begin(), candidates.end());
+			int triangles = 0;
+			for (const auto& candidate : candidates)
+			{
+				const int mesh = occluder_by_mesh[instances[candidate.second].getMeshId()];
+				if (triangles + occlusion.getOccluderMeshTriangleCount(mesh) > occluder_triangle_budget)
+					break;
+				occlusion.addOccluder(mesh, boxes[candidate.second].world);
+				occluders.push_back(std::make_pair(mesh_by_id[instances[candidate.second].getMeshId()], boxes[candidate.second].world));
+				triangles += occlusion.getOccluderMeshTriangleCount(mesh);
+			}
+			occlusion.renderOccluders();
+			in_frustum_list = visible;
+			occlusion.cull(boxes, visible);
+
+			//Every box the culler removed must be hidden in the reference too
+			rasteriseReferenceDepth(glm::value_ptr(projection_view), occluders,
+				occlusion.getWidth(), occlusion.getHeight(), reference_depth);
+			kept.assign(boxes.size(), 0);
+			for (const auto index : visible)
+				kept[index] = 1;
+			for (const auto index : in_frustum_list)
+			{
+				if (kept[index] == 0 && isBoxVisibleInReference(glm::value_ptr(projection_view), boxes[index],
+					occlusion.getWidth(), occlusion.getHeight(), reference_depth))
+					correct = false;
+			}
+
+			const auto& statistics = occlusion.getStatistics();
+			occluded += statistics.occluded;
+			occluder_triangles += statistics.rasterised_triangles;
+			draw_us += statistics.render_microseconds;
+			test_us += statistics.test_microseconds;
+		}
+
+		out << std::setw(10) << scene.getAllInstances().size()
+			<< std::setw(12) << in_frustum / frames
+			<< std::setw(10) << occluded / frames
+			<< std::setw(12) << occluder_triangles / frames
+			<< std::setw(12) << std::fixed << std::setprecision(1) << draw_us / frames
+			<< std::setw(12) << test_us / frames
+			<< std::setw(10) << (correct ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runFrustumCullingBenchmark(std::ostream& out)
+{
+	const unsigned int instance_counts[] = { 1000, 10000, 100000 };
+	const int frames = 20;
+	const double frame_step = 1.0 / 60.0;
+	const float aspect_ratio = 16.f / 9.f;
+	const FrustumCuller::InstructionSet instruction_sets[] = {
+		FrustumCuller::kScalar, FrustumCuller::kSse, FrustumCuller::kAvx2 };
+	const FrustumCuller::InstructionSet supported = FrustumCuller::getSupportedInstructionSet();
+
+	out << "Frustum culling, " << frames << " frames each on one thread, best supported "
+		<< FrustumCuller::getInstructionSetName(supported) << std::endl;
+	out << std::setw(10) << "instances"
+		<< std::setw(10) << "visible";
+	for (const auto instruction_set : instruction_sets)
+		out << std::setw(12) << std::string(FrustumCuller::getInstructionSetName(instruction_set)) + " us";
+	out << std::setw(12) << "identical" << std::endl;
+
+	//One thread so the times compare the instruction sets alone
+	sponza::JobSystem serial_jobs(0);
+
+	for (const auto count : instance_counts)
+	{
+		sponza::Context scene(std::make_unique<sponza::FixedStepClock>(frame_step),
+			makeStressSceneSettings(count, 22, 1));
+
+		FrustumCuller frustum;
+		frustum.setJobSystem(&serial_jobs);
+		std::vector<unsigned int> visible;
+		std::vector<unsigned int> reference;
+		std::vector<sponza::InstanceId> culled_ids;
+		std::vector<sponza::InstanceId> bvh_ids;
+		double microseconds[3] = {};
+		size_t visible_total = 0;
+		bool identical = true;
+
+		for (int f = 0; f < frames; f++)
+		{
+			scene.update();
+			const auto& instances = scene.getAllInstances();
+			frustum.clear();
+			frustum.setFrustum(glm::value_ptr(cameraProjectionView(scene, aspect_ratio)));
+			for (const auto& instance : instances)
+				frustum.add(scene.getMeshBoundsById(instance.getMeshId()), instance.getTransformationMatrix());
+
+			//Every path must give exactly the scalar path's list
+			for (int s = 0; s < 3; s++)
+			{
+				if (instruction_sets[s] > supported)
+					continue;
+				frustum.setInstructionSet(instruction_sets[s]);
+				const auto start = std::chrono::steady_clock::now();
+				frustum.cull(visible);
+				microseconds[s] += std::chrono::duration<double, std::micro>(
+					std::chrono::steady_clock::now() - start).count();
+				if (s == 0)
+					reference = visible;
+				else
+					identical = identical && visible == reference;
+			}
+
+			//The scene's BVH tests the same planes against the same world boxes
+			culled_ids.clear();
+			for (const auto index : reference)
+				culled_ids.push_back(instances[index].getId());
+			bvh_ids.clear();
+			scene.findInstancesInFrustum(frustum.getPlanes(), 6, bvh_ids);
+			std::sort(culled_ids.begin(), culled_ids.end());
+			std::sort(bvh_ids.begin(), bvh_ids.end());
+			identical = identical && culled_ids == bvh_ids;
+			visible_total += reference.size();
+		}
+
+		out << std::setw(10) << scene.getAllInstances().size()
+			<< std::setw(10) << visible_total / frames;
+		for (int s = 0; s < 3; s++)
+		{
+			if (instruction_sets[s] > supported)
+				out << std::setw(12) << "-";
+			else
+				out << std::setw(12) << std::fixed << std::setprecision(1) << microseconds[s] / frames;
+		}
+		out << std::setw(12) << (identical ? "yes" : "NO") << std::endl;
+	}
+}
+
+void runCommandRecordingBenchmark(std::ostream& out)
+{
+	const unsigned int instance_count = 100000;
+	const int warmup_frames = 5;
+	const int timed_frames = 50;
+	const float aspect_ratio = 16.f / 9.f;
+	const unsigned int max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+
+	sponza::Context scene(std::make_unique<sponza::FixedStepClock>(1.0 / 60.0),
+		makeStressSceneSettings(instance_count, 22, 1));
+	scene.update();
+
+	//Meshes and materials are numbered as in the draw order benchmark
+	std::map<sponza::MaterialId, int> index_by_material;
+	for (const auto& material : scene.getAllMaterials())
+	{
+		const int material_index = (int)index_by_material.size();
+		index_by_material[material.getId()] = material_index;
+	}
+	std::vector<sponza::MeshId> mesh_ids;
+	for (const auto& instance : scene.getAllInstances())
+		mesh_ids.push_back(instance.getMeshId());
+	std::sort(mesh_ids.begin(), mesh_ids.end());
+	mesh_ids.erase(std::unique(mesh_ids.begin(), mesh_ids.end()), mesh_ids.end());
+
+	//The camera is pulled back and up so most of the grid is in view
+	const auto& camera = scene.getCamera();
+	const auto direction = camera.getDirection();
+	const auto up = scene.getUpDirection();
+	const auto position = camera.getPosition();
+	const glm::vec3 eye(position.x - 500.f * direction.x + 200.f * up.x,
+		position.y - 500.f * direction.y + 200.f * up.y,
+		position.z - 500.f * direction.z + 200.f * up.z);
+	const glm::mat4 projection_view = glm::perspective(glm::radians(camera.getVerticalFieldOfViewInDegrees()),
+		aspect_ratio, camera.getNearPlaneDistance(), camera.getFarPlaneDistance())
+		* glm::lookAt(eye, eye + glm::vec3(direction.x, direction.y, direction.z), glm::vec3(up.x, up.y, up.z));
+
+	struct Candidate
+	{
+		int mesh;
+		int material_index;
+		sponza::Matrix4x3 world;
+	};
+	std::vector<Candidate> candidates;
+	for (size_t m = 0; m < mesh_ids.size(); m++)
+	{
+		for (const auto id : scene.getInstancesByMeshId(mesh_ids[m]))
+		{
+			const auto& instance = scene.getInstanceById(id);
+			candidates.push_back({ (int)m, index_by_material[instance.getMaterialId()], instance.getTransformationMatrix() });
+		}
+	}
+
+	out << "Command recording: " << candidates.size() << " instances, "
+		<< timed_frames << " frames of frustum culling, recording and merging" << std::endl;
+	out << std::setw(8) << "threads"
+		<< std::setw(10) << "visible"
+		<< std::setw(12) << "ms/frame"
+		<< std::setw(10) << "speedup"
+		<< std::setw(12) << "identical" << std::endl;
+
+	std::vector<DrawPacket> serial_packets;
+	double serial_ms = 0;
+
+	for (unsigned int threads = 1; threads <= max_threads; threads++)
+	{
+		sponza::JobSystem jobs(threads - 1);
+		FrustumCuller frustum;
+		CommandRecorder recorder;
+		frustum.setJobSystem(&jobs);
+		recorder.setJobSystem(&jobs);
+		frustum.setFrustum(glm::value_ptr(projection_view));
+		for (const auto& candidate : candidates)
+			frustum.add(scene.getMeshBoundsById(mesh_ids[candidate.mesh]), candidate.world);
+
+		std::vector<unsigned int> visible;
+		std::vector<const DrawPacket *> packets;
+		auto runFrame = [&]()
+		{
+			frustum.cull(visible);
+			recorder.record(visible.size(), [&](size_t begin, size_t end, CommandList& list)
+			{
+				for (size_t i = begin; i < end; ++i)
+				{
+					const Candidate& candidate = candidates[visible[i]];
+					const auto& xform = candidate.world;
+					const float depth = (xform.m30 - eye.x) * direction.x
+						+ (xform.m31 - eye.y) * direction.y
+						+ (xform.m32 - eye.z) * direction.z;
+					DrawPacket packet;
+					packet.key = DrawList::makeKey(DrawList::kOpaquePass, 0, DrawList::kNoTextureSet, candidate.material_index, candidate.mesh,
+						DrawList::quantizeDepth(depth, camera.getNearPlaneDistance(), camera.getFarPlaneDistance()));
+					packet.mesh = (unsigned int)candidate.mesh;
+					packet.material_index = candidate.material_index;
+					std::memcpy(packet.world_matrix, &xform, sizeof(packet.world_matrix));
+					list.record(packet);
+				}
+			});
+			recorder.merge(packets);
+		};
+
+		for (int f = 0; f < warmup_frames; f++)
+			runFrame();
+
+		const auto start = std::chrono::steady_clock::now();
+		for (int f = 0; f < timed_frames; f++)
+			runFrame();
+		const double ms = std::chrono::duration<double, std::milli>(
+			std::chrono::steady_clock::now() - start).count() / timed_frames;
+
+		bool identical = true;
+		if (threads == 1)
+		{
+			serial_ms = ms;
+			serial_packets.clear();
+			for (const auto * packet : packets)
+				serial_packets.push_back(*packet);
+		}
+		else
+		{
+			identical = packets.size() == serial_packets.size();
+			for (size_t i = 0; identical && i < packets.size(); i++)
+				identical = std::memcmp(packets[i], &serial_packets[i], sizeof(DrawPacket)) == 0;
+		}
+
+		out << std::setw(8) << threads
+			<< std::setw(10) << visible.size()
+			<< std::setw(12) << std::fixed << std::setprecision(3) << ms
+			<< std::setw(10) << std::setprecision(2) << serial_ms / ms
+			<< std::setw(12) << (identical ? "yes" : "NO") << std::endl;
+	}
+}
+
+void printFrameTimeSummary(std::ostream& out, std::vector<double> frame_ms)
+{
+	if (frame_ms.empty())
+	{
+		out << "No frames timed" << std::endl;
+		return;
+	}
+
+	std::sort(frame_ms.begin(), frame_ms.end());
+	double total = 0;
+	for (const double ms : frame_ms)
+		total += ms;
+
+	const size_t count = frame_ms.size();
+	out << std::setw(8) << "frames"
+		<< std::setw(10) << "mean ms"
+		<< std::setw(12) << "median ms"
+		<< std::setw(10) << "95% ms"
+		<< std::setw(10) << "max ms" << std::endl;
+	out << std::setw(8) << count
+		<< std::fixed << std::setprecision(3)
+		<< std::setw(10) << total / count
+		<< std::setw(12) << frame_ms[count / 2]
+		<< std::setw(10) << frame_ms[std::min(count - 1, count * 95 / 100)]
+		<< std::setw(10) << frame_ms.back() << std::endl;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <sponza/sponza_fwd.hpp>
+#include <ostream>
+#include <vector>
+
+//Headless benchmarks selected from the command line, they run in place of
+//opening the window and print their results as a table
+
+//Settings for a generated scene of at least instance_count instances,
+//copies of the stock scene on a near square grid, and light_count lights
+sponza::SceneSettings makeStressSceneSettings(unsigned int instance_count,
+	unsigned int light_count,
+	unsigned int seed);
+
+//Builds generated scenes of increasing size and times each stage that runs
+//on the CPU: construction, update and the instance and light queries
+void runSceneScalingBenchmark(std::ostream& out);
+
+//Times Context::update on a stress scene for 1 to N threads and checks
+//every thread count produces exactly the same scene as the serial run
+void runUpdateScalingBenchmark(std::ostream& out);
+
+//Times Context::findLightsInAabb against testing every light, for every
+//instance's bounds at increasing light counts, and checks both agree
+void runLightQueryBenchmark(std::ostream& out);
+
+//Lists the lights reaching every instance at increasing light counts, and
+//checks each list against every light tested on the instance's box. Lists
+//cut short must hold the brightest lights at the box
+void runInstanceLightBenchmark(std::ostream& out);
+
+//Assigns lights to the froxels of the scene's camera at increasing light
+//counts, and tests every light against every froxel to check each froxel
+//lists every light that reaches it and none that misses its box
+void runLightClusterBenchmark(std::ostream& out);
+
+//Builds the renderer's draw list for generated scenes of increasing size
+//and compares state changes in scene order against the sorted order, and
+//the radix sort's time against std::stable_sort on the same keys
+void runDrawOrderBenchmark(std::ostream& out);
+
+//Runs frustum then occlusion culling on generated scenes of increasing size
+//from the scene's own camera, with no window, and prints how many instances
+//each removes and how long drawing the occluders and testing took. Every
+//box removed is checked against an exact per-pixel depth raster of the
+//same occluders, and the table says NO if any of them could be seen
+void runOcclusionBenchmark(std::ostream& out);
+
+//Frustum culls generated scenes of increasing size with each instruction
+//set the CPU supports, and checks every set gives exactly the scalar
+//path's list and the same instances as Context::findInstancesInFrustum
+void runFrustumCullingBenchmark(std::ostream& out);
+
+//Frustum culls and records the draw packets of a stress scene for 1 to N
+//threads, merging them as the GL thread would, and checks every thread
+//count merges exactly the packets of the serial run
+void runCommandRecordingBenchmark(std::ostream& out);
+
+//Prints the count, mean, median, 95th percentile and worst of frame times
+void printFrameTimeSummary(std::ostream& out, std::vector<double> frame_ms);
@@ -0,0 +1,168 @@
+#include "CommandList.hpp"
+#include <sponza/JobSystem.hpp>
+#include <algorithm>
+#include <chrono>
+
+CommandList::CommandList()
+{
+}
+
+CommandList::~CommandList()
+{
+}
+
+void CommandList::clear()
+{
+	packets_.clear();
+	order_.clear();
+	sorted_ = false;
+}
+
+void CommandList::record(const DrawPacket& packet)
+{
+	order_.add(packet.key, (unsigned int)packets_.size());
+	packets_.push_back(packet);
+	sorted_ = false;
+}
+
+void CommandList::sort()
+{
+	//The radix sort moves only keys and indices, then the packets are
+	//gathered once into key order so the merge reads them front to back
+	order_.sort();
+	sorted_packets_.resize(packets_.size());
+	const auto& items = order_.items();
+	for (size_t i = 0; i < items.size(); ++i)
+		sorted_packets_[i] = packets_[items[i].payload];
+	sorted_ = true;
+}
+
+size_t CommandList::size() const
+{
+	return packets_.size();
+}
+
+const DrawPacket& CommandList::getPacket(size_t index) const
+{
+	return sorted_ ? sorted_packets_[index] : packets_[index];
+}
+
+const DrawPacket& CommandList::getRecordedPacket(size_t index) const
+{
+	return packets_[index];
+}
+
+DrawStateChanges CommandList::countRecordedStateChanges() const
+{
+	DrawStateChanges changes;
+	const unsigned long long * previous = nullptr;
+	for (const auto& packet : packets_)
+	{
+		DrawList::countStateChange(previous, packet.key, changes);
+		previous = &packet.key;
+	}
+	return changes;
+}
+
+CommandRecorder::CommandRecorder()
+{
+}
+
+CommandRecorder::~CommandRecorder()
+{
+}
+
+void CommandRecorder::setJobSystem(sponza::JobSystem * jobs)
+{
+	jobs_ = jobs;
+}
+
+void CommandRecorder::record(size_t count, const RecordTask& task)
+{
+	const auto start = std::chrono::steady_clock::now();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+
+	//One contiguous range per list keeps the lists in input order, which
+	//the merge relies on to break ties
+	list_count_ = std::max((size_t)1, std::min((size_t)jobs.getConcurrency(), count / kMinPacketsPerList));
+	if (lists_.size() < list_count_)
+		lists_.resize(list_count_);
+	recorded_changes_.resize(list_count_);
+	jobs.parallelFor(list_count_, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t l = begin; l < end; ++l)
+		{
+			CommandList& list = lists_[l];
+			list.clear();
+			task(count * l / list_count_, count * (l + 1) / list_count_, list);
+			recorded_changes_[l] = list.countRecordedStateChanges();
+			list.sort();
+		}
+	});
+
+	//Each list counted its first packet as changing everything, swap that
+	//for the change from the last packet of the list before it
+	statistics_ = Statistics();
+	statistics_.lists = list_count_;
+	const unsigned long long * previous = nullptr;
+	for (size_t l = 0; l < list_count_; ++l)
+	{
+		const CommandList& list = lists_[l];
+		if (list.size() == 0)
+			continue;
+		const DrawStateChanges& changes = recorded_changes_[l];
+		statistics_.recorded_state_changes.programs += changes.programs - 1;
+		statistics_.recorded_state_changes.texture_sets += changes.texture_sets - 1;
+		statistics_.recorded_state_changes.materials += changes.materials - 1;
+		statistics_.recorded_state_changes.meshes += changes.meshes - 1;
+		DrawList::countStateChange(previous, list.getRecordedPacket(0).key, statistics_.recorded_state_changes);
+		previous = &list.getRecordedPacket(list.size() - 1).key;
+		statistics_.packets += list.size();
+	}
+	statistics_.record_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void CommandRecorder::merge(std::vector<const DrawPacket *>& packets)
+{
+	const auto start = std::chrono::steady_clock::now();
+	packets.clear();
+	packets.reserve(statistics_.packets);
+	heads_.assign(list_count_, 0);
+
+	//There are only as many lists as threads, so the smallest head is found
+	//by looking at each in turn. Only a strictly smaller key moves the pick
+	//on, so equal keys come from the earlier list
+	statistics_.sorted_state_changes = DrawStateChanges();
+	const unsigned long long * previous = nullptr;
+	for (;;)
+	{
+		size_t best = list_count_;
+		unsigned long long best_key = 0;
+		for (size_t l = 0; l < list_count_; ++l)
+		{
+			if (heads_[l] == lists_[l].size())
+				continue;
+			const unsigned long long key = lists_[l].getPacket(heads_[l]).key;
+			if (best == list_count_ || key < best_key)
+			{
+				best = l;
+				best_key = key;
+			}
+		}
+		if (best == list_count_)
+			break;
+
+		const DrawPacket& packet = lists_[best].getPacket(heads_[best]++);
+		DrawList::countStateChange(previous, packet.key, statistics_.sorted_state_changes);
+		previous = &packet.key;
+		packets.push_back(&packet);
+	}
+	statistics_.merge_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+const CommandRecorder::Statistics& CommandRecorder::getStatistics() const
+{
+	return statistics_;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "DrawList.hpp"
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+namespace sponza { class JobSystem; }
+
+//A draw as a worker records it, all the GL thread needs to write the
+//instance and place it in a draw group without going back to the scene
+struct DrawPacket
+{
+	unsigned long long key;
+	unsigned int mesh;
+	int material_index;
+	float world_matrix[12];
+};
+
+//Packets recorded by one job, stored one after another in a buffer kept
+//from frame to frame so recording only allocates when a frame is larger
+//than any before it
+class CommandList
+{
+public:
+
+	CommandList();
+
+	~CommandList();
+
+	void clear();
+
+	void record(const DrawPacket& packet);
+
+	//Orders the packets by key with DrawList's radix sort, stable, so
+	//packets with equal keys stay in the order they were recorded
+	void sort();
+
+	size_t size() const;
+
+	//The packets in recorded order, or key order once sorted
+	const DrawPacket& getPacket(size_t index) const;
+
+	//The packets in recorded order whether sorted or not
+	const DrawPacket& getRecordedPacket(size_t index) const;
+
+	//State changes between the packets in the order they were recorded
+	DrawStateChanges countRecordedStateChanges() const;
+
+private:
+
+	std::vector<DrawPacket> packets_;
+	std::vector<DrawPacket> sorted_packets_;
+	DrawList order_;
+	bool sorted_{ false };
+};
+
+//Records a frame's draws on the job system, each job filling and sorting
+//its own command list over one contiguous range of the input, and merges
+//the lists on the calling thread, which then issues every GL call. Nothing
+//here touches GL, so the culling, keys and matrices all come off the GL
+//thread and the driver only sees the merged result
+class CommandRecorder
+{
+public:
+
+	//Each job records into its own list with no locks
+	typedef std::function<void(size_t begin, size_t end, CommandList& list)> RecordTask;
+
+	struct Statistics
+	{
+		size_t lists{ 0 };
+		size_t packets{ 0 };
+		DrawStateChanges recorded_state_changes;
+		DrawStateChanges sorted_state_changes;
+		double record_microseconds{ 0.0 };
+		double merge_microseconds{ 0.0 };
+	};
+
+	CommandRecorder();
+
+	~CommandRecorder();
+
+	//The pool lists are recorded on, by default the shared pool
+	void setJobSystem(sponza::JobSystem * jobs);
+
+	//Splits [0, count) into one range per list, at most one list per thread
+	//of the pool, and runs task on each in parallel. The task must not call
+	//parallelFor itself
+	void record(size_t count, const RecordTask& task);
+
+	//Replaces packets with every recorded packet in key order. Ties keep the
+	//order of the input, the same order a single sorted list would give
+	void merge(std::vector<const DrawPacket *>& packets);
+
+	const Statistics& getStatistics() const;
+
+private:
+
+	//Fewer packets than this per list are not worth a job of their own
+	static const size_t kMinPacketsPerList = 256;
+
+	sponza::JobSystem * jobs_{ nullptr };
+
+	//Lists are kept so their buffers are reused, only the first
+	//list_count_ of them hold this frame's packets
+	std::vector<CommandList> lists_;
+	size_t list_count_{ 0 };
+	std::vector<DrawStateChanges> recorded_changes_;
+	std::vector<size_t> heads_;
+
+	Statistics statistics_;
+};
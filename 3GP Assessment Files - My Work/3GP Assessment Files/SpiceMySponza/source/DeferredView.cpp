@@ -0,0 +1,672 @@
+#include "DeferredView.hpp"
+#include <sponza/sponza.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace
+{
+	//Uniform and block names, hashed by the compiler
+	constexpr StringId kMaterialTextures = stringId("material_textures");
+	constexpr StringId kGbufferAlbedo = stringId("gbuffer_albedo");
+	constexpr StringId kGbufferNormal = stringId("gbuffer_normal");
+	constexpr StringId kGbufferSpecular = stringId("gbuffer_specular");
+	constexpr StringId kGbufferDepth = stringId("gbuffer_depth");
+	constexpr StringId kLightAccumulation = stringId("light_accumulation");
+	constexpr StringId kMaterialBlock = stringId("MaterialBlock");
+	constexpr StringId kFrameBlock = stringId("FrameBlock");
+	constexpr StringId kLightBlock = stringId("LightBlock");
+	constexpr StringId kLightPassBlock = stringId("LightPassBlock");
+
+	//The forward renderer's spotlight is written into sponza_fs.glsl, here it
+	//is one more light volume
+	const float kSpotlightPosition[3] = { -35.f, 58.f, -3.f };
+	const float kSpotlightRange = 80.f;
+	const float kSpotlightColour[3] = { 0.5f, 0.66f, 0.85f };
+	const float kSpotlightConeAngle = 25.f;
+	const float kSpotlightDirection[3] = { 0.f, -1.f, 0.f };
+
+	void copyVec3(const sponza::Vector3& v, float * out)
+	{
+		out[0] = v.x;
+		out[1] = v.y;
+		out[2] = v.z;
+	}
+
+	//An icosahedron with each face split in four, vertices on the unit
+	//sphere and faces wound counter-clockwise seen from outside
+	void buildIcosphere(std::vector<glm::vec3>& positions, std::vector<unsigned int>& elements)
+	{
+		const float t = (1.f + std::sqrt(5.f)) / 2.f;
+		const glm::vec3 corners[12] = {
+			{ -1, t, 0 }, { 1, t, 0 }, { -1, -t, 0 }, { 1, -t, 0 },
+			{ 0, -1, t }, { 0, 1, t }, { 0, -1, -t }, { 0, 1, -t },
+			{ t, 0, -1 }, { t, 0, 1 }, { -t, 0, -1 }, { -t, 0, 1 } };
+		const unsigned int faces[20][3] = {
+			{ 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+			{ 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+			{ 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+			{ 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 } };
+
+		positions.clear();
+		elements.clear();
+		for (const auto& corner : corners)
+			positions.push_back(glm::normalize(corner));
+
+		//Shared edges get one midpoint, keyed by the edge's lower index first
+		std::map<std::pair<unsigned int, unsigned int>, unsigned int> midpoints;
+		const auto midpoint = [&](unsigned int a, unsigned int b)
+		{
+			const auto key = std::make_pair(std::min(a, b), std::max(a, b));
+			const auto found = midpoints.find(key);
+			if (found != midpoints.end())
+				return found->second;
+			positions.push_back(glm::normalize(positions[a] + positions[b]));
+			const unsigned int index = (unsigned int)positions.size() - 1;
+			midpoints[key] = index;
+			return index;
+		};
+
+		for (const auto& face : faces)
+		{
+			const unsigned int a = face[0];
+			const unsigned int b = face[1];
+			const unsigned int c = face[2];
+			const unsigned int ab = midpoint(a, b);
+			const unsigned int bc = midpoint(b, c);
+			const unsigned int ca = midpoint(c, a);
+			const unsigned int split[4][3] = { { a, ab, ca }, { b, bc, ab }, { c, ca, bc }, { ab, bc, ca } };
+			for (const auto& triangle : split)
+			{
+				const glm::vec3 normal = glm::cross(positions[triangle[1]] - positions[triangle[0]],
+					positions[triangle[2]] - positions[triangle[0]]);
+				const bool outward = glm::dot(normal, positions[triangle[0]]) > 0.f;
+				elements.push_back(triangle[0]);
+				elements.push_back(outward ? triangle[1] : triangle[2]);
+				elements.push_back(outward ? triangle[2] : triangle[1]);
+			}
+		}
+
+		//The faces cut inside the sphere, push them out until the nearest
+		//face touches it so the volume never clips a light's range
+		float nearest_face = 1.f;
+		for (size_t i = 0; i < elements.size(); i += 3)
+		{
+			const glm::vec3& p0 = positions[elements[i]];
+			const glm::vec3 normal = glm::normalize(glm::cross(positions[elements[i + 1]] - p0,
+				positions[elements[i + 2]] - p0));
+			nearest_face = std::min(nearest_face, glm::dot(normal, p0));
+		}
+		for (auto& position : positions)
+			position = position / nearest_face;
+	}
+
+	GLuint createTarget(GLenum internal_format, int width, int height)
+	{
+		GLuint texture = 0;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, 1, internal_format, width, height);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		return texture;
+	}
+
+	void checkFramebuffer(const char * name)
+	{
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+			throw std::runtime_error(std::string("The deferred renderer's ") + name + " framebuffer is incomplete");
+	}
+}
+
+DeferredView::DeferredView()
+{
+}
+
+DeferredView::~DeferredView()
+{
+}
+
+void DeferredView::setScene(const sponza::Context * scene)
+{
+	scene_ = scene;
+}
+
+void DeferredView::windowViewWillStart(tygra::Window * window)
+{
+	assert(scene_ != nullptr);
+
+	render_jobs_ = std::make_unique<sponza::JobSystem>(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+	frustum_culler_.setJobSystem(render_jobs_.get());
+
+	gbuffer_program_.link("resource:///sponza_vs.glsl",
+		"resource:///deferred_gbuffer_fs.glsl",
+		{ { kVertexPosition, "vertex_position" },
+		  { kVertexNormal, "vertex_normal" },
+		  { kTextureCoordinates, "texture_coordinates" },
+		  { kInstanceWorldMatrix, "instance_world_matrix" },
+		  { kInstanceMaterialIndex, "instance_material_index" } });
+	light_program_.link("resource:///deferred_light_vs.glsl",
+		"resource:///deferred_light_fs.glsl",
+		{ { kVertexPosition, "vertex_position" } });
+	composite_program_.link("resource:///deferred_composite_vs.glsl",
+		"resource:///deferred_composite_fs.glsl",
+		{});
+
+	//Blocks and samplers sit on fixed bindings and units for the view's life
+	gbuffer_program_.setUniformBlockBinding(kMaterialBlock, kMaterialBlockBinding);
+	gbuffer_program_.setUniformBlockBinding(kFrameBlock, kFrameBlockBinding);
+	light_program_.setUniformBlockBinding(kFrameBlock, kFrameBlockBinding);
+	light_program_.setUniformBlockBinding(kMaterialBlock, kMaterialBlockBinding);
+	light_program_.setUniformBlockBinding(kLightBlock, kLightBlockBinding);
+	light_program_.setUniformBlockBinding(kLightPassBlock, kLightPassBlockBinding);
+	if (light_program_.getUniformBlockSize(kLightBlock) != kMaxLights * sizeof(LightGL)
+		|| light_program_.getUniformBlockSize(kLightPassBlock) != sizeof(LightPassBlockGL))
+		std::cerr << "Uniform block layouts in the shaders do not match DeferredView" << std::endl;
+
+	glUseProgram(gbuffer_program_.getId());
+	glUniform1i(gbuffer_program_.getUniformLocation(kMaterialTextures), kMaterialTex);
+	glUseProgram(light_program_.getId());
+	glUniform1i(light_program_.getUniformLocation(kGbufferAlbedo), kAlbedoTex);
+	glUniform1i(light_program_.getUniformLocation(kGbufferNormal), kNormalTex);
+	glUniform1i(light_program_.getUniformLocation(kGbufferSpecular), kSpecularTex);
+	glUniform1i(light_program_.getUniformLocation(kGbufferDepth), kDepthTex);
+	glUseProgram(composite_program_.getId());
+	glUniform1i(composite_program_.getUniformLocation(kLightAccumulation), kLightTex);
+	glUseProgram(kNullId);
+
+	//The instance attributes read from the stream, so it comes first
+	stream_.create(kStreamRegionSize);
+	sponza::GeometryBuilder builder;
+	createSceneGeometry(builder.getAllMeshes());
+	createLightVolume();
+	glGenVertexArrays(1, &empty_vao_);
+
+	material_table_.compile(scene_->getAllMaterials());
+	material_revision_ = scene_->getMaterialRevision();
+
+	//Lights add into the buffer, the func is never changed so it is set once
+	glBlendFunc(GL_ONE, GL_ONE);
+
+	geometry_pass_timer_.create();
+	light_pass_timer_.create();
+	composite_pass_timer_.create();
+
+	//The targets follow in windowViewDidReset, once the size is known
+	state_cache_.invalidate();
+}
+
+void DeferredView::windowViewDidReset(tygra::Window * window,
+	int width,
+	int height)
+{
+	glViewport(0, 0, width, height);
+	createTargets(width, height);
+}
+
+void DeferredView::windowViewDidStop(tygra::Window * window)
+{
+	gbuffer_program_.release();
+	light_program_.release();
+	composite_program_.release();
+	stream_.release();
+	instance_attribute_buffer_ = 0;
+	releaseTargets();
+
+	glDeleteBuffers(1, &position_vbo_);
+	glDeleteBuffers(1, &normal_vbo_);
+	glDeleteBuffers(1, &texture_coordinates_vbo_);
+	glDeleteBuffers(1, &element_vbo_);
+	glDeleteVertexArrays(1, &scene_vao_);
+	glDeleteBuffers(1, &light_volume_vbo_);
+	glDeleteBuffers(1, &light_volume_ebo_);
+	glDeleteVertexArrays(1, &light_volume_vao_);
+	glDeleteVertexArrays(1, &empty_vao_);
+	meshes_.clear();
+	material_table_.release();
+
+	geometry_pass_timer_.release();
+	light_pass_timer_.release();
+	composite_pass_timer_.release();
+
+	//Another view may take over the context, leave it as GL's defaults
+	//rather than this view's last light pass
+	glBindFramebuffer(GL_FRAMEBUFFER, kNullId);
+	glDisable(GL_BLEND);
+	glDisable(GL_DEPTH_CLAMP);
+	glCullFace(GL_BACK);
+	glDepthFunc(GL_LESS);
+	glDepthMask(GL_TRUE);
+	state_cache_.invalidate();
+	render_jobs_.reset();
+}
+
+void DeferredView::windowViewRender(tygra::Window * window)
+{
+	assert(scene_ != nullptr);
+
+	const sponza::SceneSnapshot& frame = scene_->acquireSnapshot();
+	state_cache_.resetCounters();
+	stream_.beginFrame();
+
+	GLint viewport_size[4];
+	glGetIntegerv(GL_VIEWPORT, viewport_size);
+	const float aspect_ratio = viewport_size[2] / (float)viewport_size[3];
+
+	const auto& cam = frame.getCamera();
+	const glm::mat4 projection_xform = glm::perspective(glm::radians(cam.getVerticalFieldOfViewInDegrees()),
+		aspect_ratio, cam.getNearPlaneDistance(), cam.getFarPlaneDistance());
+	const auto& camera_pos = (const glm::vec3&)cam.getPosition();
+	const auto& camera_at_pos = camera_pos + (const glm::vec3&)cam.getDirection();
+	const auto& world_up = (const glm::vec3&)frame.getUpDirection();
+	const glm::mat4 view_xform = glm::lookAt(camera_pos, camera_at_pos, world_up);
+	const glm::mat4 combined_matrix = projection_xform * view_xform;
+
+	fillLights(frame);
+
+	FrameBlockGL frame_block;
+	std::memcpy(frame_block.combined_matrix, glm::value_ptr(combined_matrix), sizeof(frame_block.combined_matrix));
+	copyVec3(cam.getPosition(), frame_block.camera_position);
+	frame_block.light_count = (int)std::min(lights_gl_.size(), (size_t)kMaxLights);
+	copyVec3(frame.getAmbientLightIntensity(), frame_block.scene_ambient_light);
+	frame_block.padding = 0.f;
+	const GLintptr frame_offset = stream_.write(&frame_block, sizeof(frame_block), stream_.getUniformAlignment());
+	state_cache_.bindBufferRange(GL_UNIFORM_BUFFER, kFrameBlockBinding, stream_.getBuffer(), frame_offset, sizeof(frame_block));
+
+	LightPassBlockGL light_pass_block;
+	const glm::mat4 inverse_combined_matrix = glm::inverse(combined_matrix);
+	std::memcpy(light_pass_block.inverse_combined_matrix, glm::value_ptr(inverse_combined_matrix),
+		sizeof(light_pass_block.inverse_combined_matrix));
+	const GLintptr light_pass_offset = stream_.write(&light_pass_block, sizeof(light_pass_block), stream_.getUniformAlignment());
+	state_cache_.bindBufferRange(GL_UNIFORM_BUFFER, kLightPassBlockBinding, stream_.getBuffer(), light_pass_offset, sizeof(light_pass_block));
+
+	if (material_revision_ != scene_->getMaterialRevision())
+	{
+		material_table_.compile(scene_->getAllMaterials());
+		material_revision_ = scene_->getMaterialRevision();
+
+		//Loading textures binds them behind the cache's back
+		state_cache_.invalidate();
+	}
+
+	buildInstances(frame, combined_matrix);
+
+	geometry_pass_timer_.begin();
+	drawGeometryPass();
+	geometry_pass_timer_.end();
+
+	light_pass_timer_.begin();
+	drawLightPass();
+	light_pass_timer_.end();
+
+	composite_pass_timer_.begin();
+	drawCompositePass();
+	composite_pass_timer_.end();
+
+	stream_.endFrame();
+}
+
+void DeferredView::drawGeometryPass()
+{
+	state_cache_.bindFramebuffer(gbuffer_fbo_);
+	state_cache_.enable(GL_DEPTH_TEST);
+	state_cache_.enable(GL_CULL_FACE);
+	state_cache_.disable(GL_BLEND);
+	state_cache_.disable(GL_DEPTH_CLAMP);
+	state_cache_.cullFace(GL_BACK);
+	state_cache_.depthFunc(GL_LESS);
+	state_cache_.depthMask(GL_TRUE);
+	state_cache_.colorMask(GL_TRUE);
+
+	//Pixels no geometry covers keep the forward renderer's clear colour
+	const GLfloat zero[4] = { 0.f, 0.f, 0.f, 0.f };
+	const GLfloat background[4] = { 0.f, 0.f, 0.25f, 0.f };
+	const GLfloat far_depth = 1.f;
+	glClearBufferfv(GL_COLOR, 0, zero);
+	glClearBufferfv(GL_COLOR, 1, zero);
+	glClearBufferfv(GL_COLOR, 2, zero);
+	glClearBufferfv(GL_COLOR, 3, background);
+	glClearBufferfv(GL_DEPTH, 0, &far_depth);
+
+	state_cache_.useProgram(gbuffer_program_.getId());
+	state_cache_.bindBufferBase(GL_UNIFORM_BUFFER, kMaterialBlockBinding, material_table_.getUniformBuffer());
+	state_cache_.bindTexture(kMaterialTex, GL_TEXTURE_2D_ARRAY, material_table_.getTextureArray());
+	state_cache_.bindVertexArray(scene_vao_);
+	for (const auto& group : mesh_groups_)
+	{
+		const auto& mesh = meshes_[group.mesh];
+		glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, mesh.element_count, GL_UNSIGNED_INT,
+			TGL_BUFFER_OFFSET(mesh.first_index * sizeof(unsigned int)),
+			group.instance_count, mesh.base_vertex, instance_base_ + group.first_instance);
+	}
+}
+
+void DeferredView::drawLightPass()
+{
+	//The light buffer has its own depth, a copy of the G-buffer's, so the
+	//volumes are depth tested while the light shader samples the original
+	glBlitNamedFramebuffer(gbuffer_fbo_, light_fbo_,
+		0, 0, target_width_, target_height_,
+		0, 0, target_width_, target_height_,
+		GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+	//Back faces behind the scene mark every pixel a light can reach, and
+	//still do when the camera is inside the volume. Depth clamping keeps
+	//back faces past the far plane from being clipped away
+	state_cache_.bindFramebuffer(light_fbo_);
+	state_cache_.enable(GL_BLEND);
+	state_cache_.enable(GL_DEPTH_CLAMP);
+	state_cache_.cullFace(GL_FRONT);
+	state_cache_.depthFunc(GL_GEQUAL);
+	state_cache_.depthMask(GL_FALSE);
+
+	state_cache_.useProgram(light_program_.getId());
+	state_cache_.bindTexture(kAlbedoTex, GL_TEXTURE_2D, albedo_texture_);
+	state_cache_.bindTexture(kNormalTex, GL_TEXTURE_2D, normal_texture_);
+	state_cache_.bindTexture(kSpecularTex, GL_TEXTURE_2D, specular_texture_);
+	state_cache_.bindTexture(kDepthTex, GL_TEXTURE_2D, depth_texture_);
+	state_cache_.bindVertexArray(light_volume_vao_);
+
+	//Each batch gets its own block in the stream, so the batches queue
+	//without waiting on each other. The range bound covers the whole block
+	//even when the last batch fills only part of it
+	for (size_t first = 0; first < lights_gl_.size(); first += kMaxLights)
+	{
+		const size_t count = std::min(lights_gl_.size() - first, (size_t)kMaxLights);
+		const StreamBuffer::Allocation block = stream_.allocate(kMaxLights * sizeof(LightGL), stream_.getUniformAlignment());
+		std::memcpy(block.data, lights_gl_.data() + first, count * sizeof(LightGL));
+		state_cache_.bindBufferRange(GL_UNIFORM_BUFFER, kLightBlockBinding, stream_.getBuffer(), block.offset, kMaxLights * sizeof(LightGL));
+		glDrawElementsInstanced(GL_TRIANGLES, light_volume_element_count_, GL_UNSIGNED_INT, 0, (GLsizei)count);
+	}
+}
+
+void DeferredView::drawCompositePass()
+{
+	state_cache_.bindFramebuffer(kNullId);
+	state_cache_.disable(GL_DEPTH_TEST);
+	state_cache_.disable(GL_BLEND);
+	state_cache_.cullFace(GL_BACK);
+	state_cache_.useProgram(composite_program_.getId());
+	state_cache_.bindTexture(kLightTex, GL_TEXTURE_2D, light_texture_);
+	state_cache_.bindVertexArray(empty_vao_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void DeferredView::fillLights(const sponza::SceneSnapshot& frame)
+{
+	const auto& light_sources = frame.getAllLights();
+	lights_gl_.resize(light_sources.size() + 1);
+	for (size_t l = 0; l < light_sources.size(); l++)
+	{
+		LightGL& light = lights_gl_[l];
+		copyVec3(light_sources[l].getPosition(), light.position);
+		light.range = light_sources[l].getRange();
+		copyVec3(light_sources[l].getIntensity(), light.colour);
+		light.cone_angle = 0.f;
+		light.cone_direction[0] = light.cone_direction[1] = light.cone_direction[2] = 0.f;
+		light.padding = 0.f;
+	}
+
+	LightGL& spotlight = lights_gl_.back();
+	std::copy(kSpotlightPosition, kSpotlightPosition + 3, spotlight.position);
+	spotlight.range = kSpotlightRange;
+	std::copy(kSpotlightColour, kSpotlightColour + 3, spotlight.colour);
+	spotlight.cone_angle = kSpotlightConeAngle;
+	std::copy(kSpotlightDirection, kSpotlightDirection + 3, spotlight.cone_direction);
+	spotlight.padding = 0.f;
+}
+
+void DeferredView::buildInstances(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view)
+{
+	candidates_.clear();
+	mesh_groups_.clear();
+	instances_gl_.clear();
+
+	frustum_culler_.clear();
+	frustum_culler_.setFrustum(glm::value_ptr(projection_view));
+	for (size_t m = 0; m < meshes_.size(); ++m)
+	{
+		for (auto id : frame.getInstancesByMeshId(meshes_[m].id))
+		{
+			//The snapshot's own index, so every id is in this frame
+			const auto * instance = &frame.getInstanceById(id);
+			frustum_culler_.add(meshes_[m].bounds, instance->getTransformationMatrix());
+			candidates_.push_back({ m, instance });
+		}
+	}
+	frustum_culler_.cull(visible_instances_);
+
+	//Candidates were gathered mesh by mesh and culling keeps their order, so
+	//each mesh's instances are already consecutive
+	for (const auto index : visible_instances_)
+	{
+		const auto& candidate = candidates_[index];
+		if (mesh_groups_.empty() || mesh_groups_.back().mesh != candidate.mesh)
+			mesh_groups_.push_back({ candidate.mesh, (GLsizei)instances_gl_.size(), 0 });
+		mesh_groups_.back().instance_count++;
+
+		const sponza::Matrix4x3 world_matrix = candidate.instance->getTransformationMatrix();
+		InstanceGL instance_gl;
+		std::memcpy(instance_gl.world_matrix, &world_matrix, sizeof(instance_gl.world_matrix));
+		instance_gl.material_index = material_table_.getMaterialIndex(candidate.instance->getMaterialId());
+		instance_gl.light_list[0] = instance_gl.light_list[1] = 0;
+		instances_gl_.push_back(instance_gl);
+	}
+
+	//Aligned to a whole instance so the offset becomes part of each draw's
+	//base instance
+	const GLintptr offset = stream_.write(instances_gl_.data(), instances_gl_.size() * sizeof(InstanceGL), sizeof(InstanceGL));
+	instance_base_ = (GLuint)(offset / sizeof(InstanceGL));
+	if (stream_.getBuffer() != instance_attribute_buffer_)
+		pointInstanceAttributes();
+}
+
+void DeferredView::createTargets(int width, int height)
+{
+	releaseTargets();
+	target_width_ = std::max(width, 1);
+	target_height_ = std::max(height, 1);
+
+	albedo_texture_ = createTarget(GL_RGBA8, target_width_, target_height_);
+	normal_texture_ = createTarget(GL_RG16, target_width_, target_height_);
+	specular_texture_ = createTarget(GL_RGBA8, target_width_, target_height_);
+	depth_texture_ = createTarget(GL_DEPTH_COMPONENT32F, target_width_, target_height_);
+	light_texture_ = createTarget(GL_RGBA16F, target_width_, target_height_);
+
+	glGenRenderbuffers(1, &light_depth_renderbuffer_);
+	glBindRenderbuffer(GL_RENDERBUFFER, light_depth_renderbuffer_);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, target_width_, target_height_);
+	glBindRenderbuffer(GL_RENDERBUFFER, kNullId);
+
+	const GLenum gbuffer_draw_buffers[4] = {
+		GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+	glGenFramebuffers(1, &gbuffer_fbo_);
+	glBindFramebuffer(GL_FRAMEBUFFER, gbuffer_fbo_);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo_texture_, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normal_texture_, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, specular_texture_, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, light_texture_, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth_texture_, 0);
+	glDrawBuffers(4, gbuffer_draw_buffers);
+	checkFramebuffer("G-buffer");
+
+	glGenFramebuffers(1, &light_fbo_);
+	glBindFramebuffer(GL_FRAMEBUFFER, light_fbo_);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, light_texture_, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, light_depth_renderbuffer_);
+	checkFramebuffer("light");
+	glBindFramebuffer(GL_FRAMEBUFFER, kNullId);
+
+	//Binding the new framebuffers and textures went around the cache
+	state_cache_.invalidate();
+}
+
+void DeferredView::releaseTargets()
+{
+	glDeleteFramebuffers(1, &gbuffer_fbo_);
+	glDeleteFramebuffers(1, &light_fbo_);
+	glDeleteRenderbuffers(1, &light_depth_renderbuffer_);
+	const GLuint textures[5] = { albedo_texture_, normal_texture_, specular_texture_, depth_texture_, light_texture_ };
+	glDeleteTextures(5, textures);
+	gbuffer_fbo_ = light_fbo_ = light_depth_renderbuffer_ = 0;
+	albedo_texture_ = normal_texture_ = specular_texture_ = depth_texture_ = light_texture_ = 0;
+	target_width_ = target_height_ = 0;
+}
+
+void DeferredView::createSceneGeometry(const std::vector<sponza::Mesh>& meshes)
+{
+	std::vector<sponza::Vector3> positions;
+	std::vector<sponza::Vector3> normals;
+	std::vector<sponza::Vector2> texture_coordinates;
+	std::vector<unsigned int> elements;
+
+	//Each mesh's elements stay relative to its own vertices, the draw's
+	//base vertex offsets them
+	for (const auto& source : meshes)
+	{
+		MeshGL mesh;
+		mesh.id = source.getId();
+		mesh.bounds = scene_->getMeshBoundsById(source.getId());
+		mesh.first_index = (GLuint)elements.size();
+		mesh.base_vertex = (GLint)positions.size();
+		mesh.element_count = (int)source.getElementArray().size();
+		meshes_.push_back(mesh);
+
+		const auto& mesh_positions = source.getPositionArray();
+		const auto& mesh_normals = source.getNormalArray();
+		const auto& mesh_texture_coordinates = source.getTextureCoordinateArray();
+		const auto& mesh_elements = source.getElementArray();
+		positions.insert(positions.end(), mesh_positions.begin(), mesh_positions.end());
+		normals.insert(normals.end(), mesh_normals.begin(), mesh_normals.end());
+		texture_coordinates.insert(texture_coordinates.end(), mesh_texture_coordinates.begin(), mesh_texture_coordinates.end());
+
+		//Meshes missing an array are padded so every array stays in step
+		normals.resize(positions.size());
+		texture_coordinates.resize(positions.size());
+		elements.insert(elements.end(), mesh_elements.begin(), mesh_elements.end());
+	}
+
+	glGenBuffers(1, &position_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, position_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &normal_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, normal_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &texture_coordinates_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, texture_coordinates_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, texture_coordinates.size() * sizeof(glm::vec2), texture_coordinates.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &element_vbo_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), elements.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, kNullId);
+
+	glGenVertexArrays(1, &scene_vao_);
+	glBindVertexArray(scene_vao_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, position_vbo_);
+	glEnableVertexAttribArray(kVertexPosition);
+	glVertexAttribPointer(kVertexPosition, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	glBindBuffer(GL_ARRAY_BUFFER, normal_vbo_);
+	glEnableVertexAttribArray(kVertexNormal);
+	glVertexAttribPointer(kVertexNormal, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	glBindBuffer(GL_ARRAY_BUFFER, texture_coordinates_vbo_);
+	glEnableVertexAttribArray(kTextureCoordinates);
+	glVertexAttribPointer(kTextureCoordinates, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), TGL_BUFFER_OFFSET(0));
+
+	setInstanceAttributePointers();
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+	glBindVertexArray(kNullId);
+}
+
+void DeferredView::pointInstanceAttributes()
+{
+	state_cache_.bindVertexArray(scene_vao_);
+	setInstanceAttributePointers();
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+}
+
+void DeferredView::setInstanceAttributePointers()
+{
+	//Per-instance attributes advance once per instance, draws pick their
+	//first instance with a base instance
+	glBindBuffer(GL_ARRAY_BUFFER, stream_.getBuffer());
+	instance_attribute_buffer_ = stream_.getBuffer();
+	for (GLuint column = 0; column < 4; ++column)
+	{
+		glEnableVertexAttribArray(kInstanceWorldMatrix + column);
+		glVertexAttribPointer(kInstanceWorldMatrix + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceGL),
+			TGL_BUFFER_OFFSET(column * 3 * sizeof(float)));
+		glVertexAttribDivisor(kInstanceWorldMatrix + column, 1);
+	}
+	glEnableVertexAttribArray(kInstanceMaterialIndex);
+	glVertexAttribIPointer(kInstanceMaterialIndex, 1, GL_INT, sizeof(InstanceGL),
+		TGL_BUFFER_OFFSET(offsetof(InstanceGL, material_index)));
+	glVertexAttribDivisor(kInstanceMaterialIndex, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+}
+
+void DeferredView::createLightVolume()
+{
+	std::vector<glm::vec3> positions;
+	std::vector<unsigned int> elements;
+	buildIcosphere(positions, elements);
+	light_volume_element_count_ = (GLsizei)elements.size();
+
+	glGenBuffers(1, &light_volume_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, light_volume_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &light_volume_ebo_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, light_volume_ebo_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), elements.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, kNullId);
+
+	glGenVertexArrays(1, &light_volume_vao_);
+	glBindVertexArray(light_volume_vao_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, light_volume_ebo_);
+	glBindBuffer(GL_ARRAY_BUFFER, light_volume_vbo_);
+	glEnableVertexAttribArray(kVertexPosition);
+	glVertexAttribPointer(kVertexPosition, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+	glBindVertexArray(kNullId);
+}
+
+void DeferredView::printRenderStatistics(std::ostream& out) const
+{
+	//The G-buffer is four bytes each for albedo, normal, specular and depth.
+	//The targets add the RGBA16F light accumulation and the depth copy the
+	//light pass tests against, eight and four bytes more
+	const double pixels = (double)target_width_ * target_height_;
+	const double gbuffer_megabytes = 16.0 * pixels / (1024.0 * 1024.0);
+	const double target_megabytes = 28.0 * pixels / (1024.0 * 1024.0);
+	out << "Deferred renderer, " << instances_gl_.size() << " of " << candidates_.size()
+		<< " instances drawn in " << mesh_groups_.size() << " draws, "
+		<< lights_gl_.size() << " light volumes, targets " << target_width_ << "x" << target_height_
+		<< " G-buffer " << gbuffer_megabytes << " MB, all targets " << target_megabytes << " MB" << std::endl;
+	out << "GPU ms per frame geometry " << geometry_pass_timer_.getAverageMilliseconds()
+		<< " + lights " << light_pass_timer_.getAverageMilliseconds()
+		<< " + composite " << composite_pass_timer_.getAverageMilliseconds()
+		<< ", averaged over " << geometry_pass_timer_.getSampleCount() << " frames, "
+		<< geometry_pass_timer_.getDroppedCount() << " dropped" << std::endl;
+	out << "GL state calls issued " << state_cache_.getCounters().issued
+		<< ", elided " << state_cache_.getCounters().elided << std::endl;
+	const auto& stream = stream_.getStatistics();
+	out << "Stream buffer " << stream.bytes_used << " of " << stream_.getRegionSize()
+		<< " bytes used in " << stream.allocations << " allocations, waited "
+		<< stream.wait_microseconds << " us for the GPU, regrown " << stream.regrowths << " times" << std::endl;
+}
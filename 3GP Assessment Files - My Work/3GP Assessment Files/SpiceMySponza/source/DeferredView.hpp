@@ -0,0 +1,206 @@
+#pragma once
+
+#include "FrustumCuller.hpp"
+#include "GLStateCache.hpp"
+#include "GpuTimer.hpp"
+#include "MaterialTable.hpp"
+#include "ShaderBlocks.hpp"
+#include "ShaderProgram.hpp"
+#include "StreamBuffer.hpp"
+
+#include <sponza/sponza_fwd.hpp>
+#include <tygra/WindowViewDelegate.hpp>
+#include <tgl/tgl.h>
+#include <glm/glm.hpp>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+//A deferred shading alternative to MyView. The scene is drawn once into a
+//G-buffer of albedo, an octahedral normal, specular colour and shininess,
+//and depth. Each light then draws a sphere of its range and shades only the
+//pixels inside it, so a pixel pays for the lights that reach it rather than
+//for every light in the scene
+class DeferredView : public tygra::WindowViewDelegate
+{
+public:
+
+	DeferredView();
+
+	~DeferredView();
+
+	void setScene(const sponza::Context * scene);
+
+	//Prints the last frame's instance and light counts, the memory used by
+	//the G-buffer and by all the render targets, and the GPU time of each
+	//pass averaged since the view started
+	void printRenderStatistics(std::ostream& out) const;
+
+private:
+
+	void windowViewWillStart(tygra::Window * window) override;
+
+	void windowViewDidReset(tygra::Window * window,
+		int width,
+		int height) override;
+
+	void windowViewDidStop(tygra::Window * window) override;
+
+	void windowViewRender(tygra::Window * window) override;
+
+	void createTargets(int width, int height);
+
+	void releaseTargets();
+
+	void createSceneGeometry(const std::vector<sponza::Mesh>& meshes);
+
+	void createLightVolume();
+
+	//Points the scene's instance attributes at the stream buffer, needed
+	//again whenever the stream outgrows its buffer
+	void pointInstanceAttributes();
+
+	void setInstanceAttributePointers();
+
+	void buildInstances(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view);
+
+	void fillLights(const sponza::SceneSnapshot& frame);
+
+	void drawGeometryPass();
+
+	void drawLightPass();
+
+	void drawCompositePass();
+
+private:
+
+	const sponza::Context * scene_{ nullptr };
+
+	//Culling runs on the view's own pool. The scene
+	//updates on the shared pool, which runs one batch at a time, so sharing
+	//it would hold the frame up behind the simulation
+	std::unique_ptr<sponza::JobSystem> render_jobs_;
+
+	ShaderProgram gbuffer_program_;
+	ShaderProgram light_program_;
+	ShaderProgram composite_program_;
+
+	//Must match LightPassBlock in deferred_light_fs.glsl
+	struct LightPassBlockGL
+	{
+		float inverse_combined_matrix[16];
+	};
+
+	//The blocks, each batch of lights and the instances are written into
+	//one persistently mapped buffer each frame and bound by range
+	static const GLsizeiptr kStreamRegionSize = 2 * 1024 * 1024;
+	StreamBuffer stream_;
+
+	//Every light this frame, drawn kMaxLights at a time since that is all
+	//the light block holds
+	std::vector<LightGL> lights_gl_;
+
+	struct MeshGL
+	{
+		sponza::MeshId id{ 0 };
+		sponza::Aabb bounds;
+		GLuint first_index{ 0 };
+		GLint base_vertex{ 0 };
+		int element_count{ 0 };
+	};
+	std::vector<MeshGL> meshes_;
+
+	//Every mesh appended into one set of buffers behind one vertex array
+	GLuint position_vbo_{ 0 };
+	GLuint normal_vbo_{ 0 };
+	GLuint texture_coordinates_vbo_{ 0 };
+	GLuint element_vbo_{ 0 };
+	GLuint scene_vao_{ 0 };
+
+	//The visible instances of one mesh, consecutive in the instance buffer
+	struct MeshGroup
+	{
+		size_t mesh;
+		GLsizei first_instance;
+		GLsizei instance_count;
+	};
+
+	struct Candidate
+	{
+		size_t mesh;
+		const sponza::Instance * instance;
+	};
+
+	FrustumCuller frustum_culler_;
+	std::vector<Candidate> candidates_;
+	std::vector<unsigned int> visible_instances_;
+	std::vector<MeshGroup> mesh_groups_;
+	std::vector<InstanceGL> instances_gl_;
+	GLuint instance_attribute_buffer_{ 0 };
+	GLuint instance_base_{ 0 };
+
+	//A subdivided icosahedron scaled out so its faces enclose the unit
+	//sphere, placed and sized per light by the vertex shader
+	GLuint light_volume_vbo_{ 0 };
+	GLuint light_volume_ebo_{ 0 };
+	GLuint light_volume_vao_{ 0 };
+	GLsizei light_volume_element_count_{ 0 };
+
+	//The composite pass generates its triangle from the vertex id, but GL
+	//still needs a vertex array bound to draw
+	GLuint empty_vao_{ 0 };
+
+	//Albedo and specular are RGBA8, the normal RG16 and depth 32-bit float.
+	//Albedo's alpha holds the material index for the spotlight.
+	//Ambient light is written straight into the light buffer, RGBA16F, which
+	//also has its own copy of depth to test light volumes against while the
+	//G-buffer depth is being sampled
+	int target_width_{ 0 };
+	int target_height_{ 0 };
+	GLuint albedo_texture_{ 0 };
+	GLuint normal_texture_{ 0 };
+	GLuint specular_texture_{ 0 };
+	GLuint depth_texture_{ 0 };
+	GLuint light_texture_{ 0 };
+	GLuint light_depth_renderbuffer_{ 0 };
+	GLuint gbuffer_fbo_{ 0 };
+	GLuint light_fbo_{ 0 };
+
+	GpuTimer geometry_pass_timer_;
+	GpuTimer light_pass_timer_;
+	GpuTimer composite_pass_timer_;
+
+	GLStateCache state_cache_;
+
+	MaterialTable material_table_;
+	unsigned int material_revision_{ 0 };
+
+	const static GLuint kNullId = 0;
+
+	//The G-buffer pass shares sponza_vs.glsl with MyView, so the attribute
+	//names match its, the locations need not
+	enum VertexAttribIndexes
+	{
+		kVertexPosition = 0,
+		kVertexNormal = 1,
+		kTextureCoordinates = 2,
+		kInstanceWorldMatrix = 3, //Takes locations 3 to 6
+		kInstanceMaterialIndex = 7
+	};
+	enum TextureIndexes
+	{
+		kMaterialTex = 0,
+		kAlbedoTex = 1,
+		kNormalTex = 2,
+		kSpecularTex = 3,
+		kDepthTex = 4,
+		kLightTex = 5
+	};
+	enum UniformBlockBindings
+	{
+		kMaterialBlockBinding = 0,
+		kFrameBlockBinding = 1,
+		kLightBlockBinding = 2,
+		kLightPassBlockBinding = 3
+	};
+};
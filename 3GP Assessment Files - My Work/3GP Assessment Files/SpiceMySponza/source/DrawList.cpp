@@ -0,0 +1,134 @@
+#include "DrawList.hpp"
+#include <algorithm>
+
+namespace
+{
+	const int kDepthShift = 0;
+	const int kMeshShift = kDepthShift + DrawList::kDepthBits;
+	const int kMaterialShift = kMeshShift + DrawList::kMeshBits;
+	const int kTextureSetShift = kMaterialShift + DrawList::kMaterialBits;
+	const int kProgramShift = kTextureSetShift + DrawList::kTextureSetBits;
+	const int kPassShift = kProgramShift + DrawList::kProgramBits;
+	static_assert(kPassShift + DrawList::kPassBits == 64, "Sort key fields must fill 64 bits");
+
+	unsigned long long field(int value, int bits, int shift)
+	{
+		const unsigned long long max_value = (1ull << bits) - 1;
+		const unsigned long long clamped = value < 0 ? 0 : std::min((unsigned long long)value, max_value);
+		return clamped << shift;
+	}
+
+	int extract(unsigned long long key, int bits, int shift)
+	{
+		return (int)((key >> shift) & ((1ull << bits) - 1));
+	}
+}
+
+unsigned long long DrawList::makeKey(int pass,
+	int program,
+	int texture_set,
+	int material,
+	int mesh,
+	unsigned int depth)
+{
+	return field(pass, kPassBits, kPassShift)
+		| field(program, kProgramBits, kProgramShift)
+		| field(texture_set, kTextureSetBits, kTextureSetShift)
+		| field(material, kMaterialBits, kMaterialShift)
+		| field(mesh, kMeshBits, kMeshShift)
+		| field((int)std::min(depth, (1u << kDepthBits) - 1), kDepthBits, kDepthShift);
+}
+
+unsigned int DrawList::quantizeDepth(float distance, float near_distance, float far_distance)
+{
+	const float t = (distance - near_distance) / (far_distance - near_distance);
+	const float clamped = std::max(0.f, std::min(t, 1.f));
+	return (unsigned int)(clamped * ((1u << kDepthBits) - 1));
+}
+
+int DrawList::keyProgram(unsigned long long key)
+{
+	return extract(key, kProgramBits, kProgramShift);
+}
+
+int DrawList::keyTextureSet(unsigned long long key)
+{
+	return extract(key, kTextureSetBits, kTextureSetShift);
+}
+
+int DrawList::keyMaterial(unsigned long long key)
+{
+	return extract(key, kMaterialBits, kMaterialShift);
+}
+
+int DrawList::keyMesh(unsigned long long key)
+{
+	return extract(key, kMeshBits, kMeshShift);
+}
+
+void DrawList::clear()
+{
+	items_.clear();
+}
+
+void DrawList::add(unsigned long long key, unsigned int payload)
+{
+	items_.push_back({ key, payload });
+}
+
+void DrawList::sort()
+{
+	const size_t count = items_.size();
+	scratch_.resize(count);
+
+	for (int shift = 0; shift < 64; shift += 8)
+	{
+		size_t offsets[256] = {};
+		for (const auto& item : items_)
+			offsets[(item.key >> shift) & 0xff]++;
+
+		//Most keys share their pass and program bytes, skip those passes
+		if (count == 0 || offsets[(items_[0].key >> shift) & 0xff] == count)
+			continue;
+
+		size_t total = 0;
+		for (auto& offset : offsets)
+		{
+			const size_t bucket = offset;
+			offset = total;
+			total += bucket;
+		}
+		for (const auto& item : items_)
+			scratch_[offsets[(item.key >> shift) & 0xff]++] = item;
+		items_.swap(scratch_);
+	}
+}
+
+const std::vector<DrawList::Item>& DrawList::items() const
+{
+	return items_;
+}
+
+void DrawList::countStateChange(const unsigned long long * previous, unsigned long long key, DrawStateChanges& changes)
+{
+	if (previous == nullptr || keyProgram(key) != keyProgram(*previous))
+		changes.programs++;
+	if (previous == nullptr || keyTextureSet(key) != keyTextureSet(*previous))
+		changes.texture_sets++;
+	if (previous == nullptr || keyMaterial(key) != keyMaterial(*previous))
+		changes.materials++;
+	if (previous == nullptr || keyMesh(key) != keyMesh(*previous))
+		changes.meshes++;
+}
+
+DrawStateChanges DrawList::countStateChanges() const
+{
+	DrawStateChanges changes;
+	const unsigned long long * previous = nullptr;
+	for (const auto& item : items_)
+	{
+		countStateChange(previous, item.key, changes);
+		previous = &item.key;
+	}
+	return changes;
+}
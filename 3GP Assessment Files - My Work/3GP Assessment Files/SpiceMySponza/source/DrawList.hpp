@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+
+//How often consecutive draws in a list differ in each piece of state
+struct DrawStateChanges
+{
+	int programs{ 0 };
+	int texture_sets{ 0 };
+	int materials{ 0 };
+	int meshes{ 0 };
+
+	int total() const { return programs + texture_sets + materials + meshes; }
+};
+
+//A list of draws ordered by a 64-bit key. From the most significant bits
+//down the key holds the pass, program permutation, texture set, material,
+//mesh and depth, so sorting groups draws by the most expensive state first
+//and leaves each group's instances front to back. The texture set field is
+//reserved: every material's textures are layers of one array bound once
+//per pass, so the views always pass kNoTextureSet
+class DrawList
+{
+public:
+
+	static const int kPassBits = 2;
+	static const int kProgramBits = 4;
+	static const int kTextureSetBits = 14;
+	static const int kMaterialBits = 8;
+	static const int kMeshBits = 16;
+	static const int kDepthBits = 20;
+
+	enum Pass
+	{
+		kOpaquePass = 0
+	};
+
+	//The only texture set while the field is reserved
+	static const int kNoTextureSet = 0;
+
+	struct Item
+	{
+		unsigned long long key;
+		unsigned int payload;
+	};
+
+	//Fields wider than their bits are clamped to the largest value
+	static unsigned long long makeKey(int pass,
+		int program,
+		int texture_set,
+		int material,
+		int mesh,
+		unsigned int depth);
+
+	//Maps a view distance between near and far onto the depth bits, nearer
+	//draws get smaller values and so sort first
+	static unsigned int quantizeDepth(float distance, float near_distance, float far_distance);
+
+	static int keyProgram(unsigned long long key);
+	static int keyTextureSet(unsigned long long key);
+	static int keyMaterial(unsigned long long key);
+	static int keyMesh(unsigned long long key);
+
+	//Adds the state a draw with key changes after one with previous, null
+	//for the first draw
+	static void countStateChange(const unsigned long long * previous, unsigned long long key, DrawStateChanges& changes);
+
+	void clear();
+
+	void add(unsigned long long key, unsigned int payload);
+
+	//Least significant digit radix sort, stable, one pass per byte of key
+	//that is not the same for every item
+	void sort();
+
+	const std::vector<Item>& items() const;
+
+	//Counts the state changes between consecutive items in their current
+	//order, the first draw counts as changing everything
+	DrawStateChanges countStateChanges() const;
+
+private:
+
+	std::vector<Item> items_;
+	std::vector<Item> scratch_;
+};
@@ -0,0 +1,315 @@
+#include "FrustumCuller.hpp"
+#include <sponza/JobSystem.hpp>
+#include <algorithm>
+#include <cmath>
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FRUSTUM_CULLER_AVX2
+#else
+#include <cpuid.h>
+#define FRUSTUM_CULLER_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace
+{
+	//AVX2 needs the CPU to have it and the OS to save the wide registers
+	bool cpuHasAvx2()
+	{
+		unsigned int leaf1[4] = {};
+		unsigned int leaf7[4] = {};
+#if defined(_MSC_VER)
+		int info[4];
+		__cpuid(info, 0);
+		if (info[0] < 7)
+			return false;
+		__cpuid(info, 1);
+		for (int i = 0; i < 4; ++i)
+			leaf1[i] = (unsigned int)info[i];
+		__cpuidex(info, 7, 0);
+		for (int i = 0; i < 4; ++i)
+			leaf7[i] = (unsigned int)info[i];
+#else
+		if (__get_cpuid_max(0, nullptr) < 7)
+			return false;
+		__cpuid(1, leaf1[0], leaf1[1], leaf1[2], leaf1[3]);
+		__cpuid_count(7, 0, leaf7[0], leaf7[1], leaf7[2], leaf7[3]);
+#endif
+		const bool avx = (leaf1[2] & (1u << 28)) != 0;
+		const bool osxsave = (leaf1[2] & (1u << 27)) != 0;
+		const bool avx2 = (leaf7[1] & (1u << 5)) != 0;
+		if (!avx || !osxsave || !avx2)
+			return false;
+#if defined(_MSC_VER)
+		const unsigned long long xcr0 = _xgetbv(0);
+#else
+		unsigned int xcr0_low = 0;
+		unsigned int xcr0_high = 0;
+		__asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+		const unsigned long long xcr0 = xcr0_low;
+#endif
+		return (xcr0 & 0x6) == 0x6;
+	}
+
+	sponza::Plane makePlane(float a, float b, float c, float d)
+	{
+		const float length = std::sqrt(a * a + b * b + c * c);
+		return sponza::Plane(sponza::Vector3(a / length, b / length, c / length), d / length);
+	}
+
+	//Appends the index of each set bit, lowest first
+	void appendSetBits(unsigned int mask, unsigned int base, std::vector<unsigned int>& visible)
+	{
+		while (mask != 0)
+		{
+			unsigned int bit = 0;
+			while ((mask & (1u << bit)) == 0)
+				++bit;
+			visible.push_back(base + bit);
+			mask &= mask - 1;
+		}
+	}
+
+	FRUSTUM_CULLER_AVX2
+	size_t cullBoxesAvx2(const sponza::Plane * planes,
+		int plane_count,
+		const float * centre_x,
+		const float * centre_y,
+		const float * centre_z,
+		const float * extent_x,
+		const float * extent_y,
+		const float * extent_z,
+		size_t begin,
+		size_t end,
+		std::vector<unsigned int>& visible)
+	{
+		const __m256 sign_mask = _mm256_set1_ps(-0.f);
+		const size_t blocks = begin + (end - begin) / 8 * 8;
+		for (size_t i = begin; i < blocks; i += 8)
+		{
+			const __m256 cx = _mm256_loadu_ps(centre_x + i);
+			const __m256 cy = _mm256_loadu_ps(centre_y + i);
+			const __m256 cz = _mm256_loadu_ps(centre_z + i);
+			const __m256 ex = _mm256_loadu_ps(extent_x + i);
+			const __m256 ey = _mm256_loadu_ps(extent_y + i);
+			const __m256 ez = _mm256_loadu_ps(extent_z + i);
+
+			//A box is outside when its centre is further behind a plane than
+			//its extents reach towards it
+			__m256 outside = _mm256_setzero_ps();
+			for (int p = 0; p < plane_count; ++p)
+			{
+				const __m256 nx = _mm256_set1_ps(planes[p].normal.x);
+				const __m256 ny = _mm256_set1_ps(planes[p].normal.y);
+				const __m256 nz = _mm256_set1_ps(planes[p].normal.z);
+				const __m256 distance = _mm256_add_ps(_mm256_set1_ps(planes[p].distance),
+					_mm256_add_ps(_mm256_mul_ps(nx, cx),
+						_mm256_add_ps(_mm256_mul_ps(ny, cy), _mm256_mul_ps(nz, cz))));
+				const __m256 radius = _mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign_mask, nx), ex),
+					_mm256_add_ps(_mm256_mul_ps(_mm256_andnot_ps(sign_mask, ny), ey),
+						_mm256_mul_ps(_mm256_andnot_ps(sign_mask, nz), ez)));
+				outside = _mm256_or_ps(outside,
+					_mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+			}
+			appendSetBits(~(unsigned int)_mm256_movemask_ps(outside) & 0xffu, (unsigned int)i, visible);
+		}
+		return blocks;
+	}
+}
+
+FrustumCuller::FrustumCuller()
+	: instruction_set_(getSupportedInstructionSet())
+{
+}
+
+FrustumCuller::~FrustumCuller()
+{
+}
+
+void FrustumCuller::setJobSystem(sponza::JobSystem * jobs)
+{
+	jobs_ = jobs;
+}
+
+void FrustumCuller::setFrustum(const float * projection_view)
+{
+	//Each plane is the fourth row of the matrix plus or minus another row
+	float rows[4][4];
+	for (int r = 0; r < 4; ++r)
+		for (int c = 0; c < 4; ++c)
+			rows[r][c] = projection_view[c * 4 + r];
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const float * row = rows[axis];
+		const float * w = rows[3];
+		planes_[axis * 2] = makePlane(w[0] + row[0], w[1] + row[1], w[2] + row[2], w[3] + row[3]);
+		planes_[axis * 2 + 1] = makePlane(w[0] - row[0], w[1] - row[1], w[2] - row[2], w[3] - row[3]);
+	}
+}
+
+const sponza::Plane * FrustumCuller::getPlanes() const
+{
+	return planes_;
+}
+
+void FrustumCuller::clear()
+{
+	centre_x_.clear();
+	centre_y_.clear();
+	centre_z_.clear();
+	extent_x_.clear();
+	extent_y_.clear();
+	extent_z_.clear();
+}
+
+unsigned int FrustumCuller::add(const sponza::Aabb& bounds, const sponza::Matrix4x3& world)
+{
+	//The centre moves with the transform and the extents grow to hold the
+	//rotated box, the same box Context keeps for its spatial queries
+	const sponza::Vector3 c = bounds.centre();
+	const float ex = 0.5f * (bounds.max.x - bounds.min.x);
+	const float ey = 0.5f * (bounds.max.y - bounds.min.y);
+	const float ez = 0.5f * (bounds.max.z - bounds.min.z);
+	const sponza::Matrix4x3& m = world;
+	centre_x_.push_back(m.m00 * c.x + m.m10 * c.y + m.m20 * c.z + m.m30);
+	centre_y_.push_back(m.m01 * c.x + m.m11 * c.y + m.m21 * c.z + m.m31);
+	centre_z_.push_back(m.m02 * c.x + m.m12 * c.y + m.m22 * c.z + m.m32);
+	extent_x_.push_back(std::fabs(m.m00) * ex + std::fabs(m.m10) * ey + std::fabs(m.m20) * ez);
+	extent_y_.push_back(std::fabs(m.m01) * ex + std::fabs(m.m11) * ey + std::fabs(m.m21) * ez);
+	extent_z_.push_back(std::fabs(m.m02) * ex + std::fabs(m.m12) * ey + std::fabs(m.m22) * ez);
+	return (unsigned int)centre_x_.size() - 1;
+}
+
+size_t FrustumCuller::getBoxCount() const
+{
+	return centre_x_.size();
+}
+
+void FrustumCuller::cull(std::vector<unsigned int>& visible) const
+{
+	visible.clear();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+	const size_t count = centre_x_.size();
+	const size_t chunk_count = std::min((size_t)jobs.getConcurrency(), count / kMinBoxesPerChunk);
+	if (chunk_count <= 1)
+	{
+		cull(0, count, visible);
+		return;
+	}
+
+	//Chunk edges fall on multiples of eight so only the last chunk has a
+	//scalar tail
+	const size_t chunk_size = (count / chunk_count + 7) / 8 * 8;
+	chunk_visible_.resize(chunk_count);
+	jobs.parallelFor(chunk_count, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t chunk = begin; chunk < end; ++chunk)
+		{
+			chunk_visible_[chunk].clear();
+			cull(std::min(chunk * chunk_size, count), std::min((chunk + 1) * chunk_size, count), chunk_visible_[chunk]);
+		}
+	});
+	for (size_t chunk = 0; chunk < chunk_count; ++chunk)
+		visible.insert(visible.end(), chunk_visible_[chunk].begin(), chunk_visible_[chunk].end());
+}
+
+void FrustumCuller::cull(size_t begin, size_t end, std::vector<unsigned int>& visible) const
+{
+	size_t done = begin;
+	if (instruction_set_ == kAvx2)
+		done = cullAvx2(begin, end, visible);
+	else if (instruction_set_ == kSse)
+		done = cullSse(begin, end, visible);
+	cullScalar(done, end, visible);
+}
+
+void FrustumCuller::setInstructionSet(InstructionSet instruction_set)
+{
+	if (instruction_set <= getSupportedInstructionSet())
+		instruction_set_ = instruction_set;
+}
+
+FrustumCuller::InstructionSet FrustumCuller::getInstructionSet() const
+{
+	return instruction_set_;
+}
+
+FrustumCuller::InstructionSet FrustumCuller::getSupportedInstructionSet()
+{
+	//SSE2 is part of x64, so only AVX2 has to be asked for
+	static const InstructionSet supported = cpuHasAvx2() ? kAvx2 : kSse;
+	return supported;
+}
+
+const char * FrustumCuller::getInstructionSetName(InstructionSet instruction_set)
+{
+	switch (instruction_set)
+	{
+	case kAvx2:
+		return "AVX2";
+	case kSse:
+		return "SSE";
+	default:
+		return "scalar";
+	}
+}
+
+void FrustumCuller::cullScalar(size_t begin, size_t end, std::vector<unsigned int>& visible) const
+{
+	for (size_t i = begin; i < end; ++i)
+	{
+		bool outside = false;
+		for (int p = 0; p < kPlaneCount && !outside; ++p)
+		{
+			const sponza::Plane& plane = planes_[p];
+			const float distance = plane.distance + plane.normal.x * centre_x_[i]
+				+ plane.normal.y * centre_y_[i] + plane.normal.z * centre_z_[i];
+			const float radius = std::fabs(plane.normal.x) * extent_x_[i]
+				+ std::fabs(plane.normal.y) * extent_y_[i] + std::fabs(plane.normal.z) * extent_z_[i];
+			outside = distance + radius < 0.f;
+		}
+		if (!outside)
+			visible.push_back((unsigned int)i);
+	}
+}
+
+size_t FrustumCuller::cullSse(size_t begin, size_t end, std::vector<unsigned int>& visible) const
+{
+	const __m128 sign_mask = _mm_set1_ps(-0.f);
+	const size_t blocks = begin + (end - begin) / 4 * 4;
+	for (size_t i = begin; i < blocks; i += 4)
+	{
+		const __m128 cx = _mm_loadu_ps(&centre_x_[i]);
+		const __m128 cy = _mm_loadu_ps(&centre_y_[i]);
+		const __m128 cz = _mm_loadu_ps(&centre_z_[i]);
+		const __m128 ex = _mm_loadu_ps(&extent_x_[i]);
+		const __m128 ey = _mm_loadu_ps(&extent_y_[i]);
+		const __m128 ez = _mm_loadu_ps(&extent_z_[i]);
+
+		__m128 outside = _mm_setzero_ps();
+		for (int p = 0; p < kPlaneCount; ++p)
+		{
+			const __m128 nx = _mm_set1_ps(planes_[p].normal.x);
+			const __m128 ny = _mm_set1_ps(planes_[p].normal.y);
+			const __m128 nz = _mm_set1_ps(planes_[p].normal.z);
+			const __m128 distance = _mm_add_ps(_mm_set1_ps(planes_[p].distance),
+				_mm_add_ps(_mm_mul_ps(nx, cx),
+					_mm_add_ps(_mm_mul_ps(ny, cy), _mm_mul_ps(nz, cz))));
+			const __m128 radius = _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, nx), ex),
+				_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, ny), ey),
+					_mm_mul_ps(_mm_andnot_ps(sign_mask, nz), ez)));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+		}
+		appendSetBits(~(unsigned int)_mm_movemask_ps(outside) & 0xfu, (unsigned int)i, visible);
+	}
+	return blocks;
+}
+
+size_t FrustumCuller::cullAvx2(size_t begin, size_t end, std::vector<unsigned int>& visible) const
+{
+	return cullBoxesAvx2(planes_, kPlaneCount,
+		centre_x_.data(), centre_y_.data(), centre_z_.data(),
+		extent_x_.data(), extent_y_.data(), extent_z_.data(),
+		begin, end, visible);
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <sponza/types.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace sponza { class JobSystem; }
+
+//Culls boxes against the six planes of a camera's projection * view matrix.
+//Boxes are kept as centres and half extents in separate arrays so they are
+//tested eight at a time with AVX2, or four with SSE on CPUs without it
+class FrustumCuller
+{
+public:
+
+	enum InstructionSet
+	{
+		kScalar,
+		kSse,
+		kAvx2
+	};
+
+	FrustumCuller();
+
+	~FrustumCuller();
+
+	//The pool boxes are culled on, by default the shared pool
+	void setJobSystem(sponza::JobSystem * jobs);
+
+	//Extracts the planes from a column-major projection * view matrix, as
+	//glm stores it, for clip space depth from -1 to 1
+	void setFrustum(const float * projection_view);
+
+	//The planes face inwards and are normalised, in the order left, right,
+	//bottom, top, near, far
+	const sponza::Plane * getPlanes() const;
+
+	void clear();
+
+	//Adds a box in mesh space moved into the world by a transform and
+	//returns its index
+	unsigned int add(const sponza::Aabb& bounds, const sponza::Matrix4x3& world);
+
+	size_t getBoxCount() const;
+
+	//Replaces visible with the indices of every box at least partly inside
+	//the frustum, in the order they were added. Large sets are split into
+	//chunks culled in parallel and joined in order
+	void cull(std::vector<unsigned int>& visible) const;
+
+	//Appends the visible boxes from begin up to end. Ranges can start
+	//anywhere, so jobs can each cull their own part of the boxes
+	void cull(size_t begin, size_t end, std::vector<unsigned int>& visible) const;
+
+	//The best set the CPU supports is chosen at construction, a lower one
+	//can be forced to compare them. Higher than supported is ignored
+	void setInstructionSet(InstructionSet instruction_set);
+
+	InstructionSet getInstructionSet() const;
+
+	static InstructionSet getSupportedInstructionSet();
+
+	//"scalar", "SSE" or "AVX2", for statistics and benchmark tables
+	static const char * getInstructionSetName(InstructionSet instruction_set);
+
+private:
+
+	void cullScalar(size_t begin, size_t end, std::vector<unsigned int>& visible) const;
+
+	//The SIMD paths return where they stopped, the scalar path does the rest
+	size_t cullSse(size_t begin, size_t end, std::vector<unsigned int>& visible) const;
+
+	size_t cullAvx2(size_t begin, size_t end, std::vector<unsigned int>& visible) const;
+
+	static const int kPlaneCount = 6;
+
+	//Chunks are whole AVX2 blocks and large enough to be worth a job
+	static const size_t kMinBoxesPerChunk = 2048;
+
+	sponza::Plane planes_[kPlaneCount];
+
+	std::vector<float> centre_x_;
+	std::vector<float> centre_y_;
+	std::vector<float> centre_z_;
+	std::vector<float> extent_x_;
+	std::vector<float> extent_y_;
+	std::vector<float> extent_z_;
+
+	InstructionSet instruction_set_;
+
+	sponza::JobSystem * jobs_{ nullptr };
+
+	//Each chunk's visible boxes, kept between calls so they are only
+	//allocated when the scene grows
+	mutable std::vector<std::vector<unsigned int>> chunk_visible_;
+};
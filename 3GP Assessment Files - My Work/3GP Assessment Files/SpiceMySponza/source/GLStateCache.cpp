@@ -0,0 +1,226 @@
+#include "GLStateCache.hpp"
+#include <cstring>
+
+namespace
+{
+	unsigned long long pairKey(GLuint high, GLuint low)
+	{
+		return ((unsigned long long)high << 32) | low;
+	}
+
+	GLuint floatBits(GLfloat value)
+	{
+		GLuint bits;
+		std::memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+}
+
+GLStateCache::GLStateCache()
+{
+}
+
+GLStateCache::~GLStateCache()
+{
+}
+
+void GLStateCache::invalidate()
+{
+	cull_face_ = kUnknown;
+	depth_func_ = kUnknown;
+	depth_mask_ = kUnknown;
+	colour_mask_ = kUnknown;
+	program_ = kUnknown;
+	framebuffer_ = kUnknown;
+	vao_ = kUnknown;
+	active_unit_ = kUnknown;
+	capabilities_.clear();
+	textures_.clear();
+	samplers_.clear();
+	buffer_bindings_.clear();
+	uniforms_.clear();
+}
+
+void GLStateCache::enable(GLenum capability)
+{
+	setCapability(capability, true);
+}
+
+void GLStateCache::disable(GLenum capability)
+{
+	setCapability(capability, false);
+}
+
+void GLStateCache::setCapability(GLenum capability, bool enabled)
+{
+	const auto found = capabilities_.find(capability);
+	if (!track(found == capabilities_.end() || found->second != enabled))
+		return;
+	capabilities_[capability] = enabled;
+	if (enabled)
+		glEnable(capability);
+	else
+		glDisable(capability);
+}
+
+void GLStateCache::cullFace(GLenum face)
+{
+	if (!track(cull_face_ != face))
+		return;
+	cull_face_ = face;
+	glCullFace(face);
+}
+
+void GLStateCache::depthFunc(GLenum func)
+{
+	if (!track(depth_func_ != func))
+		return;
+	depth_func_ = func;
+	glDepthFunc(func);
+}
+
+void GLStateCache::depthMask(GLboolean enabled)
+{
+	if (!track(depth_mask_ != enabled))
+		return;
+	depth_mask_ = enabled;
+	glDepthMask(enabled);
+}
+
+void GLStateCache::colorMask(GLboolean enabled)
+{
+	if (!track(colour_mask_ != enabled))
+		return;
+	colour_mask_ = enabled;
+	glColorMask(enabled, enabled, enabled, enabled);
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+	if (!track(program_ != program))
+		return;
+	program_ = program;
+	glUseProgram(program);
+}
+
+void GLStateCache::bindFramebuffer(GLuint framebuffer)
+{
+	if (!track(framebuffer_ != framebuffer))
+		return;
+	framebuffer_ = framebuffer;
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+}
+
+void GLStateCache::bindVertexArray(GLuint vao)
+{
+	if (!track(vao_ != vao))
+		return;
+	vao_ = vao;
+	glBindVertexArray(vao);
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+	const unsigned long long key = pairKey(unit, target);
+	const auto found = textures_.find(key);
+	if (!track(found == textures_.end() || found->second != texture))
+		return;
+	textures_[key] = texture;
+
+	if (track(active_unit_ != unit))
+	{
+		active_unit_ = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+	glBindTexture(target, texture);
+}
+
+void GLStateCache::bindSampler(GLuint unit, GLuint sampler)
+{
+	const auto found = samplers_.find(unit);
+	if (!track(found == samplers_.end() || found->second != sampler))
+		return;
+	samplers_[unit] = sampler;
+	glBindSampler(unit, sampler);
+}
+
+void GLStateCache::bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+{
+	const unsigned long long key = pairKey(target, index);
+	const auto found = buffer_bindings_.find(key);
+	if (!track(found == buffer_bindings_.end() || found->second.buffer != buffer || found->second.size != -1))
+		return;
+	buffer_bindings_[key] = { buffer, 0, -1 };
+	glBindBufferBase(target, index, buffer);
+}
+
+void GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+{
+	const unsigned long long key = pairKey(target, index);
+	const auto found = buffer_bindings_.find(key);
+	if (!track(found == buffer_bindings_.end()
+		|| found->second.buffer != buffer
+		|| found->second.offset != offset
+		|| found->second.size != size))
+		return;
+	buffer_bindings_[key] = { buffer, offset, size };
+	glBindBufferRange(target, index, buffer, offset, size);
+}
+
+void GLStateCache::uniform1i(GLint location, GLint value)
+{
+	const GLuint bits[3] = { (GLuint)value, 0, 0 };
+	if (setUniform(location, bits))
+		glUniform1i(location, value);
+}
+
+void GLStateCache::uniform1f(GLint location, GLfloat value)
+{
+	const GLuint bits[3] = { floatBits(value), 0, 0 };
+	if (setUniform(location, bits))
+		glUniform1f(location, value);
+}
+
+void GLStateCache::uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z)
+{
+	const GLuint bits[3] = { floatBits(x), floatBits(y), floatBits(z) };
+	if (setUniform(location, bits))
+		glUniform3f(location, x, y, z);
+}
+
+bool GLStateCache::setUniform(GLint location, const GLuint (&bits)[3])
+{
+	//Location -1 is ignored by GL anyway, and an unknown program gives no
+	//key to shadow under
+	if (location < 0)
+		return false;
+	if (program_ == kUnknown)
+		return track(true);
+
+	const unsigned long long key = pairKey(program_, (GLuint)location);
+	const auto found = uniforms_.find(key);
+	if (!track(found == uniforms_.end()
+		|| std::memcmp(found->second.bits, bits, sizeof(bits)) != 0))
+		return false;
+	std::memcpy(uniforms_[key].bits, bits, sizeof(bits));
+	return true;
+}
+
+bool GLStateCache::track(bool changed)
+{
+	if (changed)
+		counters_.issued++;
+	else
+		counters_.elided++;
+	return changed;
+}
+
+void GLStateCache::resetCounters()
+{
+	counters_ = GLStateCounters();
+}
+
+const GLStateCounters& GLStateCache::getCounters() const
+{
+	return counters_;
+}
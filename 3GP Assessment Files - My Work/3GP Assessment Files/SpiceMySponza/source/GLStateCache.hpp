@@ -0,0 +1,117 @@
+#pragma once
+
+#include <tgl/tgl.h>
+#include <unordered_map>
+
+//Calls issued to GL and calls dropped because GL already had that state,
+//since the last resetCounters
+struct GLStateCounters
+{
+	int issued{ 0 };
+	int elided{ 0 };
+};
+
+//Shadows the GL state the renderer changes per frame and drops calls that
+//would set it to what it already is. State set by calls that bypass the
+//cache is unknown to it, so invalidate after such code runs; unknown state
+//is always set rather than assumed
+class GLStateCache
+{
+public:
+
+	GLStateCache();
+
+	~GLStateCache();
+
+	//Forgets everything, the next call of each kind is always issued
+	void invalidate();
+
+	void enable(GLenum capability);
+
+	void disable(GLenum capability);
+
+	void cullFace(GLenum face);
+
+	void depthFunc(GLenum func);
+
+	void depthMask(GLboolean enabled);
+
+	//All four channels together, the renderer never masks them separately
+	void colorMask(GLboolean enabled);
+
+	void useProgram(GLuint program);
+
+	//Binds to GL_FRAMEBUFFER, so both drawing and reading
+	void bindFramebuffer(GLuint framebuffer);
+
+	void bindVertexArray(GLuint vao);
+
+	//Makes the unit active only if the binding has to change
+	void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+	void bindSampler(GLuint unit, GLuint sampler);
+
+	void bindBufferBase(GLenum target, GLuint index, GLuint buffer);
+
+	//Shares its shadow with bindBufferBase, a base binding is a range that
+	//never matches
+	void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size);
+
+	//Uniform values are shadowed per program and location, for the
+	//program currently in use
+	void uniform1i(GLint location, GLint value);
+
+	void uniform1f(GLint location, GLfloat value);
+
+	void uniform3f(GLint location, GLfloat x, GLfloat y, GLfloat z);
+
+	void resetCounters();
+
+	const GLStateCounters& getCounters() const;
+
+private:
+
+	static const GLuint kUnknown = ~0u;
+
+	void setCapability(GLenum capability, bool enabled);
+
+	bool setUniform(GLint location, const GLuint (&bits)[3]);
+
+	bool track(bool changed);
+
+	GLuint cull_face_{ kUnknown };
+	GLuint depth_func_{ kUnknown };
+	GLuint depth_mask_{ kUnknown };
+	GLuint colour_mask_{ kUnknown };
+	GLuint program_{ kUnknown };
+	GLuint framebuffer_{ kUnknown };
+	GLuint vao_{ kUnknown };
+	GLuint active_unit_{ kUnknown };
+
+	//Keyed by the capability, true for enabled
+	std::unordered_map<GLenum, bool> capabilities_;
+
+	//Keyed by unit in the high half and target or index in the low half
+	std::unordered_map<unsigned long long, GLuint> textures_;
+	std::unordered_map<GLuint, GLuint> samplers_;
+
+	//A size of -1 for a whole buffer bound with bindBufferBase
+	struct BufferBinding
+	{
+		GLuint buffer;
+		GLintptr offset;
+		GLsizeiptr size;
+	};
+	std::unordered_map<unsigned long long, BufferBinding> buffer_bindings_;
+
+	//Keyed by program in the high half and location in the low half. The
+	//value's bits are compared rather than the floats, so a NaN matches an
+	//identical NaN and -0 and +0 count as different values
+	struct UniformValue
+	{
+		GLuint bits[3];
+	};
+	std::unordered_map<unsigned long long, UniformValue> uniforms_;
+
+	GLStateCounters counters_;
+};
@@ -0,0 +1,108 @@
+#include "GpuTimer.hpp"
+
+GpuTimer::GpuTimer()
+{
+}
+
+GpuTimer::~GpuTimer()
+{
+}
+
+void GpuTimer::create()
+{
+	release();
+	glGenQueries(kQueryCount, queries_);
+}
+
+void GpuTimer::release()
+{
+	if (queries_[0] != 0)
+		glDeleteQueries(kQueryCount, queries_);
+	for (int i = 0; i < kQueryCount; ++i)
+	{
+		queries_[i] = 0;
+		states_[i] = kIdle;
+	}
+	next_ = 0;
+	reset();
+}
+
+void GpuTimer::begin()
+{
+	//The query about to be reused is the oldest. With four in flight it is
+	//almost always back already, when it is not its sample is dropped
+	//rather than waiting for the GPU to catch up
+	collect();
+	if (states_[next_] != kIdle)
+	{
+		if (states_[next_] == kPending)
+			dropped_count_++;
+		states_[next_] = kIdle;
+	}
+	glBeginQuery(GL_TIME_ELAPSED, queries_[next_]);
+}
+
+void GpuTimer::end()
+{
+	glEndQuery(GL_TIME_ELAPSED);
+	states_[next_] = kPending;
+	next_ = (next_ + 1) % kQueryCount;
+}
+
+void GpuTimer::reset()
+{
+	for (auto& state : states_)
+	{
+		if (state == kPending)
+			state = kDiscarded;
+	}
+	last_milliseconds_ = 0.0;
+	total_milliseconds_ = 0.0;
+	sample_count_ = 0;
+	dropped_count_ = 0;
+}
+
+void GpuTimer::collect()
+{
+	for (int i = 0; i < kQueryCount; ++i)
+	{
+		const int query = (next_ + i) % kQueryCount;
+		if (states_[query] == kIdle)
+			continue;
+
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(queries_[query], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (available == GL_FALSE)
+			break;
+
+		GLuint64 nanoseconds = 0;
+		glGetQueryObjectui64v(queries_[query], GL_QUERY_RESULT, &nanoseconds);
+		if (states_[query] == kPending)
+		{
+			last_milliseconds_ = nanoseconds * 1e-6;
+			total_milliseconds_ += last_milliseconds_;
+			sample_count_++;
+		}
+		states_[query] = kIdle;
+	}
+}
+
+double GpuTimer::getLastMilliseconds() const
+{
+	return last_milliseconds_;
+}
+
+double GpuTimer::getAverageMilliseconds() const
+{
+	return sample_count_ > 0 ? total_milliseconds_ / sample_count_ : 0.0;
+}
+
+int GpuTimer::getSampleCount() const
+{
+	return sample_count_;
+}
+
+int GpuTimer::getDroppedCount() const
+{
+	return dropped_count_;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <tgl/tgl.h>
+
+//Times the GPU work issued between begin and end with GL_TIME_ELAPSED
+//queries. A few queries are kept in flight and each is read only once GL
+//says it is ready, so timing a pass never makes the CPU wait on the GPU.
+//When the GPU falls so far behind that every query is still running, the
+//oldest is reused and its sample dropped
+class GpuTimer
+{
+public:
+
+	GpuTimer();
+
+	~GpuTimer();
+
+	void create();
+
+	void release();
+
+	//Only one timer query can be running at a time, so timed passes must
+	//not overlap
+	void begin();
+
+	void end();
+
+	//Forgets the results so far, queries still in flight are not counted
+	void reset();
+
+	//The latest result to come back, zero before any has
+	double getLastMilliseconds() const;
+
+	//The mean of every result since creation or the last reset
+	double getAverageMilliseconds() const;
+
+	int getSampleCount() const;
+
+	//Samples lost since creation or the last reset because their query was
+	//needed again before its result came back
+	int getDroppedCount() const;
+
+private:
+
+	static const int kQueryCount = 4;
+
+	enum QueryState
+	{
+		kIdle,
+		kPending,
+		kDiscarded
+	};
+
+	//Reads back finished queries oldest first, stopping at the first that
+	//is still running since later ones cannot have finished before it
+	void collect();
+
+	GLuint queries_[kQueryCount] = {};
+	QueryState states_[kQueryCount] = {};
+	int next_{ 0 };
+
+	double last_milliseconds_{ 0.0 };
+	double total_milliseconds_{ 0.0 };
+	int sample_count_{ 0 };
+	int dropped_count_{ 0 };
+};
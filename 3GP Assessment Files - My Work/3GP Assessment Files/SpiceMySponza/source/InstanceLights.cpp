@@ -0,0 +1,141 @@
+#include "InstanceLights.hpp"
+#include <sponza/JobSystem.hpp>
+#include <sponza/Light.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace
+{
+	//The world box holding a mesh space box after the transform
+	sponza::Aabb worldBounds(const sponza::Aabb& bounds, const sponza::Matrix4x3& m)
+	{
+		const sponza::Vector3 c = bounds.centre();
+		const float ex = 0.5f * (bounds.max.x - bounds.min.x);
+		const float ey = 0.5f * (bounds.max.y - bounds.min.y);
+		const float ez = 0.5f * (bounds.max.z - bounds.min.z);
+		const sponza::Vector3 centre(m.m00 * c.x + m.m10 * c.y + m.m20 * c.z + m.m30,
+			m.m01 * c.x + m.m11 * c.y + m.m21 * c.z + m.m31,
+			m.m02 * c.x + m.m12 * c.y + m.m22 * c.z + m.m32);
+		const sponza::Vector3 extent(std::fabs(m.m00) * ex + std::fabs(m.m10) * ey + std::fabs(m.m20) * ez,
+			std::fabs(m.m01) * ex + std::fabs(m.m11) * ey + std::fabs(m.m21) * ez,
+			std::fabs(m.m02) * ex + std::fabs(m.m12) * ey + std::fabs(m.m22) * ez);
+		return sponza::Aabb(sponza::Vector3(centre.x - extent.x, centre.y - extent.y, centre.z - extent.z),
+			sponza::Vector3(centre.x + extent.x, centre.y + extent.y, centre.z + extent.z));
+	}
+
+	float distanceToBox(const sponza::Aabb& box, const sponza::Vector3& p)
+	{
+		const float dx = std::max(0.f, std::max(box.min.x - p.x, p.x - box.max.x));
+		const float dy = std::max(0.f, std::max(box.min.y - p.y, p.y - box.max.y));
+		const float dz = std::max(0.f, std::max(box.min.z - p.z, p.z - box.max.z));
+		return std::sqrt(dx * dx + dy * dy + dz * dz);
+	}
+}
+
+InstanceLights::InstanceLights()
+{
+}
+
+InstanceLights::~InstanceLights()
+{
+}
+
+void InstanceLights::setJobSystem(sponza::JobSystem * jobs)
+{
+	jobs_ = jobs;
+}
+
+void InstanceLights::setLights(const std::vector<sponza::Light>& lights)
+{
+	lights_.resize(lights.size());
+	for (size_t l = 0; l < lights.size(); ++l)
+	{
+		const sponza::Vector3 intensity = lights[l].getIntensity();
+		LightSource& light = lights_[l];
+		light.position = lights[l].getPosition();
+		light.range = lights[l].getRange();
+		light.brightness = std::max(intensity.x, std::max(intensity.y, intensity.z));
+		light_grid_.setLight((unsigned int)l, light.position, light.range);
+	}
+	light_grid_.truncate(lights.size());
+}
+
+void InstanceLights::assign(const std::vector<Box>& boxes)
+{
+	const auto start = std::chrono::steady_clock::now();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+
+	slots_.resize(boxes.size() * kMaxLightsPerInstance);
+	slot_counts_.resize(boxes.size());
+	found_counts_.resize(boxes.size());
+	jobs.parallelFor(boxes.size(), 64, [&](size_t begin, size_t end)
+	{
+		std::vector<unsigned int> found;
+		std::vector<std::pair<float, unsigned int>> ranked;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const sponza::Aabb box = worldBounds(boxes[i].bounds, boxes[i].world);
+			found.clear();
+			light_grid_.queryAabb(box, found);
+			found_counts_[i] = (unsigned int)found.size();
+
+			//Past the limit keep the lights brightest at the box's nearest
+			//point, by the falloff the shader uses at its simplest
+			if (found.size() > (size_t)kMaxLightsPerInstance)
+			{
+				ranked.clear();
+				for (const auto light : found)
+				{
+					const LightSource& source = lights_[light];
+					const float falloff = 1.f - distanceToBox(box, source.position) / source.range;
+					ranked.push_back(std::make_pair(-source.brightness * falloff, light));
+				}
+				std::partial_sort(ranked.begin(), ranked.begin() + kMaxLightsPerInstance, ranked.end());
+				for (int k = 0; k < kMaxLightsPerInstance; ++k)
+					found[k] = ranked[k].second;
+				found.resize(kMaxLightsPerInstance);
+			}
+			std::copy(found.begin(), found.end(), slots_.begin() + i * kMaxLightsPerInstance);
+			slot_counts_[i] = (unsigned int)found.size();
+		}
+	});
+
+	statistics_ = Statistics();
+	instance_table_.resize(2 * boxes.size());
+	light_indices_.clear();
+	for (size_t i = 0; i < boxes.size(); ++i)
+	{
+		const auto first = slots_.begin() + i * kMaxLightsPerInstance;
+		instance_table_[2 * i] = (unsigned int)light_indices_.size();
+		instance_table_[2 * i + 1] = slot_counts_[i];
+		light_indices_.insert(light_indices_.end(), first, first + slot_counts_[i]);
+		statistics_.max_instance_lights = std::max(statistics_.max_instance_lights, (size_t)found_counts_[i]);
+		statistics_.truncated_instances += found_counts_[i] > slot_counts_[i] ? 1 : 0;
+	}
+
+	statistics_.instances = boxes.size();
+	statistics_.light_indices = light_indices_.size();
+	statistics_.assign_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+const std::vector<unsigned int>& InstanceLights::getInstanceTable() const
+{
+	return instance_table_;
+}
+
+const std::vector<unsigned int>& InstanceLights::getLightIndices() const
+{
+	return light_indices_;
+}
+
+const InstanceLights::Statistics& InstanceLights::getStatistics() const
+{
+	return statistics_;
+}
+
+sponza::Aabb InstanceLights::getWorldBounds(const Box& box)
+{
+	return worldBounds(box.bounds, box.world);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <sponza/LightGrid.hpp>
+#include <sponza/types.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace sponza { class JobSystem; class Light; }
+
+//Lists the lights reaching each instance, a cheaper alternative to
+//LightClusters for scenes where most pieces are lit by only a few lights.
+//Each instance's world box is tested against the lights through a light
+//grid and keeps at most kMaxLightsPerInstance, the brightest at the box
+//first. The fragment shader then loops over its instance's list.
+//Nothing here touches GL, the lists are left for the view to upload
+class InstanceLights
+{
+public:
+
+	static const int kMaxLightsPerInstance = 16;
+
+	//A mesh space box and the transform placing it in the world
+	struct Box
+	{
+		sponza::Aabb bounds;
+		sponza::Matrix4x3 world;
+	};
+
+	struct Statistics
+	{
+		size_t instances{ 0 };
+		size_t light_indices{ 0 };
+		size_t max_instance_lights{ 0 };
+		size_t truncated_instances{ 0 };
+		double assign_microseconds{ 0.0 };
+	};
+
+	InstanceLights();
+
+	~InstanceLights();
+
+	//The pool lists are built on, by default the shared pool
+	void setJobSystem(sponza::JobSystem * jobs);
+
+	//Moves the grid's lights to match the scene's, light indices are the
+	//positions in the array. Lights that stayed in their cell cost a store
+	void setLights(const std::vector<sponza::Light>& lights);
+
+	//Lists the lights touching every box, in parallel over the boxes
+	void assign(const std::vector<Box>& boxes);
+
+	//Two values per box, the first of its lights in getLightIndices and how
+	//many there are
+	const std::vector<unsigned int>& getInstanceTable() const;
+
+	const std::vector<unsigned int>& getLightIndices() const;
+
+	const Statistics& getStatistics() const;
+
+	//The world box a box is tested as, the mesh box's corners transformed
+	static sponza::Aabb getWorldBounds(const Box& box);
+
+private:
+
+	struct LightSource
+	{
+		sponza::Vector3 position;
+		float range;
+		float brightness;
+	};
+
+	sponza::JobSystem * jobs_{ nullptr };
+
+	sponza::LightGrid light_grid_;
+	std::vector<LightSource> lights_;
+
+	//Every box gets kMaxLightsPerInstance slots while assigning in parallel,
+	//then the used slots are packed together
+	std::vector<unsigned int> slots_;
+	std::vector<unsigned int> slot_counts_;
+	std::vector<unsigned int> found_counts_;
+	std::vector<unsigned int> instance_table_;
+	std::vector<unsigned int> light_indices_;
+
+	Statistics statistics_;
+};
@@ -0,0 +1,249 @@
+#include "LightClusters.hpp"
+#include <sponza/JobSystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	//The first and last tile a range of normalised device coordinates
+	//covers, false if it misses the screen. Clamped as floats first since
+	//lights near the camera project far outside it
+	bool tileRange(float ndc_min, float ndc_max, int tiles, int& first, int& last)
+	{
+		if (ndc_max < -1.f || ndc_min > 1.f)
+			return false;
+		const float lower = std::max(ndc_min, -1.f);
+		const float upper = std::min(ndc_max, 1.f);
+		first = std::min((int)((lower * 0.5f + 0.5f) * tiles), tiles - 1);
+		last = std::min((int)((upper * 0.5f + 0.5f) * tiles), tiles - 1);
+		return true;
+	}
+}
+
+LightClusters::LightClusters()
+{
+	std::fill(view_, view_ + 16, 0.f);
+}
+
+LightClusters::~LightClusters()
+{
+}
+
+void LightClusters::setJobSystem(sponza::JobSystem * jobs)
+{
+	jobs_ = jobs;
+}
+
+void LightClusters::setView(const float * view,
+	float vertical_field_of_view_radians,
+	float aspect_ratio,
+	float near_plane_distance,
+	float far_plane_distance)
+{
+	std::copy(view, view + 16, view_);
+	if (!cluster_bounds_.empty()
+		&& vertical_field_of_view_ == vertical_field_of_view_radians
+		&& aspect_ratio_ == aspect_ratio
+		&& near_plane_ == near_plane_distance
+		&& far_plane_ == far_plane_distance)
+		return;
+
+	vertical_field_of_view_ = vertical_field_of_view_radians;
+	aspect_ratio_ = aspect_ratio;
+	near_plane_ = near_plane_distance;
+	far_plane_ = far_plane_distance;
+	tan_half_y_ = std::tan(vertical_field_of_view_radians * 0.5f);
+	tan_half_x_ = tan_half_y_ * aspect_ratio;
+	const float log_depth_ratio = std::log(far_plane_distance / near_plane_distance);
+	slice_scale_ = kSlices / log_depth_ratio;
+	slice_bias_ = -kSlices * std::log(near_plane_distance) / log_depth_ratio;
+	buildClusterBounds();
+}
+
+void LightClusters::buildClusterBounds()
+{
+	//A froxel's sides slope outwards, so its box takes the wider of its
+	//near and far faces on each side
+	cluster_bounds_.resize(kClusterCount);
+	for (int slice = 0; slice < kSlices; ++slice)
+	{
+		const float z_near = sliceDepth(slice);
+		const float z_far = sliceDepth(slice + 1);
+		for (int y = 0; y < kTilesY; ++y)
+		{
+			const float y0 = (-1.f + 2.f * y / kTilesY) * tan_half_y_;
+			const float y1 = (-1.f + 2.f * (y + 1) / kTilesY) * tan_half_y_;
+			for (int x = 0; x < kTilesX; ++x)
+			{
+				const float x0 = (-1.f + 2.f * x / kTilesX) * tan_half_x_;
+				const float x1 = (-1.f + 2.f * (x + 1) / kTilesX) * tan_half_x_;
+				Bounds& bounds = cluster_bounds_[(slice * kTilesY + y) * kTilesX + x];
+				bounds.min[0] = std::min(x0 * z_near, x0 * z_far);
+				bounds.max[0] = std::max(x1 * z_near, x1 * z_far);
+				bounds.min[1] = std::min(y0 * z_near, y0 * z_far);
+				bounds.max[1] = std::max(y1 * z_near, y1 * z_far);
+				bounds.min[2] = z_near;
+				bounds.max[2] = z_far;
+			}
+		}
+	}
+}
+
+float LightClusters::sliceDepth(int slice) const
+{
+	return near_plane_ * std::pow(far_plane_ / near_plane_, (float)slice / kSlices);
+}
+
+int LightClusters::depthSlice(float z) const
+{
+	const float slice = std::floor(std::log(z) * slice_scale_ + slice_bias_);
+	return (int)std::max(0.f, std::min(slice, (float)(kSlices - 1)));
+}
+
+void LightClusters::assign(const std::vector<Sphere>& lights)
+{
+	const auto start = std::chrono::steady_clock::now();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+
+	//Into view space first, noting the slices each light's depth reaches
+	view_spheres_.resize(lights.size());
+	jobs.parallelFor(lights.size(), 256, [&](size_t begin, size_t end)
+	{
+		const float * v = view_;
+		for (size_t i = begin; i < end; ++i)
+		{
+			const auto& c = lights[i].centre;
+			ViewSphere& sphere = view_spheres_[i];
+			sphere.x = v[0] * c.x + v[4] * c.y + v[8] * c.z + v[12];
+			sphere.y = v[1] * c.x + v[5] * c.y + v[9] * c.z + v[13];
+			sphere.z = -(v[2] * c.x + v[6] * c.y + v[10] * c.z + v[14]);
+			sphere.radius = lights[i].radius;
+			sphere.first_slice = 1;
+			sphere.last_slice = 0;
+			if (sphere.z + sphere.radius > near_plane_ && sphere.z - sphere.radius < far_plane_)
+			{
+				sphere.first_slice = depthSlice(std::max(sphere.z - sphere.radius, near_plane_));
+				sphere.last_slice = depthSlice(std::min(sphere.z + sphere.radius, far_plane_));
+			}
+		}
+	});
+
+	//Each slice's froxels are written by only the job handling that slice
+	cluster_lights_.resize(kClusterCount);
+	jobs.parallelFor(kSlices, 1, [&](size_t begin, size_t end)
+	{
+		for (size_t slice = begin; slice < end; ++slice)
+			assignSlice((int)slice);
+	});
+
+	statistics_ = Statistics();
+	cluster_table_.resize(2 * kClusterCount);
+	unsigned int offset = 0;
+	for (int cluster = 0; cluster < kClusterCount; ++cluster)
+	{
+		const unsigned int count = (unsigned int)cluster_lights_[cluster].size();
+		cluster_table_[2 * cluster] = offset;
+		cluster_table_[2 * cluster + 1] = count;
+		offset += count;
+		statistics_.max_cluster_lights = std::max(statistics_.max_cluster_lights, (size_t)count);
+	}
+	light_indices_.resize(offset);
+	jobs.parallelFor(kClusterCount, 256, [&](size_t begin, size_t end)
+	{
+		for (size_t cluster = begin; cluster < end; ++cluster)
+		{
+			const auto& list = cluster_lights_[cluster];
+			if (!list.empty())
+				std::memcpy(&light_indices_[cluster_table_[2 * cluster]], list.data(), list.size() * sizeof(unsigned int));
+		}
+	});
+
+	statistics_.lights = lights.size();
+	for (const auto& sphere : view_spheres_)
+		statistics_.visible_lights += sphere.first_slice <= sphere.last_slice ? 1 : 0;
+	statistics_.light_indices = light_indices_.size();
+	statistics_.assign_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void LightClusters::assignSlice(int slice)
+{
+	const int first_cluster = slice * kTilesY * kTilesX;
+	for (int cluster = first_cluster; cluster < first_cluster + kTilesY * kTilesX; ++cluster)
+		cluster_lights_[cluster].clear();
+
+	const float slice_near = sliceDepth(slice);
+	const float slice_far = sliceDepth(slice + 1);
+	for (size_t i = 0; i < view_spheres_.size(); ++i)
+	{
+		const ViewSphere& sphere = view_spheres_[i];
+		if (slice < sphere.first_slice || slice > sphere.last_slice)
+			continue;
+
+		//x / z over the part of the sphere's depth inside the slice is at
+		//its extremes on the corners, which bound the tiles to test
+		const float z0 = std::max(slice_near, sphere.z - sphere.radius);
+		const float z1 = std::min(slice_far, sphere.z + sphere.radius);
+		const float left = sphere.x - sphere.radius;
+		const float right = sphere.x + sphere.radius;
+		const float bottom = sphere.y - sphere.radius;
+		const float top = sphere.y + sphere.radius;
+		int first_x, last_x, first_y, last_y;
+		if (!tileRange(std::min(left / z0, left / z1) / tan_half_x_,
+				std::max(right / z0, right / z1) / tan_half_x_, kTilesX, first_x, last_x)
+			|| !tileRange(std::min(bottom / z0, bottom / z1) / tan_half_y_,
+				std::max(top / z0, top / z1) / tan_half_y_, kTilesY, first_y, last_y))
+			continue;
+
+		const float radius_squared = sphere.radius * sphere.radius;
+		const float centre[3] = { sphere.x, sphere.y, sphere.z };
+		for (int y = first_y; y <= last_y; ++y)
+		{
+			for (int x = first_x; x <= last_x; ++x)
+			{
+				const int cluster = first_cluster + y * kTilesX + x;
+				const Bounds& bounds = cluster_bounds_[cluster];
+				float distance_squared = 0.f;
+				for (int axis = 0; axis < 3; ++axis)
+				{
+					const float nearest = std::max(bounds.min[axis], std::min(centre[axis], bounds.max[axis]));
+					distance_squared += (centre[axis] - nearest) * (centre[axis] - nearest);
+				}
+				if (distance_squared <= radius_squared)
+					cluster_lights_[cluster].push_back((unsigned int)i);
+			}
+		}
+	}
+}
+
+const std::vector<unsigned int>& LightClusters::getClusterTable() const
+{
+	return cluster_table_;
+}
+
+const std::vector<unsigned int>& LightClusters::getLightIndices() const
+{
+	return light_indices_;
+}
+
+float LightClusters::getDepthSliceScale() const
+{
+	return slice_scale_;
+}
+
+float LightClusters::getDepthSliceBias() const
+{
+	return slice_bias_;
+}
+
+const LightClusters::Bounds& LightClusters::getClusterBounds(int cluster) const
+{
+	return cluster_bounds_[cluster];
+}
+
+const LightClusters::Statistics& LightClusters::getStatistics() const
+{
+	return statistics_;
+}
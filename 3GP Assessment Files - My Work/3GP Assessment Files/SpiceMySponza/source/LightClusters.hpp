@@ -0,0 +1,123 @@
+#pragma once
+
+#include <sponza/types.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace sponza { class JobSystem; }
+
+//Splits the view frustum into a grid of froxels, screen tiles by depth
+//slices spaced exponentially from the near plane to the far, and lists the
+//lights whose range reaches each one. The fragment shader finds its froxel
+//from its window position and depth and only loops over that froxel's lights.
+//Nothing here touches GL, the lists are left for the view to upload
+class LightClusters
+{
+public:
+
+	static const int kTilesX = 16;
+	static const int kTilesY = 9;
+	static const int kSlices = 24;
+	static const int kClusterCount = kTilesX * kTilesY * kSlices;
+
+	struct Sphere
+	{
+		sponza::Vector3 centre;
+		float radius;
+	};
+
+	//A froxel's box in view space, z the distance in front of the camera
+	struct Bounds
+	{
+		float min[3];
+		float max[3];
+	};
+
+	struct Statistics
+	{
+		size_t lights{ 0 };
+		size_t visible_lights{ 0 };
+		size_t light_indices{ 0 };
+		size_t max_cluster_lights{ 0 };
+		double assign_microseconds{ 0.0 };
+	};
+
+	LightClusters();
+
+	~LightClusters();
+
+	//The pool lights are assigned on, by default the shared pool
+	void setJobSystem(sponza::JobSystem * jobs);
+
+	//Sets the camera for the next assign. The view matrix is column-major as
+	//glm stores it, the froxel bounds are only rebuilt if the projection
+	//changed
+	void setView(const float * view,
+		float vertical_field_of_view_radians,
+		float aspect_ratio,
+		float near_plane_distance,
+		float far_plane_distance);
+
+	//Lists every light against the froxels its sphere touches, in parallel
+	//over depth slices
+	void assign(const std::vector<Sphere>& lights);
+
+	//Two values per cluster, the first of its lights in getLightIndices and
+	//how many there are. Clusters are ordered x fastest, then y, then slice
+	const std::vector<unsigned int>& getClusterTable() const;
+
+	const std::vector<unsigned int>& getLightIndices() const;
+
+	//The slice of a view depth z is floor(log(z) * scale + bias)
+	float getDepthSliceScale() const;
+
+	float getDepthSliceBias() const;
+
+	//The box each light is tested against, valid once setView has been called
+	const Bounds& getClusterBounds(int cluster) const;
+
+	const Statistics& getStatistics() const;
+
+private:
+
+	//A light in view space, x right, y up and z the distance in front of
+	//the camera, with the slices it reaches. first_slice > last_slice means
+	//none
+	struct ViewSphere
+	{
+		float x;
+		float y;
+		float z;
+		float radius;
+		int first_slice;
+		int last_slice;
+	};
+
+	void buildClusterBounds();
+
+	void assignSlice(int slice);
+
+	float sliceDepth(int slice) const;
+
+	int depthSlice(float z) const;
+
+	sponza::JobSystem * jobs_{ nullptr };
+
+	float view_[16];
+	float vertical_field_of_view_{ 0.f };
+	float aspect_ratio_{ 0.f };
+	float near_plane_{ 0.f };
+	float far_plane_{ 0.f };
+	float tan_half_x_{ 0.f };
+	float tan_half_y_{ 0.f };
+	float slice_scale_{ 0.f };
+	float slice_bias_{ 0.f };
+
+	std::vector<Bounds> cluster_bounds_;
+	std::vector<ViewSphere> view_spheres_;
+	std::vector<std::vector<unsigned int>> cluster_lights_;
+	std::vector<unsigned int> cluster_table_;
+	std::vector<unsigned int> light_indices_;
+
+	Statistics statistics_;
+};
@@ -0,0 +1,195 @@
+#include "MaterialTable.hpp"
+#include <sponza/sponza.hpp>
+#include <tygra/FileHelper.hpp>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	void copyColour(const sponza::Vector3& colour, float * out)
+	{
+		out[0] = colour.x;
+		out[1] = colour.y;
+		out[2] = colour.z;
+	}
+}
+
+MaterialTable::MaterialTable()
+{
+}
+
+MaterialTable::~MaterialTable()
+{
+}
+
+void MaterialTable::compile(const std::vector<sponza::Material>& materials)
+{
+	if (materials.size() > kMaxMaterials)
+		throw std::runtime_error("The scene has more materials than the shader's material array");
+
+	materials_.clear();
+	materials_.reserve(materials.size());
+	index_by_id_.clear();
+
+	for (const auto& material : materials)
+	{
+		MaterialGL packed;
+		copyColour(material.getAmbientColour(), packed.ambient_colour);
+		packed.shininess = material.getShininess();
+		copyColour(material.getDiffuseColour(), packed.diffuse_colour);
+		packed.diffuse_layer = findOrLoadTexture(material.getDiffuseTexture());
+		copyColour(material.getSpecularColour(), packed.specular_colour);
+		packed.specular_layer = findOrLoadTexture(material.getSpecularTexture());
+
+		const auto id = material.getId();
+		const auto slot = sponza::handleSlot(id);
+		if (slot >= index_by_id_.size())
+			index_by_id_.resize(slot + 1, IndexEntry{ 0, 0 });
+		index_by_id_[slot] = IndexEntry{ id, (int)materials_.size() };
+
+		materials_.push_back(packed);
+	}
+
+	if (packer_.getLayerCount() != uploaded_layer_count_)
+		uploadTextureArray();
+
+	//The buffer always holds the whole array so the block is fully backed
+	if (material_ubo_ == 0)
+	{
+		glGenBuffers(1, &material_ubo_);
+		glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
+		glBufferData(GL_UNIFORM_BUFFER, kMaxMaterials * sizeof(MaterialGL), nullptr, GL_STATIC_DRAW);
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, material_ubo_);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, materials_.size() * sizeof(MaterialGL), materials_.data());
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+void MaterialTable::release()
+{
+	glDeleteBuffers(1, &material_ubo_);
+	material_ubo_ = 0;
+	glDeleteTextures(1, &texture_array_);
+	texture_array_ = 0;
+	uploaded_layer_count_ = 0;
+	packer_.clear();
+	layer_by_name_.clear();
+	materials_.clear();
+	index_by_id_.clear();
+}
+
+GLuint MaterialTable::getUniformBuffer() const
+{
+	return material_ubo_;
+}
+
+int MaterialTable::getMaterialCount() const
+{
+	return (int)materials_.size();
+}
+
+int MaterialTable::getMaterialIndex(sponza::MaterialId id) const
+{
+	const auto slot = sponza::handleSlot(id);
+	if (slot >= index_by_id_.size() || index_by_id_[slot].id != id)
+		return 0;
+	return index_by_id_[slot].index;
+}
+
+const MaterialTable::MaterialGL& MaterialTable::getMaterial(int index) const
+{
+	return materials_[index];
+}
+
+GLuint MaterialTable::getTextureArray() const
+{
+	return texture_array_;
+}
+
+int MaterialTable::getTextureLayerCount() const
+{
+	return uploaded_layer_count_;
+}
+
+int MaterialTable::findOrLoadTexture(const std::string& name)
+{
+	if (name.empty())
+		return kNoTexture;
+
+	const auto found = layer_by_name_.find(name);
+	if (found != layer_by_name_.end())
+		return found->second;
+
+	//A texture that fails to load is remembered as missing, not retried
+	tygra::Image image = tygra::createImageFromPngFile("resource:///" + name);
+	if (!image.doesContainData())
+	{
+		std::cerr << "Failed to load texture " << name << std::endl;
+		layer_by_name_[name] = kNoTexture;
+		return kNoTexture;
+	}
+
+	TextureArrayPacker::Source source;
+	source.width = (int)image.width();
+	source.height = (int)image.height();
+	source.components = (int)image.componentsPerPixel();
+	source.bytes_per_component = (int)image.bytesPerComponent();
+	source.pixels = image.pixelData();
+	const int layer = packer_.add(source);
+	layer_by_name_[name] = layer;
+	return layer;
+}
+
+void MaterialTable::uploadTextureArray()
+{
+	GLint max_layers = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	if (packer_.getLayerCount() > max_layers)
+		throw std::runtime_error("The scene has more textures than a texture array can hold");
+
+	packer_.pack();
+	if (packer_.getResizedCount() > 0)
+	{
+		std::cout << "Resized " << packer_.getResizedCount() << " of "
+			<< packer_.getLayerCount() << " textures to "
+			<< packer_.getLayerWidth() << "x" << packer_.getLayerHeight()
+			<< " for the texture array" << std::endl;
+	}
+
+	//The layer size can change when textures are added, so the array is
+	//made again rather than grown
+	glDeleteTextures(1, &texture_array_);
+	glGenTextures(1, &texture_array_);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture_array_);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY,
+		0,
+		GL_RGBA8,
+		packer_.getLayerWidth(),
+		packer_.getLayerHeight(),
+		packer_.getLayerCount(),
+		0,
+		GL_RGBA,
+		GL_UNSIGNED_BYTE,
+		nullptr);
+	for (int layer = 0; layer < packer_.getLayerCount(); ++layer)
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY,
+			0,
+			0, 0, layer,
+			packer_.getLayerWidth(),
+			packer_.getLayerHeight(),
+			1,
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			packer_.getLayerPixels(layer));
+	}
+	glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	uploaded_layer_count_ = packer_.getLayerCount();
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <sponza/sponza_fwd.hpp>
+#include "TextureArrayPacker.hpp"
+#include <tgl/tgl.h>
+#include <map>
+#include <string>
+#include <vector>
+
+//The scene's materials compiled for the GPU: every texture becomes a layer
+//of one 2D texture array and the materials are packed into a std140 uniform
+//buffer, so a draw selects its material with a single index and the
+//textures are bound once for the whole scene
+class MaterialTable
+{
+public:
+
+	//Must match kMaxMaterials in the shaders. DeferredView keeps the index
+	//in an eight-bit G-buffer channel, so this can be no more than 256
+	static const int kMaxMaterials = 256;
+
+	//Marks a material without a texture layer of that kind
+	static const int kNoTexture = -1;
+
+	//One element of the shader's material array, laid out for std140
+	struct MaterialGL
+	{
+		float ambient_colour[3];
+		float shininess;
+		float diffuse_colour[3];
+		int diffuse_layer;
+		float specular_colour[3];
+		int specular_layer;
+	};
+
+	MaterialTable();
+
+	~MaterialTable();
+
+	//Packs the materials into the uniform buffer, loading any textures not
+	//already loaded by an earlier compile and rebuilding the texture array
+	//if there were any. Textures stay loaded until release.
+	//Throws std::runtime_error if the textures need more layers than GL allows
+	void compile(const std::vector<sponza::Material>& materials);
+
+	void release();
+
+	GLuint getUniformBuffer() const;
+
+	int getMaterialCount() const;
+
+	//Returns the index of the material in the uniform buffer
+	int getMaterialIndex(sponza::MaterialId id) const;
+
+	const MaterialGL& getMaterial(int index) const;
+
+	//Returns the GL_TEXTURE_2D_ARRAY holding every material's textures, 0 if
+	//no material has a texture
+	GLuint getTextureArray() const;
+
+	int getTextureLayerCount() const;
+
+private:
+
+	int findOrLoadTexture(const std::string& name);
+
+	void uploadTextureArray();
+
+	GLuint material_ubo_{ 0 };
+
+	std::vector<MaterialGL> materials_;
+
+	//Indexed by the slot of a material id's handle. The whole id is kept to
+	//reject stale ids, which map to index 0 like ids without a material
+	struct IndexEntry
+	{
+		sponza::MaterialId id;
+		int index;
+	};
+	std::vector<IndexEntry> index_by_id_;
+
+	TextureArrayPacker packer_;
+	GLuint texture_array_{ 0 };
+	int uploaded_layer_count_{ 0 };
+	std::map<std::string, int> layer_by_name_;
+};
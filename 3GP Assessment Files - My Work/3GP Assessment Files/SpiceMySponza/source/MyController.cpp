@@ -1,42 +1,183 @@
 #include "MyController.hpp"
 #include "MyView.hpp"
+#include "DeferredView.hpp"
+
+#include "Benchmark.hpp"
 
 #include <sponza/sponza.hpp>
 #include <tygra/Window.hpp>
 #include <glm/glm.hpp>
 
 #include <iostream>
+#include <memory>
+#include <stdexcept>
+
+MyController::MyController() : MyController(sponza::SceneSettings())
+{
+}
 
-MyController::MyController()
+MyController::MyController(const sponza::SceneSettings& settings)
 {
-    scene_ = new sponza::Context();
+    scene_ = new sponza::Context(std::make_unique<sponza::RealTimeClock>(),
+                                 settings);
     view_ = new MyView();
     view_->setScene(scene_);
+    deferred_view_ = new DeferredView();
+    deferred_view_->setScene(scene_);
 }
 
 MyController::~MyController()
 {
+    stopSimulationThread();
     delete view_;
+    delete deferred_view_;
     delete scene_;
 }
 
+void MyController::recordTo(const std::string& path)
+{
+    record_file_.open(path, std::ios::binary);
+    if (!record_file_) {
+        throw std::runtime_error("Failed to open " + path + " for recording");
+    }
+}
+
+void MyController::replayFrom(const std::string& path)
+{
+    replay_file_.open(path, std::ios::binary);
+    if (!replay_file_) {
+        throw std::runtime_error("Failed to open " + path + " for replay");
+    }
+    replaying_ = true;
+    threaded_simulation_ = false;
+}
+
+bool MyController::hasFinished() const
+{
+    return finished_;
+}
+
+void MyController::useDeferredRenderer()
+{
+    deferred_rendering_ = true;
+}
+
 void MyController::windowControlWillStart(tygra::Window * window)
 {
-    window->setView(view_);
+    if (deferred_rendering_) {
+        window->setView(deferred_view_);
+    }
+    else {
+        window->setView(view_);
+    }
     window->setTitle("3D Graphics Programming :: SpiceMySponza");
+    if (threaded_simulation_) {
+        startSimulationThread();
+    }
 }
 
 void MyController::windowControlDidStop(tygra::Window * window)
 {
+    stopSimulationThread();
     window->setView(nullptr);
 }
 
 void MyController::windowControlViewWillRender(tygra::Window * window)
 {
-    scene_->update();
+    if (replaying_) {
+        replayNextFrame();
+        return;
+    }
+    if (threaded_simulation_) {
+        // kick off the next frame, the view draws the latest finished one
+        {
+            std::lock_guard<std::mutex> lock(simulation_mutex_);
+            pending_linear_velocity_ = camera_linear_velocity_;
+            pending_rotational_velocity_ = camera_rotational_velocity_;
+            simulation_step_pending_ = true;
+        }
+        simulation_requested_.notify_one();
+    }
+    else {
+        stepSimulation(camera_linear_velocity_, camera_rotational_velocity_);
+    }
     if (camera_turn_mode_) {
-        scene_->getCamera().setRotationalVelocity(sponza::Vector2(0, 0));
+        camera_rotational_velocity_ = sponza::Vector2(0, 0);
+    }
+}
+
+void MyController::startSimulationThread()
+{
+    if (simulation_thread_.joinable())
+        return;
+    simulation_quit_ = false;
+    simulation_step_pending_ = false;
+    simulation_thread_ = std::thread(&MyController::simulationThreadMain, this);
+}
+
+void MyController::stopSimulationThread()
+{
+    if (!simulation_thread_.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(simulation_mutex_);
+        simulation_quit_ = true;
+    }
+    simulation_requested_.notify_one();
+    simulation_thread_.join();
+}
+
+void MyController::simulationThreadMain()
+{
+    for (;;) {
+        sponza::Vector3 linear_velocity;
+        sponza::Vector2 rotational_velocity;
+        {
+            std::unique_lock<std::mutex> lock(simulation_mutex_);
+            simulation_requested_.wait(lock, [this] {
+                return simulation_quit_ || simulation_step_pending_;
+            });
+            if (simulation_quit_)
+                return;
+            simulation_step_pending_ = false;
+            linear_velocity = pending_linear_velocity_;
+            rotational_velocity = pending_rotational_velocity_;
+        }
+        stepSimulation(linear_velocity, rotational_velocity);
+    }
+}
+
+void MyController::stepSimulation(sponza::Vector3 linear_velocity,
+                                  sponza::Vector2 rotational_velocity)
+{
+    scene_->getCamera().setLinearVelocity(linear_velocity);
+    scene_->getCamera().setRotationalVelocity(rotational_velocity);
+    scene_->update();
+    if (record_file_.is_open()) {
+        scene_->writeSnapshot(record_file_);
+    }
+}
+
+void MyController::replayNextFrame()
+{
+    if (finished_)
+        return;
+
+    //Time from one frame's snapshot being ready to the next frame starting,
+    //which covers drawing it and nothing of the simulation
+    const auto now = std::chrono::steady_clock::now();
+    if (replay_frame_start_ != std::chrono::steady_clock::time_point()) {
+        replay_frame_ms_.push_back(
+            std::chrono::duration<double, std::milli>(now - replay_frame_start_).count());
     }
+
+    if (!scene_->readSnapshot(replay_file_)) {
+        std::cout << "Replay finished" << std::endl;
+        printFrameTimeSummary(std::cout, replay_frame_ms_);
+        finished_ = true;
+        return;
+    }
+    replay_frame_start_ = std::chrono::steady_clock::now();
 }
 
 void MyController::windowControlMouseMoved(tygra::Window * window,
@@ -49,8 +190,8 @@ void MyController::windowControlMouseMoved(tygra::Window * window,
         int dx = x - prev_x;
         int dy = y - prev_y;
         const float mouse_speed = 0.6f;
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(-dx * mouse_speed, -dy * mouse_speed));
+        camera_rotational_velocity_
+            = sponza::Vector2(-dx * mouse_speed, -dy * mouse_speed);
     }
     prev_x = x;
     prev_y = y;
@@ -99,10 +240,57 @@ void MyController::windowControlKeyboardChanged(tygra::Window * window,
     if (!down)
         return;
 
-    //switch (key_index)
-    //{
-    //    // TODO: put usual keypress responses here
-    //}
+    switch (key_index)
+    {
+    case 'T':
+        if (replaying_)
+            break;
+        threaded_simulation_ = !threaded_simulation_;
+        if (threaded_simulation_)
+            startSimulationThread();
+        else
+            stopSimulationThread();
+        std::cout << "Threaded simulation "
+            << (threaded_simulation_ ? "on" : "off") << std::endl;
+        break;
+    case 'P':
+        if (deferred_rendering_)
+            deferred_view_->printRenderStatistics(std::cout);
+        else
+            view_->printDrawStatistics(std::cout);
+        break;
+    case 'R':
+        //The window stops one view and starts the other, each builds its
+        //GL objects from scratch
+        deferred_rendering_ = !deferred_rendering_;
+        if (deferred_rendering_)
+            window->setView(deferred_view_);
+        else
+            window->setView(view_);
+        std::cout << (deferred_rendering_ ? "Deferred" : "Forward")
+            << " renderer" << std::endl;
+        break;
+    case 'M':
+        std::cout << "Multi-draw indirect "
+            << (view_->toggleMultiDrawIndirect() ? "on" : "off") << std::endl;
+        break;
+    case 'C':
+        std::cout << "Frustum culling "
+            << (view_->toggleFrustumCulling() ? "on" : "off") << std::endl;
+        break;
+    case 'O':
+        std::cout << "Occlusion culling "
+            << (view_->toggleOcclusionCulling() ? "on" : "off") << std::endl;
+        break;
+    case 'Z':
+        std::cout << "Depth pre-pass "
+            << (view_->toggleDepthPrepass() ? "on" : "off") << std::endl;
+        break;
+    case 'L':
+        std::cout << "Per-instance light lists "
+            << (view_->toggleInstanceLightLists() ? "on" : "off") << std::endl;
+        break;
+    }
 }
 
 void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
@@ -148,9 +336,9 @@ void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
         else {
             camera_rotate_speed_[0] = 0.f;
         }
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
-                camera_rotate_speed_[1] * rotate_speed));
+        camera_rotational_velocity_
+            = sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
+                              camera_rotate_speed_[1] * rotate_speed);
         break;
     case tygra::kWindowGamepadAxisRightThumbY:
         if (pos < -deadzone || pos > deadzone) {
@@ -159,9 +347,9 @@ void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
         else {
             camera_rotate_speed_[1] = 0.f;
         }
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
-                camera_rotate_speed_[1] * rotate_speed));
+        camera_rotational_velocity_
+            = sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
+                              camera_rotate_speed_[1] * rotate_speed);
         break;
     }
 
@@ -182,6 +370,5 @@ void MyController::updateCameraTranslation()
         + key_speed * camera_move_speed_[1];
     const float forward_speed = key_speed * camera_move_speed_[2]
         - key_speed * camera_move_speed_[3];
-    scene_->getCamera().setLinearVelocity(
-        sponza::Vector3(sideward_speed, 0, forward_speed));
+    camera_linear_velocity_ = sponza::Vector3(sideward_speed, 0, forward_speed);
 }
@@ -1,8 +1,16 @@
 #pragma once
 #include <tygra/WindowControlDelegate.hpp>
 #include <sponza/sponza_fwd.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
 
 class MyView;
+class DeferredView;
 
 class MyController : public tygra::WindowControlDelegate
 {
@@ -10,8 +18,24 @@ public:
 
     MyController();
 
+    //Runs a generated scene instead of the stock one
+    explicit MyController(const sponza::SceneSettings& settings);
+
     ~MyController();
 
+    //Writes every simulated frame to the file as a snapshot record
+    void recordTo(const std::string& path);
+
+    //Draws the snapshot records in the file instead of simulating, then
+    //prints the frame times and reports finished
+    void replayFrom(const std::string& path);
+
+    bool hasFinished() const;
+
+    //Starts with the deferred renderer instead of MyView, R switches
+    //between them while running
+    void useDeferredRenderer();
+
 private:
 
     void windowControlWillStart(tygra::Window * window) override;
@@ -47,12 +71,48 @@ private:
 
     void updateCameraTranslation();
 
+    void startSimulationThread();
+
+    void stopSimulationThread();
+
+    void simulationThreadMain();
+
+    void stepSimulation(sponza::Vector3 linear_velocity,
+                        sponza::Vector2 rotational_velocity);
+
+    void replayNextFrame();
+
 private:
 
     MyView * view_{ nullptr };
+    DeferredView * deferred_view_{ nullptr };
+    bool deferred_rendering_{ false };
     sponza::Context * scene_{ nullptr };
 
     bool camera_turn_mode_{ false };
     float camera_move_speed_[4]{ 0.f, 0.f, 0.f, 0.f };
     float camera_rotate_speed_[2]{ 0.f, 0.f };
+
+    // camera input is only applied to the scene by the simulation step
+    sponza::Vector3 camera_linear_velocity_;
+    sponza::Vector2 camera_rotational_velocity_;
+
+    // when threaded, frame N+1 is simulated while frame N is rendered
+    bool threaded_simulation_{ true };
+    std::thread simulation_thread_;
+    std::mutex simulation_mutex_;
+    std::condition_variable simulation_requested_;
+    bool simulation_step_pending_{ false };
+    bool simulation_quit_{ false };
+    sponza::Vector3 pending_linear_velocity_;
+    sponza::Vector2 pending_rotational_velocity_;
+
+    // recording is written by the simulation step, replay is read on the
+    // main thread and takes the simulation's place
+    std::ofstream record_file_;
+    std::ifstream replay_file_;
+    bool replaying_{ false };
+    bool finished_{ false };
+    std::vector<double> replay_frame_ms_;
+    std::chrono::steady_clock::time_point replay_frame_start_;
 };
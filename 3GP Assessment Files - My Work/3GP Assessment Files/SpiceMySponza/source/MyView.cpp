@@ -3,9 +3,34 @@
 #include <tygra/FileHelper.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
+#include <thread>
 #include <cassert>
 
+namespace
+{
+	//Uniform and block names, hashed by the compiler
+	constexpr StringId kMaterialTextures = stringId("material_textures");
+	constexpr StringId kMaterialBlock = stringId("MaterialBlock");
+	constexpr StringId kFrameBlock = stringId("FrameBlock");
+	constexpr StringId kClusterBlock = stringId("ClusterBlock");
+	constexpr StringId kLightData = stringId("light_data");
+	constexpr StringId kClusterTable = stringId("cluster_table");
+	constexpr StringId kClusterLightIndices = stringId("cluster_light_indices");
+	constexpr StringId kInstanceLightIndices = stringId("instance_light_indices");
+
+	void copyVec3(const sponza::Vector3& v, float * out)
+	{
+		out[0] = v.x;
+		out[1] = v.y;
+		out[2] = v.z;
+	}
+}
+
 MyView::MyView()
 {
 }
@@ -22,73 +47,69 @@ void MyView::windowViewWillStart(tygra::Window * window)
 {
     assert(scene_ != nullptr);
 
-	start_time_ = std::chrono::system_clock::now();
-
-	GLint compile_status = GL_FALSE;
-
-	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	std::string vertex_shader_string
-		= tygra::createStringFromFile("resource:///sponza_vs.glsl");
-	const char * vertex_shader_code = vertex_shader_string.c_str();
-	glShaderSource(vertex_shader, 1,
-		(const GLchar **)&vertex_shader_code, NULL);
-	glCompileShader(vertex_shader);
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &compile_status);
-	if (compile_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetShaderInfoLog(vertex_shader, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
-
-	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	std::string fragment_shader_string
-		= tygra::createStringFromFile("resource:///sponza_fs.glsl");
-	const char * fragment_shader_code = fragment_shader_string.c_str();
-	glShaderSource(fragment_shader, 1,
-		(const GLchar **)&fragment_shader_code, NULL);
-	glCompileShader(fragment_shader);
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compile_status);
-	if (compile_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetShaderInfoLog(fragment_shader, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
-
-	//Create shader program & shader in variables
-	shader_program_ = glCreateProgram();
-	glAttachShader(shader_program_, vertex_shader);
+	render_jobs_ = std::make_unique<sponza::JobSystem>(std::max(std::thread::hardware_concurrency(), 1u) - 1);
+	frustum_culler_.setJobSystem(render_jobs_.get());
+	command_recorder_.setJobSystem(render_jobs_.get());
+	occlusion_culler_.setJobSystem(render_jobs_.get());
+	light_clusters_.setJobSystem(render_jobs_.get());
+	instance_lights_.setJobSystem(render_jobs_.get());
 
 	//glBindAttribLocation for all shader streamed IN variables
-	glBindAttribLocation(shader_program_, kVertexPosition, "vertex_position");
-	glBindAttribLocation(shader_program_, kVertexNormal, "vertex_normal");
-	glBindAttribLocation(shader_program_, kTextureCoordinates, "texture_coordinates");
-
-	glDeleteShader(vertex_shader);
-	glAttachShader(shader_program_, fragment_shader);
-	glDeleteShader(fragment_shader);
-	glLinkProgram(shader_program_);
-
-	GLint link_status = GL_FALSE;
-	glGetProgramiv(shader_program_, GL_LINK_STATUS, &link_status);
-	if (link_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetProgramInfoLog(shader_program_, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
+	shader_program_.link("resource:///sponza_vs.glsl",
+		"resource:///sponza_fs.glsl",
+		{ { kVertexPosition, "vertex_position" },
+		  { kVertexNormal, "vertex_normal" },
+		  { kTextureCoordinates, "texture_coordinates" },
+		  { kInstanceWorldMatrix, "instance_world_matrix" },
+		  { kInstanceMaterialIndex, "instance_material_index" },
+		  { kInstanceLightList, "instance_light_list" } });
+
+	//The material array comes from a uniform buffer and the textures from
+	//an array on a fixed unit, only the buffer contents change after this
+	shader_program_.setUniformBlockBinding(kMaterialBlock, kMaterialBlockBinding);
+	shader_program_.setUniformBlockBinding(kFrameBlock, kFrameBlockBinding);
+	shader_program_.setUniformBlockBinding(kClusterBlock, kClusterBlockBinding);
+	if (shader_program_.getUniformBlockSize(kFrameBlock) != sizeof(FrameBlockGL)
+		|| shader_program_.getUniformBlockSize(kClusterBlock) != sizeof(ClusterBlockGL))
+		std::cerr << "Uniform block layouts in the shaders do not match MyView" << std::endl;
+
+	//The pre-pass reads only positions and the instance matrices
+	depth_program_.link("resource:///depth_vs.glsl",
+		"resource:///depth_fs.glsl",
+		{ { kVertexPosition, "vertex_position" },
+		  { kInstanceWorldMatrix, "instance_world_matrix" } });
+	depth_program_.setUniformBlockBinding(kFrameBlock, kFrameBlockBinding);
+	depth_pass_timer_.create();
+	shading_pass_timer_.create();
+
+	//Per-frame blocks and lists are written into the stream each frame and
+	//bound by range, the buffer textures' units never change
+	stream_.create(kStreamRegionSize);
+	light_buffer_.create(GL_RGBA32F);
+	cluster_table_buffer_.create(GL_RG32UI);
+	cluster_index_buffer_.create(GL_R32UI);
+	instance_light_buffer_.create(GL_R32UI);
+	glUseProgram(shader_program_.getId());
+	glUniform1i(shader_program_.getUniformLocation(kMaterialTextures), kMaterialTex);
+	glUniform1i(shader_program_.getUniformLocation(kLightData), kLightDataTex);
+	glUniform1i(shader_program_.getUniformLocation(kClusterTable), kClusterTableTex);
+	glUniform1i(shader_program_.getUniformLocation(kClusterLightIndices), kClusterIndexTex);
+	glUniform1i(shader_program_.getUniformLocation(kInstanceLightIndices), kInstanceLightTex);
+	glUseProgram(kNullId);
 
 	/*
 		The framework provides a builder class that allows access to all the mesh data	
 	*/
 
+	//Instance attributes are part of every vertex array and read from the
+	//stream, so it has to exist before them
 	sponza::GeometryBuilder builder;
 	const auto& source_meshes = builder.getAllMeshes();
 
+	//Low polygon meshes double as occluders, drawn into a buffer far smaller
+	//than the window
+	occlusion_culler_.resize(kOcclusionBufferWidth, kOcclusionBufferHeight);
+
 	//Loop through each mesh in the scene
 	for each (const sponza::Mesh& source in source_meshes)
 	{
@@ -101,6 +122,9 @@ void MyView::windowViewWillStart(tygra::Window * window)
 
 		MeshGL myMesh;
 		myMesh.id = source.getId();
+		myMesh.bounds = scene_->getMeshBoundsById(source.getId());
+		if ((int)elements.size() / 3 <= kMaxOccluderMeshTriangles)
+			myMesh.occluder_mesh = occlusion_culler_.addOccluderMesh(positions, elements);
 
 		//Create VBOs for position, normals, elements and texture coordinates
 		glGenBuffers(1, &myMesh.positionVBO);
@@ -137,110 +161,25 @@ void MyView::windowViewWillStart(tygra::Window * window)
 		glBindBuffer(GL_ARRAY_BUFFER, myMesh.textureCoordinatesVBO);
 		glEnableVertexAttribArray(kTextureCoordinates);
 		glVertexAttribPointer(kTextureCoordinates, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), TGL_BUFFER_OFFSET(0));
+		setInstanceAttributePointers();
 		glBindBuffer(GL_ARRAY_BUFFER, kNullId);
 		glBindVertexArray(kNullId);
+		myMesh.depth_vao = createDepthVertexArray(myMesh.positionVBO, myMesh.elementVBO);
 
 		//Store in a mesh structure and add to a container for later use
 		m_meshVector.push_back(myMesh);
+	}
 
-		//Load in all the textures
-		tygra::Image diff0 = tygra::createImageFromPngFile("resource:///diff0.png");
-		if (diff0.doesContainData()) {
-			glGenTextures(1, &diff0_texture);
-			glBindTexture(GL_TEXTURE_2D, diff0_texture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-				GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			GLenum pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
-			glTexImage2D(GL_TEXTURE_2D,
-				0,
-				GL_RGBA,
-				diff0.width(),
-				diff0.height(),
-				0,
-				pixel_formats[diff0.componentsPerPixel()],
-				diff0.bytesPerComponent() == 1
-				? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
-				diff0.pixelData());
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, kNullId);
-		}
-
-		tygra::Image diff1 = tygra::createImageFromPngFile("resource:///diff1.png");
-		if (diff1.doesContainData()) {
-			glGenTextures(1, &diff1_texture);
-			glBindTexture(GL_TEXTURE_2D, diff1_texture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-				GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			GLenum pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
-			glTexImage2D(GL_TEXTURE_2D,
-				0,
-				GL_RGBA,
-				diff1.width(),
-				diff1.height(),
-				0,
-				pixel_formats[diff1.componentsPerPixel()],
-				diff1.bytesPerComponent() == 1
-				? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
-				diff1.pixelData());
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, kNullId);
-		}
+	//All meshes in one set of buffers for indirect draws, which cannot
+	//change vertex arrays between commands
+	createSceneGeometry(source_meshes);
 
-		tygra::Image spec1 = tygra::createImageFromPngFile("resource:///spec1.png");
-		if (spec1.doesContainData()) {
-			glGenTextures(1, &spec1_texture);
-			glBindTexture(GL_TEXTURE_2D, spec1_texture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-				GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			GLenum pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
-			glTexImage2D(GL_TEXTURE_2D,
-				0,
-				GL_RGBA,
-				spec1.width(),
-				spec1.height(),
-				0,
-				pixel_formats[spec1.componentsPerPixel()],
-				spec1.bytesPerComponent() == 1
-				? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
-				spec1.pixelData());
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, kNullId);
-		}
-
-		tygra::Image spec2 = tygra::createImageFromPngFile("resource:///spec2.png");
-		if (spec2.doesContainData()) {
-			glGenTextures(1, &spec2_texture);
-			glBindTexture(GL_TEXTURE_2D, spec2_texture);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-				GL_LINEAR_MIPMAP_LINEAR);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			GLenum pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
-			glTexImage2D(GL_TEXTURE_2D,
-				0,
-				GL_RGBA,
-				spec2.width(),
-				spec2.height(),
-				0,
-				pixel_formats[spec2.componentsPerPixel()],
-				spec2.bytesPerComponent() == 1
-				? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
-				spec2.pixelData());
-			glGenerateMipmap(GL_TEXTURE_2D);
-			glBindTexture(GL_TEXTURE_2D, kNullId);
-		}
-	}
+	//Pack the textures into one array and the materials for the shader once
+	material_table_.compile(scene_->getAllMaterials());
+	material_revision_ = scene_->getMaterialRevision();
 
+	//Setting up left bindings the cache knows nothing about
+	state_cache_.invalidate();
 }
 
 void MyView::windowViewDidReset(tygra::Window * window,
@@ -253,32 +192,65 @@ void MyView::windowViewDidReset(tygra::Window * window,
 void MyView::windowViewDidStop(tygra::Window * window)
 {
 	//Delete all the buffers when program is closed to prevent memory leaks
-	glDeleteProgram(shader_program_);
+	shader_program_.release();
+	depth_program_.release();
+	depth_pass_timer_.release();
+	shading_pass_timer_.release();
+	light_buffer_.release();
+	cluster_table_buffer_.release();
+	cluster_index_buffer_.release();
+	instance_light_buffer_.release();
+	stream_.release();
+	instance_attribute_buffer_ = 0;
+	indirect_buffer_ = 0;
+	glDeleteBuffers(1, &scene_geometry_.positionVBO);
+	glDeleteBuffers(1, &scene_geometry_.normalVBO);
+	glDeleteBuffers(1, &scene_geometry_.elementVBO);
+	glDeleteBuffers(1, &scene_geometry_.textureCoordinatesVBO);
+	glDeleteVertexArrays(1, &scene_vao_);
+	glDeleteVertexArrays(1, &scene_depth_vao_);
+	material_table_.release();
 
 	for (auto &p : m_meshVector)
 	{
 		glDeleteBuffers(1, &p.positionVBO);
 		glDeleteBuffers(1, &p.normalVBO);
-		glDeleteBuffers(1, &p.positionVBO);
 		glDeleteBuffers(1, &p.elementVBO);
 		glDeleteBuffers(1, &p.textureCoordinatesVBO);
 		glDeleteVertexArrays(1, &p.vao);
+		glDeleteVertexArrays(1, &p.depth_vao);
 	}
+
+	//The window can start the view again, as it does when switching renderer
+	m_meshVector.clear();
+	occlusion_culler_.clearOccluderMeshes();
+	render_jobs_.reset();
 }
 
 void MyView::windowViewRender(tygra::Window * window)
 {
 	assert(scene_ != nullptr);
 
+	//Take the latest finished frame, the next may already be simulating
+	const sponza::SceneSnapshot& frame = scene_->acquireSnapshot();
+
+	//Count this frame's state calls from here
+	state_cache_.resetCounters();
+
+	//Waits only if the GPU is still reading the region from three frames
+	//back
+	stream_.beginFrame();
+
 	// Configure pipeline settings
-	glEnable(GL_DEPTH_TEST);
-	glEnable(GL_CULL_FACE);
+	state_cache_.enable(GL_DEPTH_TEST);
+	state_cache_.enable(GL_CULL_FACE);
 
-	// Clear buffers from previous frame
+	// Clear buffers from previous frame, the masks also apply to clears and
+	// last frame's shading pass may have left depth writes off
+	state_cache_.depthMask(GL_TRUE);
+	state_cache_.colorMask(GL_TRUE);
 	glClearColor(0.f, 0.f, 0.25f, 0.f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-	glUseProgram(shader_program_);
 	 
 	// Compute viewport
 	GLint viewport_size[4];
@@ -286,135 +258,590 @@ void MyView::windowViewRender(tygra::Window * window)
 	const float aspect_ratio = viewport_size[2] / (float)viewport_size[3];
 
 	//Compute projection matrix
-	const auto& cam = scene_->getCamera();
+	const auto& cam = frame.getCamera();
 	glm::mat4 projection_xform = glm::perspective(glm::radians(cam.getVerticalFieldOfViewInDegrees()), aspect_ratio, cam.getNearPlaneDistance(), cam.getFarPlaneDistance());
 
 	//Compute view matrix
-	const auto& camera_pos = (const glm::vec3&)scene_->getCamera().getPosition();
-	const auto& camera_at_pos = camera_pos + (glm::vec3&)scene_->getCamera().getDirection();
-	const auto& world_up = (glm::vec3&)scene_->getUpDirection();
+	const auto& camera_pos = (const glm::vec3&)frame.getCamera().getPosition();
+	const auto& camera_at_pos = camera_pos + (glm::vec3&)frame.getCamera().getDirection();
+	const auto& world_up = (glm::vec3&)frame.getUpDirection();
 
 	//Compute camera view matrix and combine with projection matrix
 	glm::mat4 view_xform = glm::lookAt(camera_pos, camera_at_pos, world_up);
 
-	//Create combined view * projection matrix and pass to shader as a uniform
+	//Sort the scene's lights into the froxels they reach
+	updateLightClusters(frame, view_xform, aspect_ratio);
+
+	//Create combined view * projection matrix and pass it with the other
+	//per-frame values in a single buffer update
 	glm::mat4 combined_matrix = projection_xform * view_xform;
-	GLuint combined_matrix_id = glGetUniformLocation(shader_program_, "combined_matrix");
-	glUniformMatrix4fv(combined_matrix_id, 1, GL_FALSE, glm::value_ptr(combined_matrix));
+	FrameBlockGL frame_block;
+	std::memcpy(frame_block.combined_matrix, glm::value_ptr(combined_matrix), sizeof(frame_block.combined_matrix));
+	copyVec3(frame.getCamera().getPosition(), frame_block.camera_position);
+	frame_block.light_count = (int)lights_gl_.size();
+	copyVec3(frame.getAmbientLightIntensity(), frame_block.scene_ambient_light);
+	frame_block.padding = 0.f;
+	const GLintptr frame_offset = stream_.write(&frame_block, sizeof(frame_block), stream_.getUniformAlignment());
+	state_cache_.bindBufferRange(GL_UNIFORM_BUFFER, kFrameBlockBinding, stream_.getBuffer(), frame_offset, sizeof(frame_block));
+
+	//Recompile if the scene replaced its materials, as a replay can
+	if (material_revision_ != scene_->getMaterialRevision())
+	{
+		material_table_.compile(scene_->getAllMaterials());
+		material_revision_ = scene_->getMaterialRevision();
 
-	//Get light data from scene then plug the values into the shader
-	glm::vec3 scene_ambient_light = (glm::vec3&)scene_->getAmbientLightIntensity();
-	GLuint scene_ambient_light_id = glGetUniformLocation(shader_program_, "scene_ambient_light");
-	glUniform3fv(scene_ambient_light_id, 1, glm::value_ptr(scene_ambient_light));
+		//Loading textures binds them behind the cache's back
+		state_cache_.invalidate();
+	}
+	state_cache_.bindBufferBase(GL_UNIFORM_BUFFER, kMaterialBlockBinding, material_table_.getUniformBuffer());
+	state_cache_.bindTexture(kMaterialTex, GL_TEXTURE_2D_ARRAY, material_table_.getTextureArray());
+	state_cache_.bindTexture(kLightDataTex, GL_TEXTURE_BUFFER, light_buffer_.getTexture());
+	state_cache_.bindTexture(kClusterTableTex, GL_TEXTURE_BUFFER, cluster_table_buffer_.getTexture());
+	state_cache_.bindTexture(kClusterIndexTex, GL_TEXTURE_BUFFER, cluster_index_buffer_.getTexture());
+	state_cache_.bindTexture(kInstanceLightTex, GL_TEXTURE_BUFFER, instance_light_buffer_.getTexture());
+
+	//Group this frame's instances by mesh and material and upload their
+	//matrices, material indices and light lists together
+	buildDrawGroups(frame, combined_matrix);
+	if (instance_light_lists_)
+		assignInstanceLights();
+	uploadInstanceData();
+	if (render_mode_ == kMultiDrawIndirect)
+		updateIndirectCommands();
+
+	//Lay down the nearest depth first, so the light loop in the shading
+	//pass runs once per pixel rather than for every overlapping fragment
+	if (depth_prepass_)
+	{
+		depth_pass_timer_.begin();
+		state_cache_.colorMask(GL_FALSE);
+		state_cache_.depthFunc(GL_LESS);
+		state_cache_.useProgram(depth_program_.getId());
+		drawScene(true);
+		depth_pass_timer_.end();
+	}
 
-	glm::vec3 camera_position = camera_pos;
-	GLuint camera_position_id = glGetUniformLocation(shader_program_, "camera_position");
-	glUniform3fv(camera_position_id, 1, glm::value_ptr(camera_position));
+	shading_pass_timer_.begin();
+	state_cache_.colorMask(GL_TRUE);
+	state_cache_.depthFunc(depth_prepass_ ? GL_EQUAL : GL_LESS);
+	state_cache_.depthMask(depth_prepass_ ? GL_FALSE : GL_TRUE);
+	state_cache_.useProgram(shader_program_.getId());
+	drawScene(false);
+	shading_pass_timer_.end();
 
-	const auto& light_sources = scene_->getAllLights();
+	stream_.endFrame();
+}
 
-	for (int l = 0; l < light_sources.size(); l++)
+void MyView::updateLightClusters(const sponza::SceneSnapshot& frame, const glm::mat4& view_xform, float aspect_ratio)
+{
+	const auto& light_sources = frame.getAllLights();
+	lights_gl_.resize(light_sources.size());
+	light_spheres_.resize(light_sources.size());
+	for (size_t l = 0; l < light_sources.size(); l++)
 	{
-		glm::vec3 position = (glm::vec3&)light_sources[l].getPosition();
-		float range = light_sources[l].getRange();
-		glm::vec3 colour = (glm::vec3&)light_sources[l].getIntensity();
+		LightGL& light = lights_gl_[l];
+		copyVec3(light_sources[l].getPosition(), light.position);
+		light.range = light_sources[l].getRange();
+		copyVec3(light_sources[l].getIntensity(), light.colour);
+		light.cone_angle = 0.f;
+		light.cone_direction[0] = light.cone_direction[1] = light.cone_direction[2] = 0.f;
+		light.padding = 0.f;
+		light_spheres_[l].centre = light_sources[l].getPosition();
+		light_spheres_[l].radius = light.range;
+	}
 
-		std::string pos_uniform_id = "light_sources[" + std::to_string(l) + "].position";
-		GLuint position_id = glGetUniformLocation(shader_program_, pos_uniform_id.c_str());
-		glUniform3fv(position_id, 1, glm::value_ptr(position));
+	const auto& camera = frame.getCamera();
+	light_clusters_.setView(glm::value_ptr(view_xform),
+		glm::radians(camera.getVerticalFieldOfViewInDegrees()),
+		aspect_ratio,
+		camera.getNearPlaneDistance(),
+		camera.getFarPlaneDistance());
+	if (instance_light_lists_)
+		instance_lights_.setLights(light_sources);
+	else
+		light_clusters_.assign(light_spheres_);
 
-		std::string range_uniform_id = "light_sources[" + std::to_string(l) + "].range";
-		GLuint range_id = glGetUniformLocation(shader_program_, range_uniform_id.c_str());
-		glUniform1f(range_id, range);
+	GLint viewport_size[4];
+	glGetIntegerv(GL_VIEWPORT, viewport_size);
+	ClusterBlockGL cluster_block;
+	cluster_block.tile_scale[0] = LightClusters::kTilesX / (float)viewport_size[2];
+	cluster_block.tile_scale[1] = LightClusters::kTilesY / (float)viewport_size[3];
+	cluster_block.slice_scale = light_clusters_.getDepthSliceScale();
+	cluster_block.slice_bias = light_clusters_.getDepthSliceBias();
+	cluster_block.near_plane_distance = camera.getNearPlaneDistance();
+	cluster_block.far_plane_distance = camera.getFarPlaneDistance();
+	cluster_block.grid[0] = LightClusters::kTilesX;
+	cluster_block.grid[1] = LightClusters::kTilesY;
+	cluster_block.slices = LightClusters::kSlices;
+	cluster_block.instance_light_lists = instance_light_lists_ ? 1 : 0;
+	cluster_block.padding[0] = cluster_block.padding[1] = 0.f;
+	const GLintptr cluster_offset = stream_.write(&cluster_block, sizeof(cluster_block), stream_.getUniformAlignment());
+	state_cache_.bindBufferRange(GL_UNIFORM_BUFFER, kClusterBlockBinding, stream_.getBuffer(), cluster_offset, sizeof(cluster_block));
+
+	light_buffer_.update(stream_, lights_gl_.data(), lights_gl_.size() * sizeof(LightGL));
+	if (!instance_light_lists_)
+	{
+		const auto& table = light_clusters_.getClusterTable();
+		const auto& indices = light_clusters_.getLightIndices();
+		cluster_table_buffer_.update(stream_, table.data(), table.size() * sizeof(unsigned int));
+		cluster_index_buffer_.update(stream_, indices.data(), indices.size() * sizeof(unsigned int));
+	}
+}
 
-		std::string colour_uniform_id = "light_sources[" + std::to_string(l) + "].colour";
-		GLuint colour_id = glGetUniformLocation(shader_program_, colour_uniform_id.c_str());
-		glUniform3fv(colour_id, 1, glm::value_ptr(colour));
+void MyView::assignInstanceLights()
+{
+	//Boxes were gathered in instance order, so the table lines up with
+	//instances_gl_
+	instance_lights_.assign(instance_light_boxes_);
+	const auto& table = instance_lights_.getInstanceTable();
+	for (size_t i = 0; i < instances_gl_.size(); ++i)
+	{
+		instances_gl_[i].light_list[0] = table[2 * i];
+		instances_gl_[i].light_list[1] = table[2 * i + 1];
 	}
+	const auto& indices = instance_lights_.getLightIndices();
+	instance_light_buffer_.update(stream_, indices.data(), indices.size() * sizeof(unsigned int));
+}
 
-	//Render each mesh by looping through mesh container
-	for (const auto& mesh : m_meshVector)
+void MyView::drawScene(bool depth_only)
+{
+	if (render_mode_ == kMultiDrawIndirect)
+		drawIndirect(depth_only ? scene_depth_vao_ : scene_vao_);
+	else
+		drawInstanced(depth_only);
+}
+
+void MyView::drawInstanced(bool depth_only)
+{
+	//Render each group with one instanced draw, the base instance offsets
+	//the instance attributes to the group's first instance
+	for (const auto& group : draw_groups_)
 	{
-		glBindVertexArray(mesh.vao);
+		const auto& mesh = m_meshVector[group.mesh];
+		state_cache_.bindVertexArray(depth_only ? mesh.depth_vao : mesh.vao);
+		glDrawElementsInstancedBaseInstance(GL_TRIANGLES, mesh.numElements, GL_UNSIGNED_INT, 0,
+			group.instance_count, instance_base_ + group.first_instance);
+	}
+}
 
-		//Render each instance of mesh with its own model matrix
-		const auto& instances = scene_->getInstancesByMeshId(mesh.id);
+void MyView::updateIndirectCommands()
+{
+	//The buffer is not kept and patched when the visible set changes, as
+	//it once was. The instances move to a new stream region every frame,
+	//so every base_instance changes even when the groups do not, and a
+	//whole rewrite is only a store into mapped memory.
+	//One command per group, drawing from the shared geometry buffers
+	commands_.resize(draw_groups_.size());
+	for (size_t i = 0; i < draw_groups_.size(); ++i)
+	{
+		const auto& group = draw_groups_[i];
+		const auto& mesh = m_meshVector[group.mesh];
+		DrawElementsIndirectCommand& command = commands_[i];
+		command.count = (GLuint)mesh.numElements;
+		command.instance_count = (GLuint)group.instance_count;
+		command.first_index = mesh.first_index;
+		command.base_vertex = mesh.base_vertex;
+		command.base_instance = instance_base_ + (GLuint)group.first_instance;
+	}
+	indirect_offset_ = stream_.write(commands_.data(), commands_.size() * sizeof(DrawElementsIndirectCommand), sizeof(GLuint));
+	indirect_buffer_ = stream_.getBuffer();
+}
 
-		for (auto i : instances)
+void MyView::drawIndirect(GLuint vao)
+{
+	//Every material's textures are in the one array, so the whole pass is
+	//a single submission
+	state_cache_.bindVertexArray(vao);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirect_buffer_);
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, TGL_BUFFER_OFFSET(indirect_offset_), (GLsizei)commands_.size(), 0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, kNullId);
+}
+
+void MyView::buildDrawGroups(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view)
+{
+	instances_gl_.clear();
+	draw_groups_.clear();
+	batch_scratch_.clear();
+	instance_light_boxes_.clear();
+
+	const auto& camera = frame.getCamera();
+	const auto camera_position = camera.getPosition();
+	const auto camera_direction = camera.getDirection();
+
+	//Gather every instance with its world bounds, then keep the ones the
+	//camera can see. Culling is timed from the first box to the visible list.
+	//Gathering walks the scene's mesh index so stays on this thread, the
+	//culling itself is split across the job system
+	const auto cull_start = std::chrono::steady_clock::now();
+	frustum_culler_.clear();
+	frustum_culler_.setFrustum(glm::value_ptr(projection_view));
+	for (size_t m = 0; m < m_meshVector.size(); ++m)
+	{
+		for (auto id : frame.getInstancesByMeshId(m_meshVector[m].id))
 		{
-			//For each instance, call getTransformationMatrix and pass to the shader as a uniform
-			glm::mat4 world_matrix = (glm::mat4x3&)scene_->getInstanceById(i).getTransformationMatrix();
-			GLuint world_matrix_id = glGetUniformLocation(shader_program_, "world_matrix");
-			glUniformMatrix4fv(world_matrix_id, 1, GL_FALSE, glm::value_ptr(world_matrix));
-
-			//Get material for this instance
-			const auto& material_id = scene_->getInstanceById(i).getMaterialId();
-			const auto& material = scene_->getMaterialById(material_id);
-			
-			//Get the material colours and pass to the shader
-			const glm::vec3& ambient_colour = (glm::vec3&)material.getAmbientColour();
-			GLuint ambient_colour_id = glGetUniformLocation(shader_program_, "mat.ambient_colour");
-			glUniform3fv(ambient_colour_id, 1, glm::value_ptr(ambient_colour));
-
-			const glm::vec3& diffuse_colour = (glm::vec3&)material.getDiffuseColour();
-			GLuint diffuse_colour_id = glGetUniformLocation(shader_program_, "mat.diffuse_colour");
-			glUniform3fv(diffuse_colour_id, 1, glm::value_ptr(diffuse_colour));
-
-			const glm::vec3& specular_colour = (glm::vec3&)material.getSpecularColour();
-			GLuint specular_colour_id = glGetUniformLocation(shader_program_, "mat.specular_colour");
-			glUniform3fv(specular_colour_id, 1, glm::value_ptr(specular_colour));
-
-			const float& shininess = material.getShininess();
-			GLuint shininess_id = glGetUniformLocation(shader_program_, "mat.shininess");
-			glUniform1f(shininess_id, shininess);
-
-			const bool& is_shiny = material.isShiny();
-			GLuint is_shiny_id = glGetUniformLocation(shader_program_, "mat.is_shiny");
-			glUniform1i(is_shiny_id, is_shiny);
-
-			//Get material textures and pass to shader
-			GLuint diff_texture_id = glGetUniformLocation(shader_program_, "mat.diff_texture");
-			GLuint has_diffuse_texture_id = glGetUniformLocation(shader_program_, "mat.has_diffuse_texture");
-
-			if (material.getDiffuseTexture() == "diff0.png")
-			{
-				glActiveTexture(GL_TEXTURE0 + kDiffTex);
-				glBindTexture(GL_TEXTURE_2D, diff0_texture);
-				glUniform1i(diff_texture_id, kDiffTex);
-				glUniform1i(has_diffuse_texture_id, true);
-			}
-			else if (material.getDiffuseTexture() == "diff1.png")
-			{
-				glActiveTexture(GL_TEXTURE0 + kDiffTex);
-				glBindTexture(GL_TEXTURE_2D, diff1_texture);
-				glUniform1i(diff_texture_id, kDiffTex);
-				glUniform1i(has_diffuse_texture_id, true);
-			}
-			else
-				glUniform1i(has_diffuse_texture_id, false);
+			//The snapshot's own index, so every id is in this frame
+			const auto * instance = &frame.getInstanceById(id);
 
-			GLuint spec_texture_id = glGetUniformLocation(shader_program_, "mat.spec_texture");
-			GLuint has_specular_texture_id = glGetUniformLocation(shader_program_, "mat.has_specular_texture");
+			frustum_culler_.add(m_meshVector[m].bounds, instance->getTransformationMatrix());
+			const int material_index = material_table_.getMaterialIndex(instance->getMaterialId());
+			batch_scratch_.push_back({ m, material_index, instance });
+		}
+	}
+	if (frustum_culling_)
+	{
+		frustum_culler_.cull(visible_instances_);
+	}
+	else
+	{
+		visible_instances_.resize(batch_scratch_.size());
+		for (size_t i = 0; i < visible_instances_.size(); ++i)
+			visible_instances_[i] = (unsigned int)i;
+	}
+	culling_tested_ = batch_scratch_.size();
+	culling_visible_ = visible_instances_.size();
+	culling_microseconds_ = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - cull_start).count();
+
+	if (occlusion_culling_)
+		cullOccludedInstances(frame, projection_view);
+
+	//Keys and matrices are recorded in parallel, each job sorting its own
+	//list, and the sorted lists are merged here into the draw order
+	const float near_plane = camera.getNearPlaneDistance();
+	const float far_plane = camera.getFarPlaneDistance();
+	command_recorder_.record(visible_instances_.size(), [&](size_t begin, size_t end, CommandList& list)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			//Depth is the instance origin's distance along the view direction
+			const auto& entry = batch_scratch_[visible_instances_[i]];
+			const sponza::Matrix4x3 xform = entry.instance->getTransformationMatrix();
+			const float depth = (xform.m30 - camera_position.x) * camera_direction.x
+				+ (xform.m31 - camera_position.y) * camera_direction.y
+				+ (xform.m32 - camera_position.z) * camera_direction.z;
+
+			DrawPacket packet;
+			packet.key = DrawList::makeKey(DrawList::kOpaquePass,
+				kSponzaProgram,
+				DrawList::kNoTextureSet,
+				entry.material_index,
+				(int)entry.mesh,
+				DrawList::quantizeDepth(depth, near_plane, far_plane));
+			packet.mesh = (unsigned int)entry.mesh;
+			packet.material_index = entry.material_index;
+			std::memcpy(packet.world_matrix, &xform, sizeof(packet.world_matrix));
+			list.record(packet);
+		}
+	});
+	command_recorder_.merge(draw_packets_);
 
-			if (material.getSpecularTexture() == "spec1.png")
-			{
-				glActiveTexture(GL_TEXTURE0 + kSpecTex);
-				glBindTexture(GL_TEXTURE_2D, spec1_texture);
-				glUniform1i(spec_texture_id, kSpecTex);
-				glUniform1i(has_specular_texture_id, true);
-			}
-			else if (material.getSpecularTexture() == "spec2.png")
+	//Materials come before meshes in the key, so consecutive groups usually
+	//share a material whichever way they are submitted. Only finding where
+	//the groups start is serial, instance i is always packet i
+	for (size_t i = 0; i < draw_packets_.size(); ++i)
+	{
+		const DrawPacket * packet = draw_packets_[i];
+		if (draw_groups_.empty()
+			|| draw_groups_.back().mesh != packet->mesh
+			|| draw_groups_.back().material_index != packet->material_index)
+		{
+			DrawGroup group;
+			group.mesh = packet->mesh;
+			group.material_index = packet->material_index;
+			group.first_instance = (GLsizei)i;
+			group.instance_count = 0;
+			draw_groups_.push_back(group);
+		}
+		draw_groups_.back().instance_count++;
+	}
+
+	instances_gl_.resize(draw_packets_.size());
+	instance_light_boxes_.resize(instance_light_lists_ ? draw_packets_.size() : 0);
+	render_jobs_->parallelFor(draw_packets_.size(), 1024, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const DrawPacket * packet = draw_packets_[i];
+			InstanceGL& instance_gl = instances_gl_[i];
+			std::memcpy(instance_gl.world_matrix, packet->world_matrix, sizeof(instance_gl.world_matrix));
+			instance_gl.material_index = packet->material_index;
+			instance_gl.light_list[0] = instance_gl.light_list[1] = 0;
+			if (instance_light_lists_)
 			{
-				glActiveTexture(GL_TEXTURE0 + kSpecTex);
-				glBindTexture(GL_TEXTURE_2D, spec2_texture);
-				glUniform1i(spec_texture_id, kSpecTex);
-				glUniform1i(has_specular_texture_id, true);
+				InstanceLights::Box& box = instance_light_boxes_[i];
+				box.bounds = m_meshVector[packet->mesh].bounds;
+				std::memcpy(&box.world, packet->world_matrix, sizeof(packet->world_matrix));
 			}
-			else
-				glUniform1i(has_specular_texture_id, false);
-
-			//Render the mesh
-			glDrawElements(GL_TRIANGLES, mesh.numElements, GL_UNSIGNED_INT, 0);
 		}
+	});
+}
+
+void MyView::cullOccludedInstances(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view)
+{
+	const auto& camera = frame.getCamera();
+	const auto camera_position = camera.getPosition();
+	const auto camera_direction = camera.getDirection();
+
+	//The nearest occluders hide the most, so they get the triangle budget
+	occlusion_culler_.beginFrame(glm::value_ptr(projection_view));
+	occluder_candidates_.clear();
+	for (const auto index : visible_instances_)
+	{
+		const auto& entry = batch_scratch_[index];
+		if (m_meshVector[entry.mesh].occluder_mesh < 0)
+			continue;
+		const auto xform = entry.instance->getTransformationMatrix();
+		const float depth = (xform.m30 - camera_position.x) * camera_direction.x
+			+ (xform.m31 - camera_position.y) * camera_direction.y
+			+ (xform.m32 - camera_position.z) * camera_direction.z;
+		occluder_candidates_.push_back(std::make_pair(depth, index));
+	}
+	std::sort(occluder_candidates_.begin(), occluder_candidates_.end());
+
+	int triangles = 0;
+	for (const auto& candidate : occluder_candidates_)
+	{
+		const auto& entry = batch_scratch_[candidate.second];
+		const int occluder_mesh = m_meshVector[entry.mesh].occluder_mesh;
+		const int mesh_triangles = occlusion_culler_.getOccluderMeshTriangleCount(occluder_mesh);
+		if (triangles + mesh_triangles > kOccluderTriangleBudget)
+			break;
+		occlusion_culler_.addOccluder(occluder_mesh, entry.instance->getTransformationMatrix());
+		triangles += mesh_triangles;
+	}
+	occlusion_culler_.renderOccluders();
+
+	//Only the boxes of instances that survived frustum culling are filled
+	occlusion_boxes_.resize(batch_scratch_.size());
+	for (const auto index : visible_instances_)
+	{
+		const auto& entry = batch_scratch_[index];
+		occlusion_boxes_[index].bounds = m_meshVector[entry.mesh].bounds;
+		occlusion_boxes_[index].world = entry.instance->getTransformationMatrix();
+	}
+	occlusion_culler_.cull(occlusion_boxes_, visible_instances_);
+}
+
+void MyView::uploadInstanceData()
+{
+	//Aligned to a whole instance, the offset is then a count of instances
+	//the draws skip with their base instance
+	const GLsizeiptr size = instances_gl_.size() * sizeof(InstanceGL);
+	const GLintptr offset = stream_.write(instances_gl_.data(), size, sizeof(InstanceGL));
+	instance_base_ = (GLuint)(offset / sizeof(InstanceGL));
+	if (stream_.getBuffer() != instance_attribute_buffer_)
+		pointInstanceAttributes();
+}
+
+void MyView::setInstanceAttributePointers()
+{
+	//Per-instance attributes advance once per instance, draws pick their
+	//first instance with a base instance rather than by moving the pointers
+	glBindBuffer(GL_ARRAY_BUFFER, stream_.getBuffer());
+	instance_attribute_buffer_ = stream_.getBuffer();
+
+	//The world matrix is a mat4x3, one vec3 column per attribute location
+	for (GLuint column = 0; column < 4; ++column)
+	{
+		glEnableVertexAttribArray(kInstanceWorldMatrix + column);
+		glVertexAttribPointer(kInstanceWorldMatrix + column, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceGL),
+			TGL_BUFFER_OFFSET(column * 3 * sizeof(float)));
+		glVertexAttribDivisor(kInstanceWorldMatrix + column, 1);
+	}
+	glEnableVertexAttribArray(kInstanceMaterialIndex);
+	glVertexAttribIPointer(kInstanceMaterialIndex, 1, GL_INT, sizeof(InstanceGL),
+		TGL_BUFFER_OFFSET(offsetof(InstanceGL, material_index)));
+	glVertexAttribDivisor(kInstanceMaterialIndex, 1);
+	glEnableVertexAttribArray(kInstanceLightList);
+	glVertexAttribIPointer(kInstanceLightList, 2, GL_UNSIGNED_INT, sizeof(InstanceGL),
+		TGL_BUFFER_OFFSET(offsetof(InstanceGL, light_list)));
+	glVertexAttribDivisor(kInstanceLightList, 1);
+}
+
+void MyView::pointInstanceAttributes()
+{
+	for (const auto& mesh : m_meshVector)
+	{
+		state_cache_.bindVertexArray(mesh.vao);
+		setInstanceAttributePointers();
+		state_cache_.bindVertexArray(mesh.depth_vao);
+		setInstanceAttributePointers();
+	}
+	state_cache_.bindVertexArray(scene_vao_);
+	setInstanceAttributePointers();
+	state_cache_.bindVertexArray(scene_depth_vao_);
+	setInstanceAttributePointers();
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+}
+
+void MyView::createSceneGeometry(const std::vector<sponza::Mesh>& meshes)
+{
+	std::vector<sponza::Vector3> positions;
+	std::vector<sponza::Vector3> normals;
+	std::vector<sponza::Vector2> texture_coordinates;
+	std::vector<unsigned int> elements;
+
+	//Each mesh's elements stay relative to its own vertices, the command's
+	//base vertex offsets them
+	for (size_t m = 0; m < meshes.size(); ++m)
+	{
+		const auto& source = meshes[m];
+		m_meshVector[m].first_index = (GLuint)elements.size();
+		m_meshVector[m].base_vertex = (GLint)positions.size();
+
+		const auto& mesh_positions = source.getPositionArray();
+		const auto& mesh_normals = source.getNormalArray();
+		const auto& mesh_texture_coordinates = source.getTextureCoordinateArray();
+		const auto mesh_elements = source.getElementArray();
+		positions.insert(positions.end(), mesh_positions.begin(), mesh_positions.end());
+		normals.insert(normals.end(), mesh_normals.begin(), mesh_normals.end());
+		texture_coordinates.insert(texture_coordinates.end(), mesh_texture_coordinates.begin(), mesh_texture_coordinates.end());
+
+		//Meshes missing an array are padded so every array stays in step
+		normals.resize(positions.size());
+		texture_coordinates.resize(positions.size());
+		elements.insert(elements.end(), mesh_elements.begin(), mesh_elements.end());
+	}
+
+	glGenBuffers(1, &scene_geometry_.positionVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.positionVBO);
+	glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(glm::vec3), positions.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &scene_geometry_.normalVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.normalVBO);
+	glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3), normals.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &scene_geometry_.textureCoordinatesVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.textureCoordinatesVBO);
+	glBufferData(GL_ARRAY_BUFFER, texture_coordinates.size() * sizeof(glm::vec2), texture_coordinates.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &scene_geometry_.elementVBO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene_geometry_.elementVBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(unsigned int), elements.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, kNullId);
+	scene_geometry_.numElements = (int)elements.size();
+
+	glGenVertexArrays(1, &scene_vao_);
+	glBindVertexArray(scene_vao_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, scene_geometry_.elementVBO);
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.positionVBO);
+	glEnableVertexAttribArray(kVertexPosition);
+	glVertexAttribPointer(kVertexPosition, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.normalVBO);
+	glEnableVertexAttribArray(kVertexNormal);
+	glVertexAttribPointer(kVertexNormal, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	glBindBuffer(GL_ARRAY_BUFFER, scene_geometry_.textureCoordinatesVBO);
+	glEnableVertexAttribArray(kTextureCoordinates);
+	glVertexAttribPointer(kTextureCoordinates, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), TGL_BUFFER_OFFSET(0));
+	setInstanceAttributePointers();
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+	glBindVertexArray(kNullId);
+	scene_depth_vao_ = createDepthVertexArray(scene_geometry_.positionVBO, scene_geometry_.elementVBO);
+}
+
+GLuint MyView::createDepthVertexArray(GLuint position_vbo, GLuint element_vbo)
+{
+	//Normals and texture coordinates are left out, so the pre-pass fetches
+	//only the position stream
+	GLuint vao = 0;
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, position_vbo);
+	glEnableVertexAttribArray(kVertexPosition);
+	glVertexAttribPointer(kVertexPosition, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), TGL_BUFFER_OFFSET(0));
+	setInstanceAttributePointers();
+	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+	glBindVertexArray(kNullId);
+	return vao;
+}
+
+void MyView::printDrawStatistics(std::ostream& out) const
+{
+	const auto& recording = command_recorder_.getStatistics();
+	out << "Draw groups " << draw_groups_.size()
+		<< ", state changes per frame in scene order " << recording.recorded_state_changes.total()
+		<< " (materials " << recording.recorded_state_changes.materials
+		<< ", meshes " << recording.recorded_state_changes.meshes
+		<< "), sorted " << recording.sorted_state_changes.total()
+		<< " (materials " << recording.sorted_state_changes.materials
+		<< ", meshes " << recording.sorted_state_changes.meshes << ")" << std::endl;
+	out << "Command recording " << recording.packets << " packets in " << recording.lists
+		<< " lists in " << recording.record_microseconds << " us, merged in "
+		<< recording.merge_microseconds << " us" << std::endl;
+	out << "GL state calls issued " << state_cache_.getCounters().issued
+		<< ", elided " << state_cache_.getCounters().elided << std::endl;
+	const size_t culled = culling_tested_ - culling_visible_;
+	out << "Frustum culling " << (frustum_culling_ ? "on" : "off")
+		<< " (" << FrustumCuller::getInstructionSetName(frustum_culler_.getInstructionSet()) << ")"
+		<< ", culled " << culled << " of " << culling_tested_ << " instances ("
+		<< (culling_tested_ > 0 ? 100.0 * culled / culling_tested_ : 0.0) << "%) in "
+		<< culling_microseconds_ << " us" << std::endl;
+	const auto& occlusion = occlusion_culler_.getStatistics();
+	out << "Occlusion culling " << (occlusion_culling_ ? "on" : "off")
+		<< ", " << occlusion.rasterised_triangles << " of " << occlusion.occluder_triangles
+		<< " occluder triangles drawn in " << occlusion.render_microseconds
+		<< " us, occluded " << occlusion.occluded << " of " << occlusion.tested
+		<< " instances in " << occlusion.test_microseconds << " us" << std::endl;
+	if (instance_light_lists_)
+	{
+		const auto& lists = instance_lights_.getStatistics();
+		out << "Instance light lists, " << lists.light_indices << " entries over " << lists.instances
+			<< " instances (" << (lists.instances > 0 ? (double)lists.light_indices / lists.instances : 0.0)
+			<< " each), at most " << lists.max_instance_lights << " lights on one instance, "
+			<< lists.truncated_instances << " cut to " << InstanceLights::kMaxLightsPerInstance
+			<< ", assigned in " << lists.assign_microseconds << " us" << std::endl;
 	}
+	else
+	{
+		const auto& clusters = light_clusters_.getStatistics();
+		out << "Light clusters " << LightClusters::kTilesX << "x" << LightClusters::kTilesY << "x" << LightClusters::kSlices
+			<< ", " << clusters.visible_lights << " of " << clusters.lights << " lights within view depth, "
+			<< clusters.light_indices << " cluster entries, at most " << clusters.max_cluster_lights
+			<< " lights per cluster, assigned in " << clusters.assign_microseconds << " us" << std::endl;
+	}
+	const auto& stream = stream_.getStatistics();
+	out << "Stream buffer " << stream.bytes_used << " of " << stream_.getRegionSize()
+		<< " bytes used in " << stream.allocations << " allocations, waited "
+		<< stream.wait_microseconds << " us for the GPU, regrown " << stream.regrowths << " times" << std::endl;
+	const double depth_ms = depth_pass_timer_.getAverageMilliseconds();
+	const double shading_ms = shading_pass_timer_.getAverageMilliseconds();
+	out << "Depth pre-pass " << (depth_prepass_ ? "on" : "off")
+		<< ", GPU ms per frame depth " << depth_ms << " + shading " << shading_ms
+		<< " = " << depth_ms + shading_ms << ", averaged over "
+		<< shading_pass_timer_.getSampleCount() << " frames, "
+		<< shading_pass_timer_.getDroppedCount() << " dropped" << std::endl;
+}
+
+bool MyView::toggleMultiDrawIndirect()
+{
+	render_mode_ = render_mode_ == kMultiDrawIndirect ? kInstanced : kMultiDrawIndirect;
+	return render_mode_ == kMultiDrawIndirect;
+}
+
+bool MyView::toggleFrustumCulling()
+{
+	frustum_culling_ = !frustum_culling_;
+	return frustum_culling_;
+}
+
+bool MyView::toggleOcclusionCulling()
+{
+	occlusion_culling_ = !occlusion_culling_;
+	return occlusion_culling_;
+}
+
+bool MyView::toggleInstanceLightLists()
+{
+	instance_light_lists_ = !instance_light_lists_;
+	return instance_light_lists_;
+}
+
+bool MyView::toggleDepthPrepass()
+{
+	//Averages restart so they only ever cover one mode
+	depth_prepass_ = !depth_prepass_;
+	depth_pass_timer_.reset();
+	shading_pass_timer_.reset();
+	return depth_prepass_;
 }
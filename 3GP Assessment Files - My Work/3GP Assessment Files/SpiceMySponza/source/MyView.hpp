@@ -1,12 +1,26 @@
 #pragma once
 
+#include "CommandList.hpp"
+#include "DrawList.hpp"
+#include "FrustumCuller.hpp"
+#include "GLStateCache.hpp"
+#include "GpuTimer.hpp"
+#include "InstanceLights.hpp"
+#include "LightClusters.hpp"
+#include "MaterialTable.hpp"
+#include "OcclusionCuller.hpp"
+#include "ShaderBlocks.hpp"
+#include "ShaderProgram.hpp"
+#include "StreamBuffer.hpp"
+#include "TextureBuffer.hpp"
+
 #include <sponza/sponza_fwd.hpp>
 #include <tygra/WindowViewDelegate.hpp>
 #include <tgl/tgl.h>
 #include <glm/glm.hpp>
-#include <chrono>
 #include <vector>
 #include <memory>
+#include <ostream>
 
 class MyView : public tygra::WindowViewDelegate
 {
@@ -18,6 +32,33 @@ public:
     
     void setScene(const sponza::Context * scene);
 
+    //Switches between one instanced draw per group and submitting the
+    //groups through glMultiDrawElementsIndirect, returns true for indirect
+    bool toggleMultiDrawIndirect();
+
+    //Turns culling instances outside the view on and off, returns true
+    //when culling
+    bool toggleFrustumCulling();
+
+    //Turns culling instances hidden behind nearer geometry on and off,
+    //returns true when culling
+    bool toggleOcclusionCulling();
+
+    //Turns the depth-only pre-pass on and off, returns true when on. With
+    //it the shading pass only runs for the fragments that end up visible
+    bool toggleDepthPrepass();
+
+    //Switches fragments between the lights listed for their froxel and the
+    //lights listed for their instance, returns true for per instance
+    bool toggleInstanceLightLists();
+
+    //Prints the last frame's draw group count and state changes, counted
+    //in scene order and in the sorted order actually drawn, the GL state
+    //calls the state cache issued and elided, the instances culled, the
+    //light lists built, the stream buffer's use and the GPU time of each
+    //render pass
+    void printDrawStatistics(std::ostream& out) const;
+
 private:
 
     void windowViewWillStart(tygra::Window * window) override;
@@ -30,17 +71,176 @@ private:
     
     void windowViewRender(tygra::Window * window) override;
 
+	void buildDrawGroups(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view);
+
+	void cullOccludedInstances(const sponza::SceneSnapshot& frame, const glm::mat4& projection_view);
+
+	void uploadInstanceData();
+
+	void setInstanceAttributePointers();
+
+	void createSceneGeometry(const std::vector<sponza::Mesh>& meshes);
+
+	GLuint createDepthVertexArray(GLuint position_vbo, GLuint element_vbo);
+
+	//Submits this frame's draw groups, the depth pass uses the position only
+	//vertex arrays
+	void drawScene(bool depth_only);
+
+	void drawInstanced(bool depth_only);
+
+	void drawIndirect(GLuint vao);
+
+	void updateIndirectCommands();
+
+	//Points every vertex array's instance attributes at the stream buffer,
+	//needed again whenever the stream outgrows its buffer
+	void pointInstanceAttributes();
+
 private:
 
     const sponza::Context * scene_;
 
-	std::chrono::system_clock::time_point start_time_;
+	//Every job the render thread runs goes to the view's own pool. The scene
+	//updates on the shared pool, which runs one batch at a time, so sharing
+	//it would hold the frame up behind the simulation
+	std::unique_ptr<sponza::JobSystem> render_jobs_;
+
+	ShaderProgram shader_program_;
+
+	//The pre-pass writes depth alone, then shading tests for equal depth
+	//without writing it. Each pass is timed on the GPU, averaged since the
+	//last toggle, so the two modes can be compared
+	ShaderProgram depth_program_;
+	bool depth_prepass_{ false };
+	GpuTimer depth_pass_timer_;
+	GpuTimer shading_pass_timer_;
+
+	//Every block, light list, instance and command written per frame goes
+	//into one persistently mapped buffer, a region per frame in flight
+	static const GLsizeiptr kStreamRegionSize = 2 * 1024 * 1024;
+	StreamBuffer stream_;
+
+	//Must match ClusterBlock in sponza_fs.glsl
+	struct ClusterBlockGL
+	{
+		float tile_scale[2];
+		float slice_scale;
+		float slice_bias;
+		float near_plane_distance;
+		float far_plane_distance;
+		int grid[2];
+		int slices;
+		int instance_light_lists;
+		float padding[2];
+	};
+
+	//Every light goes into a buffer texture, as many as the scene has, and
+	//the froxels' light lists into two more. Lights are assigned to froxels
+	//on the job system each frame
+	void updateLightClusters(const sponza::SceneSnapshot& frame, const glm::mat4& view_xform, float aspect_ratio);
+
+	std::vector<LightGL> lights_gl_;
+	std::vector<LightClusters::Sphere> light_spheres_;
+	LightClusters light_clusters_;
+	TextureBuffer light_buffer_;
+	TextureBuffer cluster_table_buffer_;
+	TextureBuffer cluster_index_buffer_;
+
+	//The alternative to clusters, each drawn instance's world box is tested
+	//against a light grid and the lights reaching it are listed in its
+	//instance attributes. Froxels are not assigned while this is on
+	void assignInstanceLights();
+
+	InstanceLights instance_lights_;
+	std::vector<InstanceLights::Box> instance_light_boxes_;
+	TextureBuffer instance_light_buffer_;
+	bool instance_light_lists_{ false };
 
-	GLuint diff0_texture{ 0 };
-	GLuint diff1_texture{ 0 };
-	GLuint spec1_texture{ 0 };
-	GLuint spec2_texture{ 0 };
-	GLuint shader_program_{ 0 };
+	//A run of instances sharing a mesh and material, drawn with one call
+	struct DrawGroup
+	{
+		size_t mesh;
+		int material_index;
+		GLsizei first_instance;
+		GLsizei instance_count;
+	};
+
+	struct BatchEntry
+	{
+		size_t mesh;
+		int material_index;
+		const sponza::Instance * instance;
+	};
+
+	//Instances are written to the stream aligned to their own size, so the
+	//attributes read from its start and draws add instance_base_ to their
+	//base instance. instance_attribute_buffer_ is the buffer they point at
+	GLuint instance_attribute_buffer_{ 0 };
+	GLuint instance_base_{ 0 };
+	std::vector<InstanceGL> instances_gl_;
+	std::vector<DrawGroup> draw_groups_;
+	std::vector<BatchEntry> batch_scratch_;
+
+	//Program permutations for the sort key, there is one so far
+	enum ProgramPermutations
+	{
+		kSponzaProgram = 0
+	};
+
+	//Visible instances become draw packets recorded on the job system, the
+	//merged packets are in draw order and point into the recorder's lists
+	CommandRecorder command_recorder_;
+	std::vector<const DrawPacket *> draw_packets_;
+
+	//Instance world bounds are tested against the view before any draw is
+	//built, batch_scratch_ and the culler's boxes share indices
+	FrustumCuller frustum_culler_;
+	std::vector<unsigned int> visible_instances_;
+	bool frustum_culling_{ true };
+	size_t culling_tested_{ 0 };
+	size_t culling_visible_{ 0 };
+	double culling_microseconds_{ 0.0 };
+
+	//Low polygon meshes are drawn into a small CPU depth buffer each frame,
+	//nearest first up to a triangle budget, and the instances left after
+	//frustum culling are tested against it
+	static const int kOcclusionBufferWidth = 256;
+	static const int kOcclusionBufferHeight = 128;
+	static const int kMaxOccluderMeshTriangles = 1024;
+	static const int kOccluderTriangleBudget = 16384;
+	OcclusionCuller occlusion_culler_;
+	std::vector<OcclusionCuller::Box> occlusion_boxes_;
+	std::vector<std::pair<float, unsigned int>> occluder_candidates_;
+	bool occlusion_culling_{ true };
+
+	enum RenderMode
+	{
+		kInstanced,
+		kMultiDrawIndirect
+	};
+	RenderMode render_mode_{ kInstanced };
+
+	//Laid out as GL reads it from the indirect buffer
+	struct DrawElementsIndirectCommand
+	{
+		GLuint count;
+		GLuint instance_count;
+		GLuint first_index;
+		GLint base_vertex;
+		GLuint base_instance;
+	};
+
+	//Commands are written to the stream whole each frame, a plain store
+	//into mapped memory
+	std::vector<DrawElementsIndirectCommand> commands_;
+	GLuint indirect_buffer_{ 0 };
+	GLintptr indirect_offset_{ 0 };
+
+	GLStateCache state_cache_;
+
+	MaterialTable material_table_;
+	unsigned int material_revision_{ 0 };
 
 	//Defines values for Vertex attributes
 	const static GLuint kNullId = 0;
@@ -49,7 +249,10 @@ private:
 	{
 		kVertexPosition = 0,
 		kVertexNormal = 1,
-		kTextureCoordinates = 2 
+		kTextureCoordinates = 2,
+		kInstanceWorldMatrix = 3, //Takes locations 3 to 6
+		kInstanceMaterialIndex = 7,
+		kInstanceLightList = 8
 	};
 	enum FragmentDataIndexes
 	{
@@ -57,14 +260,29 @@ private:
 	};
 	enum TextureIndexes
 	{
-		kDiffTex = 0,
-		kSpecTex = 1
+		kMaterialTex = 0,
+		kLightDataTex = 1,
+		kClusterTableTex = 2,
+		kClusterIndexTex = 3,
+		kInstanceLightTex = 4
+	};
+	enum UniformBlockBindings
+	{
+		kMaterialBlockBinding = 0,
+		kFrameBlockBinding = 1,
+		kClusterBlockBinding = 2
 	};
 
 	//Create a mesh structure to hold VBO ids etc.
 	struct MeshGL
 	{
-		int id{ 0 };
+		sponza::MeshId id{ 0 };
+
+		//Mesh space bounds, placed in the world per instance for culling
+		sponza::Aabb bounds;
+
+		//The mesh's index in the occlusion culler, -1 if it is not an occluder
+		int occluder_mesh{ -1 };
 
 		//VertexBufferObjects for vertex positions and indices
 		GLuint positionVBO{ 0 };
@@ -75,9 +293,21 @@ private:
 		//VertexArrayObject for shape's vertex array settings
 		GLuint vao{ 0 };
 
+		//Positions and instance attributes only, for the depth pre-pass
+		GLuint depth_vao{ 0 };
+
 		int numElements{ 0 };
+
+		//Where the mesh starts in the shared scene geometry
+		GLuint first_index{ 0 };
+		GLint base_vertex{ 0 };
 	};
 
 	//Create a container of these mesh
 	std::vector<MeshGL> m_meshVector;
+
+	//Every mesh appended into one set of buffers, for indirect draws
+	MeshGL scene_geometry_;
+	GLuint scene_vao_{ 0 };
+	GLuint scene_depth_vao_{ 0 };
 };
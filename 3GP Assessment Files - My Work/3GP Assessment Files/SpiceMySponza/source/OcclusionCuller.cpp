@@ -0,0 +1,494 @@
+#include "OcclusionCuller.hpp"
+#include <sponza/JobSystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <emmintrin.h>
+#include <limits>
+
+namespace
+{
+	//Corners nearer than this, or behind the camera, cannot be projected
+	const float kMinimumDepth = 1e-3f;
+
+	const unsigned int kFullRow = ~0u;
+
+	struct ClipPoint
+	{
+		float x, y, z, w;
+	};
+
+	//Combines a column-major projection * view with a world transform, whose
+	//bottom row is always 0 0 0 1
+	void composeClipMatrix(const float * projection_view, const sponza::Matrix4x3& m, float * out)
+	{
+		const float world[4][3] = {
+			{ m.m00, m.m01, m.m02 },
+			{ m.m10, m.m11, m.m12 },
+			{ m.m20, m.m21, m.m22 },
+			{ m.m30, m.m31, m.m32 } };
+		for (int c = 0; c < 4; ++c)
+		{
+			for (int r = 0; r < 4; ++r)
+			{
+				out[c * 4 + r] = projection_view[r] * world[c][0]
+					+ projection_view[4 + r] * world[c][1]
+					+ projection_view[8 + r] * world[c][2]
+					+ (c == 3 ? projection_view[12 + r] : 0.f);
+			}
+		}
+	}
+
+	ClipPoint transformPoint(const float * m, float x, float y, float z)
+	{
+		ClipPoint p;
+		p.x = m[0] * x + m[4] * y + m[8] * z + m[12];
+		p.y = m[1] * x + m[5] * y + m[9] * z + m[13];
+		p.z = m[2] * x + m[6] * y + m[10] * z + m[14];
+		p.w = m[3] * x + m[7] * y + m[11] * z + m[15];
+		return p;
+	}
+
+	float horizontalMin(__m128 v)
+	{
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	float horizontalMax(__m128 v)
+	{
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+		return _mm_cvtss_f32(v);
+	}
+
+	//The bits of a 32 pixel tile row from x_begin to x_end inclusive, given
+	//relative to the tile's first pixel
+	unsigned int spanMask(int x_begin, int x_end)
+	{
+		if (x_end < 0 || x_begin > 31 || x_begin > x_end)
+			return 0;
+		x_begin = std::max(x_begin, 0);
+		x_end = std::min(x_end, 31);
+		const unsigned int below_end = x_end == 31 ? kFullRow : (1u << (x_end + 1)) - 1;
+		return below_end & (kFullRow << x_begin);
+	}
+}
+
+OcclusionCuller::OcclusionCuller()
+{
+	std::fill(projection_view_, projection_view_ + 16, 0.f);
+}
+
+OcclusionCuller::~OcclusionCuller()
+{
+}
+
+void OcclusionCuller::resize(int width, int height)
+{
+	tiles_x_ = std::max(1, (width + kTileWidth - 1) / kTileWidth);
+	tiles_y_ = std::max(1, (height + kTileHeight - 1) / kTileHeight);
+	width_ = tiles_x_ * kTileWidth;
+	height_ = tiles_y_ * kTileHeight;
+	tiles_.resize(tiles_x_ * tiles_y_);
+	beginFrame(projection_view_);
+}
+
+void OcclusionCuller::setJobSystem(sponza::JobSystem * jobs)
+{
+	jobs_ = jobs;
+}
+
+int OcclusionCuller::addOccluderMesh(const std::vector<sponza::Vector3>& positions,
+	const std::vector<unsigned int>& elements)
+{
+	OccluderMesh mesh;
+	mesh.positions = positions;
+	mesh.elements = elements;
+	mesh.elements.resize(elements.size() / 3 * 3);
+	meshes_.push_back(std::move(mesh));
+	return (int)meshes_.size() - 1;
+}
+
+void OcclusionCuller::clearOccluderMeshes()
+{
+	meshes_.clear();
+	occluders_.clear();
+}
+
+int OcclusionCuller::getOccluderMeshTriangleCount(int mesh) const
+{
+	return (int)meshes_[mesh].elements.size() / 3;
+}
+
+void OcclusionCuller::beginFrame(const float * projection_view)
+{
+	std::copy(projection_view, projection_view + 16, projection_view_);
+
+	Tile empty;
+	std::fill(empty.mask, empty.mask + kTileHeight, 0u);
+	empty.z0 = std::numeric_limits<float>::infinity();
+	empty.z1 = 0.f;
+	std::fill(tiles_.begin(), tiles_.end(), empty);
+
+	occluders_.clear();
+	statistics_ = Statistics();
+}
+
+void OcclusionCuller::addOccluder(int mesh, const sponza::Matrix4x3& world)
+{
+	Occluder occluder;
+	occluder.mesh = mesh;
+	occluder.world = world;
+	occluder.first_triangle = occluders_.empty() ? 0
+		: occluders_.back().first_triangle + getOccluderMeshTriangleCount(occluders_.back().mesh);
+	occluders_.push_back(occluder);
+}
+
+void OcclusionCuller::renderOccluders()
+{
+	const auto start = std::chrono::steady_clock::now();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+
+	//Triangles are set up once per occluder, then each band of tile rows is
+	//rasterised by one thread so no two threads write the same tile
+	statistics_.occluder_triangles = occluders_.empty() ? 0
+		: occluders_.back().first_triangle + getOccluderMeshTriangleCount(occluders_.back().mesh);
+	triangles_.resize(statistics_.occluder_triangles);
+	jobs.parallelFor(occluders_.size(), 8, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+			setupTriangles(occluders_[i]);
+	});
+
+	const int band_height = 2;
+	const int band_count = (tiles_y_ + band_height - 1) / band_height;
+	jobs.parallelFor(band_count, 1, [&](size_t begin, size_t end)
+	{
+		rasteriseBand((int)begin * band_height, std::min((int)end * band_height, tiles_y_));
+	});
+
+	statistics_.rasterised_triangles = 0;
+	for (const auto& triangle : triangles_)
+		statistics_.rasterised_triangles += triangle.valid ? 1 : 0;
+	statistics_.render_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+bool OcclusionCuller::isVisible(const sponza::Aabb& bounds, const sponza::Matrix4x3& world) const
+{
+	//The box is first put in the world as an axis aligned box around the
+	//moved one, so its corners come from the projection * view alone
+	const sponza::Vector3 local_centre = bounds.centre();
+	const float lx = 0.5f * (bounds.max.x - bounds.min.x);
+	const float ly = 0.5f * (bounds.max.y - bounds.min.y);
+	const float lz = 0.5f * (bounds.max.z - bounds.min.z);
+	const sponza::Matrix4x3& m = world;
+	const float centre[3] = {
+		m.m00 * local_centre.x + m.m10 * local_centre.y + m.m20 * local_centre.z + m.m30,
+		m.m01 * local_centre.x + m.m11 * local_centre.y + m.m21 * local_centre.z + m.m31,
+		m.m02 * local_centre.x + m.m12 * local_centre.y + m.m22 * local_centre.z + m.m32 };
+	const float half[3] = {
+		std::fabs(m.m00) * lx + std::fabs(m.m10) * ly + std::fabs(m.m20) * lz,
+		std::fabs(m.m01) * lx + std::fabs(m.m11) * ly + std::fabs(m.m21) * lz,
+		std::fabs(m.m02) * lx + std::fabs(m.m12) * ly + std::fabs(m.m22) * lz };
+
+	//The box's screen rectangle and its nearest depth bound every pixel it
+	//could cover, which is all the test needs
+	const float * pv = projection_view_;
+	const float centre_x = pv[0] * centre[0] + pv[4] * centre[1] + pv[8] * centre[2] + pv[12];
+	const float centre_y = pv[1] * centre[0] + pv[5] * centre[1] + pv[9] * centre[2] + pv[13];
+	const float centre_w = pv[3] * centre[0] + pv[7] * centre[1] + pv[11] * centre[2] + pv[15];
+
+	//The eight corners are two SSE registers per component, SSE2 being
+	//part of every x64 CPU
+	const __m128 sign_x = _mm_setr_ps(-1.f, 1.f, -1.f, 1.f);
+	const __m128 sign_y = _mm_setr_ps(-1.f, -1.f, 1.f, 1.f);
+	__m128 corner_x[2];
+	__m128 corner_y[2];
+	__m128 corner_w[2];
+	for (int half_box = 0; half_box < 2; ++half_box)
+	{
+		//The first four corners are at the box's low z, the rest at high z
+		const float z_sign = half_box == 0 ? -1.f : 1.f;
+		corner_x[half_box] = _mm_add_ps(
+			_mm_set1_ps(centre_x + z_sign * pv[8] * half[2]),
+			_mm_add_ps(_mm_mul_ps(sign_x, _mm_set1_ps(pv[0] * half[0])),
+				_mm_mul_ps(sign_y, _mm_set1_ps(pv[4] * half[1]))));
+		corner_y[half_box] = _mm_add_ps(
+			_mm_set1_ps(centre_y + z_sign * pv[9] * half[2]),
+			_mm_add_ps(_mm_mul_ps(sign_x, _mm_set1_ps(pv[1] * half[0])),
+				_mm_mul_ps(sign_y, _mm_set1_ps(pv[5] * half[1]))));
+		corner_w[half_box] = _mm_add_ps(
+			_mm_set1_ps(centre_w + z_sign * pv[11] * half[2]),
+			_mm_add_ps(_mm_mul_ps(sign_x, _mm_set1_ps(pv[3] * half[0])),
+				_mm_mul_ps(sign_y, _mm_set1_ps(pv[7] * half[1]))));
+	}
+
+	const float z_min = horizontalMin(_mm_min_ps(corner_w[0], corner_w[1]));
+	if (z_min < kMinimumDepth)
+		return true;
+
+	const __m128 x0 = _mm_div_ps(corner_x[0], corner_w[0]);
+	const __m128 x1 = _mm_div_ps(corner_x[1], corner_w[1]);
+	const __m128 y0 = _mm_div_ps(corner_y[0], corner_w[0]);
+	const __m128 y1 = _mm_div_ps(corner_y[1], corner_w[1]);
+	float x_min = horizontalMin(_mm_min_ps(x0, x1));
+	float x_max = horizontalMax(_mm_max_ps(x0, x1));
+	float y_min = horizontalMin(_mm_min_ps(y0, y1));
+	float y_max = horizontalMax(_mm_max_ps(y0, y1));
+	x_min = (x_min * 0.5f + 0.5f) * width_;
+	x_max = (x_max * 0.5f + 0.5f) * width_;
+	y_min = (y_min * 0.5f + 0.5f) * height_;
+	y_max = (y_max * 0.5f + 0.5f) * height_;
+
+	//Every pixel the rectangle touches, not only those whose centre it holds.
+	//Clamped as floats, a box just in front of the camera can project far
+	//outside the range of an int
+	const int x_begin = (int)std::max(0.f, std::floor(x_min));
+	const int x_end = (int)std::min((float)(width_ - 1), std::floor(x_max));
+	const int y_begin = (int)std::max(0.f, std::floor(y_min));
+	const int y_end = (int)std::min((float)(height_ - 1), std::floor(y_max));
+	if (x_begin > x_end || y_begin > y_end)
+		return false;
+
+	for (int ty = y_begin / kTileHeight; ty <= y_end / kTileHeight; ++ty)
+	{
+		for (int tx = x_begin / kTileWidth; tx <= x_end / kTileWidth; ++tx)
+		{
+			const int tile_x = tx * kTileWidth;
+			const int tile_y = ty * kTileHeight;
+			if (!isTileRectOccluded(tiles_[ty * tiles_x_ + tx],
+				x_begin - tile_x, x_end - tile_x,
+				std::max(y_begin - tile_y, 0), std::min(y_end - tile_y, kTileHeight - 1),
+				z_min))
+				return true;
+		}
+	}
+	return false;
+}
+
+void OcclusionCuller::cull(const std::vector<Box>& boxes, std::vector<unsigned int>& indices)
+{
+	const auto start = std::chrono::steady_clock::now();
+	sponza::JobSystem& jobs = jobs_ != nullptr ? *jobs_ : sponza::JobSystem::shared();
+
+	box_visible_.resize(indices.size());
+	jobs.parallelFor(indices.size(), 256, [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			const Box& box = boxes[indices[i]];
+			box_visible_[i] = isVisible(box.bounds, box.world) ? 1 : 0;
+		}
+	});
+
+	size_t kept = 0;
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		if (box_visible_[i] != 0)
+			indices[kept++] = indices[i];
+	}
+	statistics_.tested += indices.size();
+	statistics_.occluded += indices.size() - kept;
+	indices.resize(kept);
+	statistics_.test_microseconds += std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+float OcclusionCuller::getPixelDepthBound(int x, int y) const
+{
+	const Tile& tile = tiles_[(y / kTileHeight) * tiles_x_ + x / kTileWidth];
+	const unsigned int bit = 1u << (x % kTileWidth);
+	return (tile.mask[y % kTileHeight] & bit) != 0 ? tile.z1 : tile.z0;
+}
+
+int OcclusionCuller::getWidth() const
+{
+	return width_;
+}
+
+int OcclusionCuller::getHeight() const
+{
+	return height_;
+}
+
+const OcclusionCuller::Statistics& OcclusionCuller::getStatistics() const
+{
+	return statistics_;
+}
+
+void OcclusionCuller::setupTriangles(const Occluder& occluder)
+{
+	float clip_matrix[16];
+	composeClipMatrix(projection_view_, occluder.world, clip_matrix);
+
+	const OccluderMesh& mesh = meshes_[occluder.mesh];
+	ScreenTriangle * out = &triangles_[occluder.first_triangle];
+	for (size_t e = 0; e < mesh.elements.size(); e += 3, ++out)
+	{
+		//Dropping a triangle that crosses the near plane only loses
+		//occlusion, it never hides anything that is visible
+		ScreenTriangle& triangle = *out;
+		triangle.valid = false;
+		triangle.z_max = 0.f;
+		bool projectable = true;
+		for (int v = 0; v < 3; ++v)
+		{
+			const sponza::Vector3& position = mesh.positions[mesh.elements[e + v]];
+			const ClipPoint p = transformPoint(clip_matrix, position.x, position.y, position.z);
+			if (p.w < kMinimumDepth)
+			{
+				projectable = false;
+				break;
+			}
+			triangle.x[v] = (p.x / p.w * 0.5f + 0.5f) * width_;
+			triangle.y[v] = (p.y / p.w * 0.5f + 0.5f) * height_;
+			triangle.z_max = std::max(triangle.z_max, p.w);
+		}
+		if (!projectable)
+			continue;
+
+		const float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0])
+			- (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+		if (area == 0.f)
+			continue;
+		if (area < 0.f)
+		{
+			std::swap(triangle.x[1], triangle.x[2]);
+			std::swap(triangle.y[1], triangle.y[2]);
+		}
+
+		//Rows whose pixel centres the triangle's height spans
+		const float y_min = std::min(triangle.y[0], std::min(triangle.y[1], triangle.y[2]));
+		const float y_max = std::max(triangle.y[0], std::max(triangle.y[1], triangle.y[2]));
+		triangle.row_begin = (int)std::max(0.f, std::ceil(y_min - 0.5f));
+		triangle.row_end = (int)std::min((float)height_, std::floor(y_max - 0.5f) + 1.f);
+		triangle.valid = triangle.row_begin < triangle.row_end;
+	}
+}
+
+void OcclusionCuller::rasteriseBand(int tile_row_begin, int tile_row_end)
+{
+	for (const auto& triangle : triangles_)
+	{
+		if (triangle.valid
+			&& triangle.row_begin < tile_row_end * kTileHeight
+			&& triangle.row_end > tile_row_begin * kTileHeight)
+			rasteriseTriangle(triangle, tile_row_begin, tile_row_end);
+	}
+}
+
+void OcclusionCuller::rasteriseTriangle(const ScreenTriangle& triangle, int tile_row_begin, int tile_row_end)
+{
+	const int row_begin = std::max(triangle.row_begin, tile_row_begin * kTileHeight);
+	const int row_end = std::min(triangle.row_end, tile_row_end * kTileHeight);
+
+	for (int tile_y = row_begin / kTileHeight; tile_y * kTileHeight < row_end; ++tile_y)
+	{
+		//The covered pixels of each row of this tile row, as an inclusive
+		//span found by intersecting the three edges at the pixel centre
+		int span_begin[kTileHeight];
+		int span_end[kTileHeight];
+		int x_low = width_;
+		int x_high = -1;
+		for (int r = 0; r < kTileHeight; ++r)
+		{
+			const int row = tile_y * kTileHeight + r;
+			span_begin[r] = 0;
+			span_end[r] = -1;
+			if (row < row_begin || row >= row_end)
+				continue;
+
+			const float y = row + 0.5f;
+			float left = 0.f;
+			float right = (float)width_;
+			bool empty = false;
+			for (int edge = 0; edge < 3; ++edge)
+			{
+				const int next = (edge + 1) % 3;
+				const float dx = triangle.x[next] - triangle.x[edge];
+				const float dy = triangle.y[next] - triangle.y[edge];
+				if (dy == 0.f)
+				{
+					empty = empty || dx * (y - triangle.y[edge]) < 0.f;
+					continue;
+				}
+				const float x = triangle.x[edge] + dx * (y - triangle.y[edge]) / dy;
+				if (dy > 0.f)
+					right = std::min(right, x);
+				else
+					left = std::max(left, x);
+			}
+			if (empty)
+				continue;
+
+			span_begin[r] = std::max(0, (int)std::ceil(left - 0.5f));
+			span_end[r] = std::min(width_ - 1, (int)std::floor(right - 0.5f));
+			if (span_begin[r] <= span_end[r])
+			{
+				x_low = std::min(x_low, span_begin[r]);
+				x_high = std::max(x_high, span_end[r]);
+			}
+		}
+		if (x_low > x_high)
+			continue;
+
+		for (int tile_x = x_low / kTileWidth; tile_x <= x_high / kTileWidth; ++tile_x)
+		{
+			unsigned int coverage[kTileHeight];
+			const int first_pixel = tile_x * kTileWidth;
+			for (int r = 0; r < kTileHeight; ++r)
+				coverage[r] = spanMask(span_begin[r] - first_pixel, span_end[r] - first_pixel);
+			updateTile(tiles_[tile_y * tiles_x_ + tile_x], coverage, triangle.z_max);
+		}
+	}
+}
+
+void OcclusionCuller::updateTile(Tile& tile, const unsigned int * coverage, float z_max)
+{
+	//A triangle behind everything the tile already guarantees adds nothing
+	if (z_max >= tile.z0)
+		return;
+
+	unsigned int any = 0;
+	unsigned int all = kFullRow;
+	for (int r = 0; r < kTileHeight; ++r)
+	{
+		tile.mask[r] |= coverage[r];
+		any |= coverage[r];
+		all &= tile.mask[r];
+	}
+	if (any == 0)
+		return;
+
+	//The working layer's depth is the farthest of what it holds. Once it
+	//covers the whole tile it becomes the tile's new bound
+	tile.z1 = std::max(tile.z1, z_max);
+	if (all == kFullRow)
+	{
+		tile.z0 = tile.z1;
+		tile.z1 = 0.f;
+		std::fill(tile.mask, tile.mask + kTileHeight, 0u);
+	}
+}
+
+bool OcclusionCuller::isTileRectOccluded(const Tile& tile,
+	int x_begin, int x_end, int y_begin, int y_end, float z_min) const
+{
+	if (z_min > tile.z0)
+		return true;
+	if (z_min <= tile.z1)
+		return false;
+
+	//Nearer than the tile's bound, so only hidden if the working layer
+	//covers every pixel of the rectangle in this tile
+	const unsigned int rect = spanMask(x_begin, x_end);
+	for (int r = y_begin; r <= y_end; ++r)
+	{
+		if ((rect & ~tile.mask[r]) != 0)
+			return false;
+	}
+	return true;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <sponza/types.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace sponza { class JobSystem; }
+
+//Occlusion culling on the CPU in the style of masked software occlusion
+//culling. Occluder triangles are rasterised into a small depth buffer made of
+//32x8 pixel tiles, each holding a coverage bit per pixel and two depths
+//rather than a depth per pixel, and boxes are then tested against it.
+//Nothing here touches GL, so it runs and can be checked without a window
+class OcclusionCuller
+{
+public:
+
+	static const int kTileWidth = 32;
+	static const int kTileHeight = 8;
+
+	struct Statistics
+	{
+		size_t occluder_triangles{ 0 };
+		size_t rasterised_triangles{ 0 };
+		size_t tested{ 0 };
+		size_t occluded{ 0 };
+		double render_microseconds{ 0.0 };
+		double test_microseconds{ 0.0 };
+	};
+
+	OcclusionCuller();
+
+	~OcclusionCuller();
+
+	//Sets the buffer size, rounded up to whole tiles, and clears it
+	void resize(int width, int height);
+
+	//The pool rasterising and testing runs on, by default the shared pool
+	void setJobSystem(sponza::JobSystem * jobs);
+
+	//Registers a mesh's triangles for use as an occluder, returns its index.
+	//Occluders should be low polygon and closed or wall-like, they are drawn
+	//with both faces
+	int addOccluderMesh(const std::vector<sponza::Vector3>& positions,
+		const std::vector<unsigned int>& elements);
+
+	//Forgets every occluder mesh, indices from addOccluderMesh start again
+	//from zero
+	void clearOccluderMeshes();
+
+	int getOccluderMeshTriangleCount(int mesh) const;
+
+	//Starts a frame, the projection * view matrix is column-major as glm
+	//stores it. Clears the buffer and the queued occluders
+	void beginFrame(const float * projection_view);
+
+	void addOccluder(int mesh, const sponza::Matrix4x3& world);
+
+	//Rasterises every queued occluder into the buffer
+	void renderOccluders();
+
+	//Whether any part of a box in mesh space, moved into the world by a
+	//transform, might be visible past the occluders. Boxes reaching behind
+	//the camera are always visible
+	bool isVisible(const sponza::Aabb& bounds, const sponza::Matrix4x3& world) const;
+
+	struct Box
+	{
+		sponza::Aabb bounds;
+		sponza::Matrix4x3 world;
+	};
+
+	//Tests the boxes named in indices in parallel and removes those that are
+	//hidden, keeping the order of the rest
+	void cull(const std::vector<Box>& boxes, std::vector<unsigned int>& indices);
+
+	//The farthest depth, as distance along the view direction, any pixel
+	//of the buffer can have. Pixels no occluder covers are infinitely far
+	float getPixelDepthBound(int x, int y) const;
+
+	int getWidth() const;
+
+	int getHeight() const;
+
+	const Statistics& getStatistics() const;
+
+private:
+
+	//The depth of a pixel is at most z1 where its bit in mask is set and
+	//at most z0 everywhere. A full mask is folded into z0 and cleared
+	struct Tile
+	{
+		unsigned int mask[kTileHeight];
+		float z0;
+		float z1;
+	};
+
+	struct OccluderMesh
+	{
+		std::vector<sponza::Vector3> positions;
+		std::vector<unsigned int> elements;
+	};
+
+	struct Occluder
+	{
+		int mesh;
+		sponza::Matrix4x3 world;
+		size_t first_triangle;
+	};
+
+	//A triangle in pixels, counter-clockwise, with the farthest depth of its
+	//corners. Triangles reaching behind the near plane are left invalid
+	struct ScreenTriangle
+	{
+		float x[3];
+		float y[3];
+		float z_max;
+		int row_begin;
+		int row_end;
+		bool valid;
+	};
+
+	void setupTriangles(const Occluder& occluder);
+
+	void rasteriseBand(int tile_row_begin, int tile_row_end);
+
+	void rasteriseTriangle(const ScreenTriangle& triangle, int tile_row_begin, int tile_row_end);
+
+	void updateTile(Tile& tile, const unsigned int * coverage, float z_max);
+
+	bool isTileRectOccluded(const Tile& tile, int x_begin, int x_end, int y_begin, int y_end, float z_min) const;
+
+	int width_{ 0 };
+	int height_{ 0 };
+	int tiles_x_{ 0 };
+	int tiles_y_{ 0 };
+	std::vector<Tile> tiles_;
+
+	sponza::JobSystem * jobs_{ nullptr };
+
+	float projection_view_[16];
+
+	std::vector<OccluderMesh> meshes_;
+	std::vector<Occluder> occluders_;
+	std::vector<ScreenTriangle> triangles_;
+	std::vector<unsigned char> box_visible_;
+
+	Statistics statistics_;
+};
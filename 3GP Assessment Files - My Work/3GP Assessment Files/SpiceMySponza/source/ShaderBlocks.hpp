@@ -0,0 +1,40 @@
+#pragma once
+
+//Uniform block and instance layouts shared by every view and its shaders
+
+//Per-frame values, must match FrameBlock in the shaders
+struct FrameBlockGL
+{
+	float combined_matrix[16];
+	float camera_position[3];
+	int light_count;
+	float scene_ambient_light[3];
+	float padding;
+};
+
+//One light, a cone angle of zero is a point light. MyView uploads these to
+//the light_data buffer texture that sponza_fs.glsl reads as three RGBA32F
+//texels per light, in this order. DeferredView draws them in batches of
+//kMaxLights through LightBlock, which must match this as a std140 array
+//of Light
+const int kMaxLights = 256;
+struct LightGL
+{
+	float position[3];
+	float range;
+	float colour[3];
+	float cone_angle;
+	float cone_direction[3];
+	float padding;
+};
+
+//Per-instance vertex attributes, world_matrix is a Matrix4x3's twelve
+//floats in column order. light_list is the first of the instance's lights
+//in its view's instance light indices and how many, zero where a view does
+//not light per instance
+struct InstanceGL
+{
+	float world_matrix[12];
+	int material_index;
+	unsigned int light_list[2];
+};
@@ -0,0 +1,232 @@
+#include "ShaderProgram.hpp"
+#include <tygra/FileHelper.hpp>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+namespace
+{
+	GLuint compileShader(GLenum type, const std::string& file)
+	{
+		GLuint shader = glCreateShader(type);
+		std::string shader_string = tygra::createStringFromFile(file);
+		const char * shader_code = shader_string.c_str();
+		glShaderSource(shader, 1, (const GLchar **)&shader_code, NULL);
+		glCompileShader(shader);
+
+		GLint compile_status = GL_FALSE;
+		glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+		if (compile_status != GL_TRUE)
+		{
+			const int string_length = 1024;
+			GLchar log[string_length] = "";
+			glGetShaderInfoLog(shader, string_length, NULL, log);
+			std::cerr << file << ": " << log << std::endl;
+			glDeleteShader(shader);
+			return 0;
+		}
+		return shader;
+	}
+}
+
+StringId elementId(StringId array, int index)
+{
+	//Digits are produced most significant first, as they appear in the name
+	char digits[12];
+	int count = 0;
+	unsigned int value = (unsigned int)index;
+	do
+	{
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value != 0);
+
+	StringId hash = (array ^ (unsigned char)'[') * kStringIdPrime;
+	while (count > 0)
+		hash = (hash ^ (unsigned char)digits[--count]) * kStringIdPrime;
+	return (hash ^ (unsigned char)']') * kStringIdPrime;
+}
+
+ShaderProgram::ShaderProgram()
+{
+}
+
+ShaderProgram::~ShaderProgram()
+{
+}
+
+bool ShaderProgram::link(const std::string& vertex_shader_file,
+	const std::string& fragment_shader_file,
+	const std::vector<AttributeBinding>& attributes)
+{
+	release();
+
+	GLuint vertex_shader = compileShader(GL_VERTEX_SHADER, vertex_shader_file);
+	GLuint fragment_shader = compileShader(GL_FRAGMENT_SHADER, fragment_shader_file);
+	if (vertex_shader == 0 || fragment_shader == 0)
+	{
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+		return false;
+	}
+
+	program_ = glCreateProgram();
+	glAttachShader(program_, vertex_shader);
+	glAttachShader(program_, fragment_shader);
+	for (const auto& attribute : attributes)
+		glBindAttribLocation(program_, attribute.first, attribute.second);
+	glLinkProgram(program_);
+
+	//The program keeps the shaders alive for as long as it needs them
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+
+	GLint link_status = GL_FALSE;
+	glGetProgramiv(program_, GL_LINK_STATUS, &link_status);
+	if (link_status != GL_TRUE)
+	{
+		const int string_length = 1024;
+		GLchar log[string_length] = "";
+		glGetProgramInfoLog(program_, string_length, NULL, log);
+		std::cerr << log << std::endl;
+		release();
+		return false;
+	}
+
+	reflect();
+	return true;
+}
+
+void ShaderProgram::release()
+{
+	glDeleteProgram(program_);
+	program_ = 0;
+	uniforms_.clear();
+	blocks_.clear();
+}
+
+GLuint ShaderProgram::getId() const
+{
+	return program_;
+}
+
+GLint ShaderProgram::getUniformLocation(StringId name) const
+{
+	const auto found = uniforms_.find(name);
+	return found != uniforms_.end() ? found->second.location : -1;
+}
+
+GLuint ShaderProgram::getUniformBlockIndex(StringId name) const
+{
+	const auto found = blocks_.find(name);
+	return found != blocks_.end() ? found->second.index : GL_INVALID_INDEX;
+}
+
+GLint ShaderProgram::getUniformBlockSize(StringId name) const
+{
+	const auto found = blocks_.find(name);
+	return found != blocks_.end() ? found->second.data_size : 0;
+}
+
+bool ShaderProgram::setUniformBlockBinding(StringId name, GLuint binding) const
+{
+	const GLuint index = getUniformBlockIndex(name);
+	if (index == GL_INVALID_INDEX)
+		return false;
+	glUniformBlockBinding(program_, index, binding);
+	return true;
+}
+
+size_t ShaderProgram::getUniformCount() const
+{
+	return uniforms_.size();
+}
+
+void ShaderProgram::reflect()
+{
+	GLint name_length = 0;
+	glGetProgramiv(program_, GL_ACTIVE_UNIFORM_MAX_LENGTH, &name_length);
+	GLint block_name_length = 0;
+	glGetProgramiv(program_, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &block_name_length);
+	std::vector<GLchar> name(std::max(name_length, block_name_length) + 1);
+
+	GLint uniform_count = 0;
+	glGetProgramiv(program_, GL_ACTIVE_UNIFORMS, &uniform_count);
+	for (GLint i = 0; i < uniform_count; ++i)
+	{
+		//Members of uniform blocks have no location, they are reached
+		//through the block's buffer
+		const GLuint uniform_index = (GLuint)i;
+		GLint block_index = -1;
+		glGetActiveUniformsiv(program_, 1, &uniform_index, GL_UNIFORM_BLOCK_INDEX, &block_index);
+		if (block_index != -1)
+			continue;
+
+		GLint size = 0;
+		GLenum type = 0;
+		glGetActiveUniform(program_, uniform_index, (GLsizei)name.size(), NULL, &size, &type, name.data());
+		std::string uniform_name = name.data();
+
+		//Arrays of basic types are reported once as "name[0]". Each element
+		//is registered, and the bare name refers to the first
+		const auto bracket = uniform_name.size() > 3
+			&& uniform_name.compare(uniform_name.size() - 3, 3, "[0]") == 0
+			? uniform_name.size() - 3 : std::string::npos;
+		if (bracket == std::string::npos)
+		{
+			const GLint location = glGetUniformLocation(program_, uniform_name.c_str());
+			addUniform(stringId(uniform_name.c_str()), uniform_name, location, type);
+
+			//Struct members are also filed under their element and member ids
+			//so a loop over an array of structs can combine ids per element
+			const auto dot = uniform_name.rfind("].");
+			if (dot != std::string::npos)
+			{
+				const std::string element = uniform_name.substr(0, dot + 1);
+				const std::string member = uniform_name.substr(dot + 2);
+				addUniform(memberId(stringId(element.c_str()), stringId(member.c_str())),
+					uniform_name, location, type);
+			}
+			continue;
+		}
+
+		const std::string base = uniform_name.substr(0, bracket);
+		addUniform(stringId(base.c_str()), uniform_name,
+			glGetUniformLocation(program_, uniform_name.c_str()), type);
+		for (GLint element = 0; element < size; ++element)
+		{
+			const std::string element_name = base + "[" + std::to_string(element) + "]";
+			addUniform(stringId(element_name.c_str()), element_name,
+				glGetUniformLocation(program_, element_name.c_str()), type);
+		}
+	}
+
+	GLint block_count = 0;
+	glGetProgramiv(program_, GL_ACTIVE_UNIFORM_BLOCKS, &block_count);
+	for (GLint i = 0; i < block_count; ++i)
+	{
+		glGetActiveUniformBlockName(program_, (GLuint)i, (GLsizei)name.size(), NULL, name.data());
+		UniformBlock block;
+		block.index = (GLuint)i;
+		block.data_size = 0;
+		block.name = name.data();
+		glGetActiveUniformBlockiv(program_, block.index, GL_UNIFORM_BLOCK_DATA_SIZE, &block.data_size);
+
+		const StringId id = stringId(block.name.c_str());
+		const auto inserted = blocks_.insert(std::make_pair(id, block));
+		if (!inserted.second && inserted.first->second.name != block.name)
+			throw std::runtime_error("Uniform blocks " + block.name + " and "
+				+ inserted.first->second.name + " have the same string id");
+	}
+}
+
+void ShaderProgram::addUniform(StringId id, const std::string& name, GLint location, GLenum type)
+{
+	//Two names with one id would make lookups silently wrong, so stop here
+	//and let the shader author rename one
+	Uniform uniform = { location, type, name };
+	const auto inserted = uniforms_.insert(std::make_pair(id, uniform));
+	if (!inserted.second && inserted.first->second.name != name)
+		throw std::runtime_error("Uniforms " + name + " and "
+			+ inserted.first->second.name + " have the same string id");
+}
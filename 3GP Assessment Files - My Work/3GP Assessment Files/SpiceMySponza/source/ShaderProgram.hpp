@@ -0,0 +1,98 @@
+#pragma once
+
+#include <tgl/tgl.h>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//Uniforms and blocks are named by a 32-bit FNV-1a hash of their GLSL name.
+//Written as constexpr so a literal's id is worked out by the compiler
+typedef unsigned int StringId;
+
+const StringId kStringIdBasis = 2166136261u;
+const StringId kStringIdPrime = 16777619u;
+
+constexpr StringId stringId(const char * name, StringId hash = kStringIdBasis)
+{
+	return *name == '\0'
+		? hash
+		: stringId(name + 1, (hash ^ (unsigned char)*name) * kStringIdPrime);
+}
+
+//The id of "array[index]" given the id of "array", without building the string
+StringId elementId(StringId array, int index);
+
+//The id of a struct member, e.g. memberId(elementId(lights, 3), position) for
+//"lights[3].position" where position is stringId("position")
+constexpr StringId memberId(StringId element, StringId member)
+{
+	return (element ^ (member * 0x9e3779b1u)) * kStringIdPrime;
+}
+
+//A linked program with its active uniforms and uniform blocks reflected once
+//at link time, so per-frame code finds locations without asking the driver
+class ShaderProgram
+{
+public:
+
+	//Binds a vertex attribute name to a location before linking
+	typedef std::pair<GLuint, const char *> AttributeBinding;
+
+	ShaderProgram();
+
+	~ShaderProgram();
+
+	//Owns its program id, a copy would release the same program twice
+	ShaderProgram(const ShaderProgram&) = delete;
+	ShaderProgram& operator=(const ShaderProgram&) = delete;
+
+	//Compiles and links the two shader files, printing any log to std::cerr.
+	//Returns false if compiling or linking failed
+	bool link(const std::string& vertex_shader_file,
+		const std::string& fragment_shader_file,
+		const std::vector<AttributeBinding>& attributes);
+
+	void release();
+
+	GLuint getId() const;
+
+	//Returns -1 for names that are not active uniforms, which glUniform*
+	//silently ignores, as it would for a name the driver optimised away
+	GLint getUniformLocation(StringId name) const;
+
+	//Returns GL_INVALID_INDEX for names that are not active blocks
+	GLuint getUniformBlockIndex(StringId name) const;
+
+	//Returns 0 for names that are not active blocks
+	GLint getUniformBlockSize(StringId name) const;
+
+	bool setUniformBlockBinding(StringId name, GLuint binding) const;
+
+	size_t getUniformCount() const;
+
+private:
+
+	struct Uniform
+	{
+		GLint location;
+		GLenum type;
+		std::string name;
+	};
+
+	struct UniformBlock
+	{
+		GLuint index;
+		GLint data_size;
+		std::string name;
+	};
+
+	void reflect();
+
+	void addUniform(StringId id, const std::string& name, GLint location, GLenum type);
+
+	GLuint program_{ 0 };
+
+	std::unordered_map<StringId, Uniform> uniforms_;
+	std::unordered_map<StringId, UniformBlock> blocks_;
+};
@@ -0,0 +1,200 @@
+#include "StreamBuffer.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace
+{
+	const GLbitfield kMapFlags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	GLintptr roundUp(GLintptr value, GLsizeiptr multiple)
+	{
+		return (value + multiple - 1) / multiple * multiple;
+	}
+
+	GLsizeiptr queryAlignment(GLenum name)
+	{
+		GLint alignment = 0;
+		glGetIntegerv(name, &alignment);
+		return std::max(alignment, 1);
+	}
+}
+
+StreamBuffer::StreamBuffer()
+{
+}
+
+StreamBuffer::~StreamBuffer()
+{
+}
+
+void StreamBuffer::create(GLsizeiptr region_size)
+{
+	release();
+	uniform_alignment_ = queryAlignment(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT);
+	texture_buffer_alignment_ = queryAlignment(GL_TEXTURE_BUFFER_OFFSET_ALIGNMENT);
+	binding_alignment_ = std::max(std::max(uniform_alignment_, texture_buffer_alignment_),
+		queryAlignment(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT));
+	createStorage(region_size);
+}
+
+void StreamBuffer::createStorage(GLsizeiptr region_size)
+{
+	//Regions start on a binding alignment so the first allocation of each
+	//frame never has to skip bytes
+	region_size_ = roundUp(region_size, binding_alignment_);
+	glCreateBuffers(1, &buffer_);
+	glNamedBufferStorage(buffer_, kRegionCount * region_size_, nullptr, kMapFlags);
+	mapping_ = (unsigned char *)glMapNamedBufferRange(buffer_, 0, kRegionCount * region_size_, kMapFlags);
+}
+
+void StreamBuffer::release()
+{
+	//Deleting a buffer the GPU is still reading is safe, GL keeps it until
+	//the draws are done
+	for (auto& fence : fences_)
+	{
+		if (fence != nullptr)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	for (const auto& retired : retired_)
+	{
+		if (retired.fence != nullptr)
+			glDeleteSync(retired.fence);
+		glDeleteBuffers(1, &retired.buffer);
+	}
+	retired_.clear();
+	if (buffer_ != 0)
+		glUnmapNamedBuffer(buffer_);
+	glDeleteBuffers(1, &buffer_);
+	buffer_ = 0;
+	mapping_ = nullptr;
+	region_size_ = 0;
+	region_ = 0;
+	used_ = 0;
+	frame_statistics_ = Statistics();
+	statistics_ = Statistics();
+}
+
+void StreamBuffer::waitFor(GLsync fence)
+{
+	//The first wait flushes so the fence is sure to reach the GPU
+	GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+	for (;;)
+	{
+		const GLenum result = glClientWaitSync(fence, flags, 1000000);
+		if (result != GL_TIMEOUT_EXPIRED)
+			return;
+		flags = 0;
+	}
+}
+
+void StreamBuffer::beginFrame()
+{
+	const auto start = std::chrono::steady_clock::now();
+	region_ = (region_ + 1) % kRegionCount;
+	used_ = 0;
+	if (fences_[region_] != nullptr)
+	{
+		waitFor(fences_[region_]);
+		glDeleteSync(fences_[region_]);
+		fences_[region_] = nullptr;
+	}
+
+	//Retired buffers are polled rather than waited on
+	retired_.erase(std::remove_if(retired_.begin(), retired_.end(), [](const RetiredBuffer& retired)
+	{
+		if (retired.fence == nullptr)
+			return false;
+		const GLenum result = glClientWaitSync(retired.fence, 0, 0);
+		if (result != GL_ALREADY_SIGNALED && result != GL_CONDITION_SATISFIED)
+			return false;
+		glDeleteSync(retired.fence);
+		glDeleteBuffers(1, &retired.buffer);
+		return true;
+	}), retired_.end());
+
+	const int regrowths = frame_statistics_.regrowths;
+	frame_statistics_ = Statistics();
+	frame_statistics_.regrowths = regrowths;
+	frame_statistics_.wait_microseconds = std::chrono::duration<double, std::micro>(
+		std::chrono::steady_clock::now() - start).count();
+}
+
+void StreamBuffer::endFrame()
+{
+	fences_[region_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	for (auto& retired : retired_)
+	{
+		if (retired.fence == nullptr)
+			retired.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	frame_statistics_.bytes_used = used_;
+	statistics_ = frame_statistics_;
+}
+
+StreamBuffer::Allocation StreamBuffer::allocate(GLsizeiptr size, GLsizeiptr alignment)
+{
+	const GLintptr region_start = region_ * region_size_;
+	GLintptr offset = roundUp(region_start + used_, alignment);
+	if (offset + size > region_start + region_size_)
+	{
+		//Draws already issued this frame keep reading the old buffer, so it
+		//is retired rather than deleted, and the new one has no frames in
+		//flight to wait for
+		retired_.push_back({ buffer_, nullptr });
+		glUnmapNamedBuffer(buffer_);
+		for (auto& fence : fences_)
+		{
+			if (fence != nullptr)
+				glDeleteSync(fence);
+			fence = nullptr;
+		}
+		createStorage(std::max(2 * region_size_, 2 * (used_ + size + alignment)));
+		used_ = 0;
+		offset = roundUp(region_ * region_size_, alignment);
+		frame_statistics_.regrowths++;
+	}
+	used_ = offset + size - region_ * region_size_;
+	frame_statistics_.allocations++;
+	return { offset, mapping_ + offset };
+}
+
+GLintptr StreamBuffer::write(const void * data, GLsizeiptr size, GLsizeiptr alignment)
+{
+	const Allocation allocation = allocate(size, alignment);
+	if (size > 0)
+		std::memcpy(allocation.data, data, size);
+	return allocation.offset;
+}
+
+GLuint StreamBuffer::getBuffer() const
+{
+	return buffer_;
+}
+
+GLsizeiptr StreamBuffer::getRegionSize() const
+{
+	return region_size_;
+}
+
+GLsizeiptr StreamBuffer::getBindingAlignment() const
+{
+	return binding_alignment_;
+}
+
+GLsizeiptr StreamBuffer::getUniformAlignment() const
+{
+	return uniform_alignment_;
+}
+
+GLsizeiptr StreamBuffer::getTextureBufferAlignment() const
+{
+	return texture_buffer_alignment_;
+}
+
+const StreamBuffer::Statistics& StreamBuffer::getStatistics() const
+{
+	return statistics_;
+}
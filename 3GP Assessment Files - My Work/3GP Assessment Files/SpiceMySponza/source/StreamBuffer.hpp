@@ -0,0 +1,103 @@
+#pragma once
+
+#include <tgl/tgl.h>
+#include <vector>
+
+//One buffer for everything rewritten each frame, mapped once for its whole
+//life with GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT so data is written
+//straight into memory the GPU reads, with no copy made by the driver. The
+//buffer is split into kRegionCount regions used in turn, one per frame, and
+//a fence placed after each frame's draws keeps a region from being written
+//again until the GPU has finished with it
+class StreamBuffer
+{
+public:
+
+	static const int kRegionCount = 3;
+
+	struct Allocation
+	{
+		//From the start of the buffer, ready for glBindBufferRange,
+		//glTexBufferRange or an attribute or indirect offset
+		GLintptr offset;
+		void * data;
+	};
+
+	struct Statistics
+	{
+		GLsizeiptr bytes_used{ 0 };
+		int allocations{ 0 };
+		double wait_microseconds{ 0.0 };
+		int regrowths{ 0 };
+	};
+
+	StreamBuffer();
+
+	~StreamBuffer();
+
+	//Each region holds region_size bytes to start with
+	void create(GLsizeiptr region_size);
+
+	void release();
+
+	//Moves on to the next region, waiting if the GPU may still be reading
+	//it. Allocations are only valid between beginFrame and endFrame
+	void beginFrame();
+
+	//Fences the region after the frame's draws have been issued
+	void endFrame();
+
+	//Reserves size bytes at an offset that is a multiple of alignment, which
+	//need not be a power of two. A frame outgrowing its region moves to a
+	//buffer with larger regions, so getBuffer can change between calls, but
+	//earlier allocations this frame stay valid
+	Allocation allocate(GLsizeiptr size, GLsizeiptr alignment);
+
+	//allocate followed by a copy of size bytes from data
+	GLintptr write(const void * data, GLsizeiptr size, GLsizeiptr alignment);
+
+	GLuint getBuffer() const;
+
+	GLsizeiptr getRegionSize() const;
+
+	//The largest of the uniform, storage and texture buffer offset
+	//alignments, any allocation made with it can be bound as any of them
+	GLsizeiptr getBindingAlignment() const;
+
+	GLsizeiptr getUniformAlignment() const;
+
+	GLsizeiptr getTextureBufferAlignment() const;
+
+	//The last frame's use of its region, regrowths counts every time since
+	//create
+	const Statistics& getStatistics() const;
+
+private:
+
+	void createStorage(GLsizeiptr region_size);
+
+	static void waitFor(GLsync fence);
+
+	GLuint buffer_{ 0 };
+	unsigned char * mapping_{ nullptr };
+	GLsizeiptr region_size_{ 0 };
+	int region_{ 0 };
+	GLsizeiptr used_{ 0 };
+	GLsync fences_[kRegionCount]{};
+
+	//Buffers left behind by growing, deleted once the fence of the frame
+	//that last used them has passed
+	struct RetiredBuffer
+	{
+		GLuint buffer;
+		GLsync fence;
+	};
+	std::vector<RetiredBuffer> retired_;
+
+	GLsizeiptr uniform_alignment_{ 256 };
+	GLsizeiptr texture_buffer_alignment_{ 256 };
+	GLsizeiptr binding_alignment_{ 256 };
+
+	Statistics frame_statistics_;
+	Statistics statistics_;
+};
@@ -0,0 +1,151 @@
+#include "TextureArrayPacker.hpp"
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <utility>
+
+namespace
+{
+	//Reads one component as 8 bits, two byte components keep their high byte
+	unsigned char readComponent(const unsigned char * pixel, int component, int bytes_per_component)
+	{
+		if (bytes_per_component == 1)
+			return pixel[component];
+		const unsigned short value = *(const unsigned short *)(pixel + component * 2);
+		return (unsigned char)(value >> 8);
+	}
+
+	std::vector<unsigned char> resize(const std::vector<unsigned char>& pixels,
+		int width, int height, int new_width, int new_height)
+	{
+		//Bilinear, sampling at texel centres and wrapping at the edges as a
+		//repeating texture would
+		std::vector<unsigned char> resized((size_t)new_width * new_height * 4);
+		for (int y = 0; y < new_height; ++y)
+		{
+			const float sy = (y + 0.5f) * height / new_height - 0.5f;
+			const int y0 = (int)std::floor(sy);
+			const float fy = sy - y0;
+			const int row0 = ((y0 % height) + height) % height;
+			const int row1 = (row0 + 1) % height;
+			for (int x = 0; x < new_width; ++x)
+			{
+				const float sx = (x + 0.5f) * width / new_width - 0.5f;
+				const int x0 = (int)std::floor(sx);
+				const float fx = sx - x0;
+				const int col0 = ((x0 % width) + width) % width;
+				const int col1 = (col0 + 1) % width;
+				const unsigned char * p00 = &pixels[((size_t)row0 * width + col0) * 4];
+				const unsigned char * p01 = &pixels[((size_t)row0 * width + col1) * 4];
+				const unsigned char * p10 = &pixels[((size_t)row1 * width + col0) * 4];
+				const unsigned char * p11 = &pixels[((size_t)row1 * width + col1) * 4];
+				unsigned char * out = &resized[((size_t)y * new_width + x) * 4];
+				for (int c = 0; c < 4; ++c)
+				{
+					const float top = p00[c] + (p01[c] - p00[c]) * fx;
+					const float bottom = p10[c] + (p11[c] - p10[c]) * fx;
+					out[c] = (unsigned char)(top + (bottom - top) * fy + 0.5f);
+				}
+			}
+		}
+		return resized;
+	}
+}
+
+TextureArrayPacker::TextureArrayPacker()
+{
+}
+
+TextureArrayPacker::~TextureArrayPacker()
+{
+}
+
+int TextureArrayPacker::add(const Source& source)
+{
+	Layer layer;
+	layer.width = source.width;
+	layer.height = source.height;
+	layer.pixels.resize((size_t)source.width * source.height * 4);
+
+	//Missing components fill as GL would expand them: zero colour, opaque
+	const int stride = source.components * source.bytes_per_component;
+	const unsigned char * in = (const unsigned char *)source.pixels;
+	for (size_t i = 0; i < (size_t)source.width * source.height; ++i)
+	{
+		const unsigned char * pixel = in + i * stride;
+		unsigned char * out = &layer.pixels[i * 4];
+		for (int c = 0; c < 4; ++c)
+		{
+			out[c] = c < source.components
+				? readComponent(pixel, c, source.bytes_per_component)
+				: (c == 3 ? 255 : 0);
+		}
+	}
+
+	layers_.push_back(std::move(layer));
+	return (int)layers_.size() - 1;
+}
+
+void TextureArrayPacker::clear()
+{
+	layers_.clear();
+	layer_width_ = 0;
+	layer_height_ = 0;
+	resized_count_ = 0;
+}
+
+void TextureArrayPacker::pack()
+{
+	std::map<std::pair<int, int>, int> count_by_size;
+	for (const auto& layer : layers_)
+		count_by_size[std::make_pair(layer.width, layer.height)]++;
+
+	int best_count = 0;
+	for (const auto& size : count_by_size)
+	{
+		const bool larger = (long long)size.first.first * size.first.second
+			> (long long)layer_width_ * layer_height_;
+		if (size.second > best_count || (size.second == best_count && larger))
+		{
+			best_count = size.second;
+			layer_width_ = size.first.first;
+			layer_height_ = size.first.second;
+		}
+	}
+
+	resized_count_ = 0;
+	for (auto& layer : layers_)
+	{
+		if (layer.width == layer_width_ && layer.height == layer_height_)
+			continue;
+		layer.pixels = resize(layer.pixels, layer.width, layer.height, layer_width_, layer_height_);
+		layer.width = layer_width_;
+		layer.height = layer_height_;
+		resized_count_++;
+	}
+}
+
+int TextureArrayPacker::getLayerCount() const
+{
+	return (int)layers_.size();
+}
+
+int TextureArrayPacker::getLayerWidth() const
+{
+	return layer_width_;
+}
+
+int TextureArrayPacker::getLayerHeight() const
+{
+	return layer_height_;
+}
+
+int TextureArrayPacker::getResizedCount() const
+{
+	return resized_count_;
+}
+
+const unsigned char * TextureArrayPacker::getLayerPixels(int layer) const
+{
+	return layers_[layer].pixels.data();
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+//Collects textures of any size and pixel format as RGBA8 images of one
+//common size, ready to upload as the layers of a single 2D texture array.
+//Textures are resized rather than padded so texture coordinates, including
+//repeating ones, still cover the whole image
+class TextureArrayPacker
+{
+public:
+
+	//A texture's pixels as loaded, rows tightly packed, 1 to 4 components
+	//of 1 or 2 bytes each
+	struct Source
+	{
+		int width;
+		int height;
+		int components;
+		int bytes_per_component;
+		const void * pixels;
+	};
+
+	TextureArrayPacker();
+
+	~TextureArrayPacker();
+
+	//Copies the texture as RGBA8 and returns its layer
+	int add(const Source& source);
+
+	void clear();
+
+	//Chooses the layer size, the size most textures already have with ties
+	//going to the larger, and resizes every other texture to it
+	void pack();
+
+	int getLayerCount() const;
+
+	int getLayerWidth() const;
+
+	int getLayerHeight() const;
+
+	//The number of textures pack had to resize
+	int getResizedCount() const;
+
+	//A layer's RGBA8 pixels, only valid after pack
+	const unsigned char * getLayerPixels(int layer) const;
+
+private:
+
+	struct Layer
+	{
+		int width;
+		int height;
+		std::vector<unsigned char> pixels;
+	};
+
+	std::vector<Layer> layers_;
+	int layer_width_{ 0 };
+	int layer_height_{ 0 };
+	int resized_count_{ 0 };
+};
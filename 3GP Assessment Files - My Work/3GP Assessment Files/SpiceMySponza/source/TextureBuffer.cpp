@@ -0,0 +1,48 @@
+#include "TextureBuffer.hpp"
+#include "StreamBuffer.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	//glTexBufferRange needs a range of at least one byte
+	const GLsizeiptr kMinimumSize = 16;
+}
+
+TextureBuffer::TextureBuffer()
+{
+}
+
+TextureBuffer::~TextureBuffer()
+{
+}
+
+void TextureBuffer::create(GLenum internal_format)
+{
+	release();
+	internal_format_ = internal_format;
+	glCreateTextures(GL_TEXTURE_BUFFER, 1, &texture_);
+}
+
+void TextureBuffer::release()
+{
+	glDeleteTextures(1, &texture_);
+	texture_ = 0;
+}
+
+void TextureBuffer::update(StreamBuffer& stream, const void * data, GLsizeiptr size)
+{
+	const GLsizeiptr range = std::max(size, kMinimumSize);
+	const StreamBuffer::Allocation allocation = stream.allocate(range, stream.getTextureBufferAlignment());
+	if (size > 0)
+		std::memcpy(allocation.data, data, size);
+
+	//Direct state access leaves the texture units, which the state cache
+	//shadows, untouched
+	glTextureBufferRange(texture_, internal_format_, stream.getBuffer(), allocation.offset, range);
+}
+
+GLuint TextureBuffer::getTexture() const
+{
+	return texture_;
+}
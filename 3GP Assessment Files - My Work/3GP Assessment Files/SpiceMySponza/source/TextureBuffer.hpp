@@ -0,0 +1,34 @@
+#pragma once
+
+#include <tgl/tgl.h>
+
+class StreamBuffer;
+
+//A buffer texture for arrays too big for a uniform block. It owns no
+//storage of its own: each update writes into the frame's StreamBuffer
+//region and points the texture at that range
+class TextureBuffer
+{
+public:
+
+	TextureBuffer();
+
+	~TextureBuffer();
+
+	//Texels have the given sized format, such as GL_RGBA32F
+	void create(GLenum internal_format);
+
+	void release();
+
+	//Copies size bytes into the stream and reads from them until the next
+	//update. An empty update still gives the texture a range to read
+	void update(StreamBuffer& stream, const void * data, GLsizeiptr size);
+
+	//The buffer texture, bound to GL_TEXTURE_BUFFER
+	GLuint getTexture() const;
+
+private:
+
+	GLuint texture_{ 0 };
+	GLenum internal_format_{ 0 };
+};
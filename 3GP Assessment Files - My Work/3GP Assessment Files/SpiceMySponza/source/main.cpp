@@ -1,9 +1,12 @@
 #include "MyController.hpp"
+#include "Benchmark.hpp"
 
+#include <sponza/sponza.hpp>
 #include <tygra/Window.hpp>
 
 #include <crtdbg.h>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <memory>
 
@@ -13,17 +16,94 @@ int main(int argc, char *argv[])
     _CrtSetDbgFlag(_CRTDBG_ALLOC_MEM_DF | _CRTDBG_LEAK_CHECK_DF);
 
     try {
-        auto controller = std::make_unique<MyController>();
+        if (argc > 1 && std::strcmp(argv[1], "--bench-update") == 0) {
+            runUpdateScalingBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-lights") == 0) {
+            runLightQueryBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-instance-lights") == 0) {
+            runInstanceLightBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-clusters") == 0) {
+            runLightClusterBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-scene") == 0) {
+            runSceneScalingBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-draw-order") == 0) {
+            runDrawOrderBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-occlusion") == 0) {
+            runOcclusionBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-frustum") == 0) {
+            runFrustumCullingBenchmark(std::cout);
+            return 0;
+        }
+        if (argc > 1 && std::strcmp(argv[1], "--bench-record") == 0) {
+            runCommandRecordingBenchmark(std::cout);
+            return 0;
+        }
+
+        // --scene <instances> <lights> [seed] runs a generated scene,
+        // --record <file> captures every frame, --replay <file> draws
+        // a capture instead of simulating and --deferred starts with the
+        // deferred renderer
+        sponza::SceneSettings settings;
+        const char * record_path = nullptr;
+        const char * replay_path = nullptr;
+        bool deferred = false;
+        for (int i = 1; i < argc; i++) {
+            if (std::strcmp(argv[i], "--scene") == 0 && i + 2 < argc) {
+                const bool has_seed = i + 3 < argc && argv[i + 3][0] != '-';
+                const unsigned int seed = has_seed ? std::atoi(argv[i + 3]) : 0;
+                settings = makeStressSceneSettings(std::atoi(argv[i + 1]),
+                                                   std::atoi(argv[i + 2]),
+                                                   seed);
+                i += has_seed ? 3 : 2;
+            }
+            else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+                record_path = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+                replay_path = argv[++i];
+            }
+            else if (std::strcmp(argv[i], "--deferred") == 0) {
+                deferred = true;
+            }
+        }
+
+        auto controller = std::make_unique<MyController>(settings);
+        if (record_path != nullptr) {
+            controller->recordTo(record_path);
+        }
+        if (replay_path != nullptr) {
+            controller->replayFrom(replay_path);
+        }
+        if (deferred) {
+            controller->useDeferredRenderer();
+        }
         auto window = tygra::Window::mainWindow();
         window->setController(controller.get());
 
         const int window_width = 1280;
         const int window_height = 720;
         const int number_of_samples = 4;
+        const int gl_major_version = 4;
+        const int gl_minor_version = 5;
 
         if (window->open(window_width, window_height,
-            number_of_samples, true)) {
-            while (window->isVisible()) {
+            number_of_samples, true,
+            gl_major_version, gl_minor_version)) {
+            while (window->isVisible() && !controller->hasFinished()) {
                 window->update();
             }
             window->close();
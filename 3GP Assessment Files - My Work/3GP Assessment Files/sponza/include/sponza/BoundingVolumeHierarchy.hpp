@@ -0,0 +1,88 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include <vector>
+
+namespace sponza {
+
+/**
+ * A binary AABB tree over a list of item bounds, built with a binned
+ * surface area heuristic. Items are referred to by their index in the
+ * array given to build(). Nodes are stored depth first in one array: a
+ * node's left child immediately follows it and only the right child's
+ * index is stored, so traversal walks mostly forward through memory.
+ */
+class BoundingVolumeHierarchy
+{
+public:
+
+    /**
+     * Builds a new tree over the given bounds.
+     */
+    void build(const std::vector<Aabb>& item_bounds);
+
+    /**
+     * Updates node bounds bottom-up for items that have moved, keeping the
+     * tree topology. item_bounds must hold the same items as for build().
+     */
+    void refit(const std::vector<Aabb>& item_bounds);
+
+    size_t getItemCount() const;
+
+    size_t getNodeCount() const;
+
+    void queryAabb(const Aabb& box,
+                   std::vector<unsigned int>& items) const;
+
+    void querySphere(const Vector3& centre,
+                     float radius,
+                     std::vector<unsigned int>& items) const;
+
+    /**
+     * Finds items whose bounds are not fully outside any of the planes.
+     * Plane normals point into the volume.
+     */
+    void queryFrustum(const Plane * planes,
+                      int plane_count,
+                      std::vector<unsigned int>& items) const;
+
+    /**
+     * Finds the item whose bounds the ray enters first.
+     * @return  False if no bounds are hit within max_distance.
+     */
+    bool queryRay(const Vector3& origin,
+                  const Vector3& direction,
+                  float max_distance,
+                  unsigned int& item,
+                  float& distance) const;
+
+private:
+
+    struct Node
+    {
+        Aabb bounds;
+        // leaf: first entry in item_indices_; inner: right child's node index
+        unsigned int offset{ 0 };
+        // leaf: number of items; inner: zero
+        unsigned int count{ 0 };
+    };
+
+    void buildNode(unsigned int node_index,
+                   unsigned int first,
+                   unsigned int count,
+                   unsigned int depth,
+                   const std::vector<Aabb>& item_bounds,
+                   const std::vector<Vector3>& centres);
+
+    void collectSubtree(unsigned int node_index,
+                        std::vector<unsigned int>& items) const;
+
+    std::vector<Node> nodes_;
+
+    // item indices and bounds in leaf order, so a leaf's items are adjacent
+    std::vector<unsigned int> item_indices_;
+    std::vector<Aabb> item_bounds_;
+
+};
+
+} // end namespace sponza
@@ -0,0 +1,84 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include <chrono>
+#include <vector>
+
+namespace sponza {
+
+/**
+ * A source of simulation time for a Context.
+ * Each call to tick() advances the clock by one frame and returns the
+ * time of that frame in seconds since the clock was reset.
+ */
+class Clock
+{
+public:
+    virtual ~Clock() {}
+
+    virtual void reset() = 0;
+
+    virtual double tick() = 0;
+};
+
+/**
+ * Wall time measured with the monotonic steady clock at its native
+ * (nanosecond) resolution.
+ */
+class RealTimeClock : public Clock
+{
+public:
+    RealTimeClock();
+
+    void reset() override;
+
+    double tick() override;
+
+private:
+    std::chrono::steady_clock::time_point start_time_;
+
+};
+
+/**
+ * Advances by a constant step every frame regardless of wall time,
+ * so the n-th frame is always at n * step seconds.
+ */
+class FixedStepClock : public Clock
+{
+public:
+    FixedStepClock(double step_seconds);
+
+    double getStepInSeconds() const;
+
+    void reset() override;
+
+    double tick() override;
+
+private:
+    double step_seconds_{ 0 };
+    unsigned long long frame_index_{ 0 };
+
+};
+
+/**
+ * Plays back a recorded list of frame times. Once the script is exhausted
+ * the final time is repeated.
+ */
+class ScriptedClock : public Clock
+{
+public:
+    ScriptedClock(std::vector<double> frame_times);
+
+    bool isFinished() const;
+
+    void reset() override;
+
+    double tick() override;
+
+private:
+    std::vector<double> frame_times_;
+    size_t frame_index_{ 0 };
+
+};
+
+} // end namespace sponza
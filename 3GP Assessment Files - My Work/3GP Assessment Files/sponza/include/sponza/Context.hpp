@@ -1,21 +1,102 @@
 #pragma once
 
 #include "sponza_fwd.hpp"
+#include "BoundingVolumeHierarchy.hpp"
+#include "LightGrid.hpp"
+#include "Material.hpp"
+#include "SceneSnapshot.hpp"
+#include "SlotMap.hpp"
+#include "TransformHierarchy.hpp"
+#include "TripleBuffer.hpp"
+#include <iosfwd>
 #include <vector>
-#include <chrono>
 #include <memory>
 
 namespace sponza {
 
+/**
+ * Optional scaling of the stock scene, used for stress testing.
+ * The default settings give the stock scene.
+ */
+struct SceneSettings
+{
+    // copies of the whole instance set laid out on a rows by columns grid,
+    // the first copy is the stock scene left where it is
+    unsigned int replica_rows{ 1 };
+    unsigned int replica_columns{ 1 };
+
+    // distance between neighbouring copies, zero to fit the scene's extent
+    float replica_spacing{ 0.f };
+
+    // give every copy after the first a random turn and offset, and its
+    // instances random materials, and spread the orb lights over all copies
+    bool randomize_replicas{ true };
+
+    // extra materials with random colours made for the copies to use
+    unsigned int random_material_count{ 16 };
+
+    // seeds all of the randomisation above, the same seed gives the same scene
+    unsigned int seed{ 0 };
+
+    // extra copies of the animated instance laid out on a grid
+    unsigned int animated_instance_copies{ 0 };
+
+    // orbiting lights when fully lit, half of them switch off periodically
+    unsigned int orb_light_count{ 20 };
+};
+
 class Context
 {
 public:
     Context();
 
+    /**
+     * Constructs the scene driven by the given clock instead of wall time.
+     * With a FixedStepClock or ScriptedClock every call to update() steps
+     * the scene by exactly one frame and the results are reproducible.
+     */
+    explicit Context(std::unique_ptr<Clock> clock);
+
+    Context(std::unique_ptr<Clock> clock, const SceneSettings& settings);
+
     ~Context();
 
+    /**
+     * Sets the worker pool used to parallelise update(), by default the
+     * shared pool. The results of update() do not depend on the pool.
+     */
+    void setJobSystem(JobSystem * jobs);
+
+    /**
+     * Advances the simulation one frame and publishes a new snapshot.
+     */
     void update();
 
+    /**
+     * Returns the latest snapshot published by update(). The reference
+     * stays valid until the next call, even while update() runs on another
+     * thread. Must only be called from a single (render) thread.
+     */
+    const SceneSnapshot& acquireSnapshot() const;
+
+    /**
+     * Writes the state published by the last update() (camera, lights,
+     * instances and materials) to the stream as one binary record.
+     * Records can be written back to back to capture a whole run.
+     * @return  False if the stream failed.
+     */
+    bool writeSnapshot(std::ostream& out) const;
+
+    /**
+     * Replaces the scene state with the next record in the stream and
+     * publishes it as if update() had made it, without simulating. The
+     * record must come from the same scene file but may come from other
+     * SceneSettings, in which case update() no longer animates instances.
+     * @return  False at the end of the stream or if the record is not
+     *          valid for this scene, either way the scene is unchanged.
+     */
+    bool readSnapshot(std::istream& in);
+
     bool toggleCameraAnimation();
 
     float getTimeInSeconds() const;
@@ -32,32 +113,156 @@ public:
 
     const std::vector<Material>& getAllMaterials() const;
 
+    /**
+     * Changes whenever the material list is replaced, so renderers that
+     * compile materials know when to do it again.
+     */
+    unsigned int getMaterialRevision() const;
+
     const Material& getMaterialById(MaterialId id) const;
 
     const std::vector<Instance>& getAllInstances() const;
 
     const Instance& getInstanceById(InstanceId id) const;
 
-    const std::vector<InstanceId> getInstancesByMeshId(MeshId id) const;
+    /**
+     * The live index, for the thread running update(). Renderers on other
+     * threads use SceneSnapshot::getInstancesByMeshId instead.
+     */
+    const std::vector<InstanceId>& getInstancesByMeshId(MeshId id) const;
+
+    /*
+     * Ids are generational handles: lookups by id throw std::out_of_range
+     * for an id that was never issued or whose object has been removed.
+     */
+
+    /**
+     * Adds an instance to the scene and returns its id. It appears in
+     * the next snapshot. Only call from the thread running update().
+     */
+    InstanceId addInstance(MeshId mesh,
+                           MaterialId material,
+                           const Matrix4x3& xform);
+
+    /**
+     * Removes an instance. Every other id stays valid, though the order
+     * of getAllInstances() changes. Only call from the thread running
+     * update().
+     * @return  False if the id is not a live instance.
+     */
+    bool removeInstance(InstanceId id);
+
+    /**
+     * The transform tree driving instances that belong to a group.
+     * Instances outside the tree keep their own flat world matrix.
+     */
+    const TransformHierarchy& getTransformHierarchy() const;
+
+    Aabb getMeshBoundsById(MeshId id) const;
+
+    Aabb getInstanceBoundsById(InstanceId id) const;
+
+    /*
+     * Spatial queries over instance world bounds, answered by a BVH that is
+     * refit by every update(). Matching ids are appended to instances.
+     * Only call these from the thread running update().
+     */
+
+    void findInstancesInFrustum(const Plane * planes,
+                                int plane_count,
+                                std::vector<InstanceId>& instances) const;
+
+    void findInstancesInSphere(Vector3 centre,
+                               float radius,
+                               std::vector<InstanceId>& instances) const;
+
+    void findInstancesInAabb(const Aabb& box,
+                             std::vector<InstanceId>& instances) const;
+
+    bool findFirstInstanceOnRay(Vector3 origin,
+                                Vector3 direction,
+                                float max_distance,
+                                InstanceId& instance,
+                                float& distance) const;
+
+    /*
+     * Find lights whose range touches the given volume, from a light grid
+     * kept up to date by every update(). Matching ids are appended to
+     * lights. Only call these from the thread running update().
+     */
+
+    void findLightsInAabb(const Aabb& box, std::vector<LightId>& lights) const;
+
+    void findLightsInSphere(Vector3 centre,
+                            float radius,
+                            std::vector<LightId>& lights) const;
 
 private:
 
     bool readFile(std::string filepath);
 
-    std::chrono::system_clock::time_point start_time_;
+    void addReplicas(const SceneSettings& settings);
+
+    void addAnimatedInstanceCopies(unsigned int count);
+
+    void placeOrbLights(const SceneSettings& settings);
+
+    void buildTransformHierarchy();
+
+    void rebuildInstanceBvh();
+
+    void updateLightIndex();
+
+    void publishSnapshot();
+
+    JobSystem * jobs_{ nullptr };
+
+    std::unique_ptr<Clock> clock_;
+    double clock_seconds_{ 0 };
     float time_seconds_{ 0.f };
+    unsigned long long frame_index_{ 0 };
+    Vector3 up_direction_{ 0.f, 1.f, 0.f };
+    Vector3 ambient_light_intensity_{ 0.2f, 0.2f, 0.f };
 
     std::unique_ptr<FirstPersonMovement> camera_movement_;
     Camera camera_;
     bool animate_camera_{ false };
 
-    std::vector<Light> lights_;
+    SlotMap<Light> lights_;
+    unsigned int orb_light_count_{ 20 };
+    std::vector<Vector3> orb_light_intensities_;
+    // each orb light circles its centre on an ellipse with these radii
+    std::vector<Vector3> orb_light_centres_;
+    std::vector<Vector3> orb_light_radii_;
+
+    // where each replica put the stock scene's origin
+    std::vector<Vector3> replica_origins_;
+    LightGrid light_index_;
+
+    SlotMap<Material> materials_;
+    unsigned int material_revision_{ 0 };
+
+    SlotMap<Instance> instances_;
+
+    struct MeshRecord
+    {
+        Aabb bounds;
+        std::vector<InstanceId> instances;
+    };
+    // meshes are added in file order, as GeometryBuilder does, so both
+    // hand out the same mesh ids
+    SlotMap<MeshRecord> meshes_;
+    MeshId bounce_mesh_id_{ 0 };
 
-    std::vector<Material> materials_;
+    // in the same dense order as instances_
+    std::vector<Aabb> instance_bounds_;
+    BoundingVolumeHierarchy instance_bvh_;
 
-    std::vector<Instance> instances_;
+    TransformHierarchy transforms_;
+    std::vector<InstanceId> instance_by_transform_node_;
+    TransformNodeId bounce_group_node_{ TransformHierarchy::kNoParent };
 
-    std::vector<std::vector<InstanceId>> instances_by_mesh_;
+    mutable TripleBuffer<SceneSnapshot> snapshots_;
 
 };
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include "sponza_fwd.hpp"
+#include "Mesh.hpp"
+#include "SlotMap.hpp"
 #include <string>
 #include <vector>
 
@@ -22,7 +24,7 @@ private:
 
     bool readFile(std::string filepath);
 
-    std::vector<Mesh> meshes_;
+    SlotMap<Mesh> meshes_;
 
 };
 
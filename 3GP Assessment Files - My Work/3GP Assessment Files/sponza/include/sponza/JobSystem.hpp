@@ -0,0 +1,82 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace sponza {
+
+/**
+ * A fixed pool of worker threads that executes range-partitioned loops.
+ * The thread calling parallelFor() also takes part in the work, so a pool
+ * with zero workers runs everything serially on the caller.
+ */
+class JobSystem
+{
+public:
+    typedef std::function<void(size_t begin, size_t end)> RangeTask;
+
+    /**
+     * @param worker_count  Number of threads in addition to the caller.
+     */
+    explicit JobSystem(unsigned int worker_count);
+
+    ~JobSystem();
+
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    unsigned int getWorkerCount() const;
+
+    /**
+     * Total number of threads that execute a parallelFor, including the
+     * calling thread.
+     */
+    unsigned int getConcurrency() const;
+
+    /**
+     * Splits [0, count) into ranges of at most grain_size elements and runs
+     * task on each range. Returns once every range has completed. Ranges
+     * never overlap so tasks may write to their own elements without locks.
+     */
+    void parallelFor(size_t count, size_t grain_size, const RangeTask& task);
+
+    /**
+     * A process wide pool sized to the hardware.
+     */
+    static JobSystem& shared();
+
+private:
+
+    struct Batch
+    {
+        const RangeTask * task{ nullptr };
+        size_t count{ 0 };
+        size_t grain_size{ 1 };
+        std::atomic<size_t> next_begin{ 0 };
+    };
+
+    void workerMain();
+
+    static void runRanges(Batch& batch);
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable work_ready_;
+    std::condition_variable work_done_;
+    Batch * batch_{ nullptr };
+    unsigned long long generation_{ 0 };
+    unsigned int active_workers_{ 0 };
+    bool quit_{ false };
+
+    // serialises concurrent callers of parallelFor
+    std::mutex submit_mutex_;
+
+};
+
+} // end namespace sponza
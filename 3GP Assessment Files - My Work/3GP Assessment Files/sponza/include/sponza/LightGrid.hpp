@@ -0,0 +1,104 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include <unordered_map>
+#include <vector>
+
+namespace sponza {
+
+/**
+ * A sparse uniform grid over light spheres. Each light is filed under the
+ * one cell holding its centre, so moving a light touches at most two cells
+ * and the grid never needs rebuilding. Lights whose range is larger than
+ * a cell are kept in a separate list that every query tests directly.
+ * Lights are referred to by a dense index chosen by the caller.
+ */
+class LightGrid
+{
+public:
+
+    explicit LightGrid(float cell_size = 40.f);
+
+    float getCellSize() const;
+
+    size_t getLightCount() const;
+
+    /**
+     * The number of cells allocated so far. Cells that empty out are kept
+     * for reuse since lights tend to move back and forth over the same area.
+     */
+    size_t getCellCount() const;
+
+    /**
+     * Adds the light if it is new or moves it if it is not. Indices above
+     * the current count grow the grid, leaving the gaps empty.
+     */
+    void setLight(unsigned int light, Vector3 position, float range);
+
+    void removeLight(unsigned int light);
+
+    /**
+     * Removes every light with an index of count or above. If the largest
+     * light in a cell has shrunk or left since the last call, the query
+     * margin is also tightened to the largest range still filed, so call
+     * this once after each round of setLight calls.
+     */
+    void truncate(size_t count);
+
+    /*
+     * Append the indices of lights whose sphere touches the given volume.
+     * Results are not in any particular order.
+     */
+
+    void queryAabb(const Aabb& box, std::vector<unsigned int>& lights) const;
+
+    void querySphere(Vector3 centre,
+                     float radius,
+                     std::vector<unsigned int>& lights) const;
+
+private:
+
+    struct Entry
+    {
+        Vector3 position;
+        float range;
+        unsigned int light;
+    };
+
+    struct Record
+    {
+        static const unsigned long long kOversized = ~0ull;
+        static const unsigned long long kAbsent = ~0ull - 1;
+
+        unsigned long long cell{ kAbsent };
+        unsigned int slot{ 0 };
+    };
+
+    typedef std::vector<Entry> Cell;
+
+    unsigned long long cellKeyOf(Vector3 position) const;
+
+    void unlink(Record& record);
+
+    template<typename Test>
+    void query(const Aabb& region,
+               Test test,
+               std::vector<unsigned int>& lights) const;
+
+    float cell_size_;
+    float inverse_cell_size_;
+
+    // largest range among lights filed in cells, it bounds how far
+    // outside its cell a light can reach. Until truncate recomputes it,
+    // a stale value is only ever too large, which costs time not results
+    float max_cell_range_{ 0.f };
+    bool max_cell_range_stale_{ false };
+
+    std::unordered_map<unsigned long long, Cell> cells_;
+    std::vector<Entry> oversized_;
+    std::vector<Record> records_;
+    size_t light_count_{ 0 };
+
+};
+
+} // end namespace sponza
@@ -0,0 +1,74 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include "Camera.hpp"
+#include "Instance.hpp"
+#include "Light.hpp"
+#include "SlotMap.hpp"
+#include <vector>
+
+namespace sponza {
+
+/**
+ * An immutable copy of the dynamic scene state at the end of one
+ * Context::update(). Renderers read snapshots rather than the Context so
+ * the next frame can be simulated while this one is drawn.
+ */
+class SceneSnapshot
+{
+public:
+    unsigned long long getFrameIndex() const;
+
+    float getTimeInSeconds() const;
+
+    Vector3 getUpDirection() const;
+
+    Vector3 getAmbientLightIntensity() const;
+
+    const Camera& getCamera() const;
+
+    const std::vector<Light>& getAllLights() const;
+
+    const std::vector<Instance>& getAllInstances() const;
+
+    /**
+     * @throws std::out_of_range if the instance is not in this snapshot.
+     */
+    const Instance& getInstanceById(InstanceId id) const;
+
+    /**
+     * Returns nullptr if the instance is not in this snapshot, as happens
+     * for one added or removed since the snapshot was published.
+     */
+    const Instance * findInstanceById(InstanceId id) const;
+
+    /**
+     * The instances of a mesh as of this snapshot, so always in step with
+     * getAllInstances() however the scene has changed since.
+     * @throws std::out_of_range if the mesh id is not live.
+     */
+    const std::vector<InstanceId>& getInstancesByMeshId(MeshId id) const;
+
+private:
+    friend class Context;
+
+    unsigned long long frame_index_{ 0 };
+    float time_seconds_{ 0.f };
+    Vector3 up_direction_;
+    Vector3 ambient_light_intensity_;
+    Camera camera_;
+    std::vector<Light> lights_;
+    SlotMap<Instance> instances_;
+
+    // indexed by the slot of each mesh id, the id itself is kept to tell
+    // a live mesh from an empty or reused slot
+    struct MeshInstances
+    {
+        MeshId mesh{ 0 };
+        std::vector<InstanceId> instances;
+    };
+    std::vector<MeshInstances> mesh_instances_;
+
+};
+
+} // end namespace sponza
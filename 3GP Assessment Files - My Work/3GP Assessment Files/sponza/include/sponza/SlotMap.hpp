@@ -0,0 +1,244 @@
+#pragma once
+
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace sponza {
+
+/*
+ * Handles pack a slot index in the low bits and a generation in the high
+ * bits. Generations start at one, so zero is never a valid handle, and a
+ * slot's generation moves on each time it is freed so stale handles to
+ * it stop resolving.
+ */
+
+const unsigned int kHandleIndexBits = 20;
+const unsigned int kHandleIndexMask = (1u << kHandleIndexBits) - 1;
+const unsigned int kHandleGenerationMask = ~0u >> kHandleIndexBits;
+
+inline unsigned int makeHandle(unsigned int slot, unsigned int generation)
+{
+    return (generation << kHandleIndexBits) | slot;
+}
+
+/**
+ * The slot a handle refers to. Slots are reused, so two handles with the
+ * same slot are only the same object if the whole handles are equal.
+ */
+inline unsigned int handleSlot(unsigned int handle)
+{
+    return handle & kHandleIndexMask;
+}
+
+inline unsigned int handleGeneration(unsigned int handle)
+{
+    return handle >> kHandleIndexBits;
+}
+
+/**
+ * Values addressed by generational handles. Values are kept packed in one
+ * array for iteration and handles find them through a slot table, so
+ * lookups are O(1) and check the handle is still live, and erasing a value
+ * leaves every other handle valid. Erasing moves the last value into the
+ * hole, so the dense order is only stable while nothing is erased.
+ */
+template<typename T>
+class SlotMap
+{
+public:
+    static const size_t npos = ~size_t(0);
+
+    /**
+     * The handle the next insert will return, for values that store their
+     * own handle and so need it before they are inserted.
+     */
+    unsigned int nextHandle() const
+    {
+        const unsigned int slot = peekFreeSlot();
+        return makeHandle(slot, slot < slots_.size() ? slots_[slot].generation : 1);
+    }
+
+    unsigned int insert(const T& value)
+    {
+        const unsigned int handle = nextHandle();
+        const unsigned int slot = handleSlot(handle);
+        if (slot == slots_.size()) {
+            if (slot > kHandleIndexMask) {
+                throw std::length_error("SlotMap is full");
+            }
+            slots_.push_back(Slot());
+        } else {
+            free_slots_.pop_back();
+        }
+        occupy(slot, handleGeneration(handle), value);
+        return handle;
+    }
+
+    /**
+     * Inserts a value under a handle chosen elsewhere, for restoring a
+     * saved map. Fails if the handle's slot is in use.
+     */
+    bool insertWithHandle(unsigned int handle, const T& value)
+    {
+        const unsigned int slot = handleSlot(handle);
+        const unsigned int generation = handleGeneration(handle);
+        if (generation == 0) return false;
+        while (slots_.size() <= slot) {
+            free_slots_.push_back((unsigned int)slots_.size());
+            slots_.push_back(Slot());
+        }
+        if (slots_[slot].dense_index != kFree) return false;
+        // its free list entry is skipped when it reaches the top
+        occupy(slot, generation, value);
+        return true;
+    }
+
+    bool erase(unsigned int handle)
+    {
+        const size_t index = indexOf(handle);
+        if (index == npos) return false;
+
+        const unsigned int slot = handleSlot(handle);
+        const size_t last = values_.size() - 1;
+        if (index != last) {
+            values_[index] = std::move(values_[last]);
+            handles_[index] = handles_[last];
+            slots_[handleSlot(handles_[index])].dense_index = (unsigned int)index;
+        }
+        values_.pop_back();
+        handles_.pop_back();
+
+        Slot& freed = slots_[slot];
+        freed.dense_index = kFree;
+        freed.generation = (freed.generation + 1) & kHandleGenerationMask;
+        if (freed.generation == 0) freed.generation = 1;
+        free_slots_.push_back(slot);
+        return true;
+    }
+
+    void clear()
+    {
+        values_.clear();
+        handles_.clear();
+        slots_.clear();
+        free_slots_.clear();
+    }
+
+    void reserve(size_t count)
+    {
+        values_.reserve(count);
+        handles_.reserve(count);
+        slots_.reserve(count);
+    }
+
+    bool contains(unsigned int handle) const
+    {
+        return indexOf(handle) != npos;
+    }
+
+    /**
+     * The dense index of a live handle's value, or npos.
+     */
+    size_t indexOf(unsigned int handle) const
+    {
+        const unsigned int slot = handleSlot(handle);
+        if (slot >= slots_.size()) return npos;
+        const Slot& s = slots_[slot];
+        if (s.dense_index == kFree || s.generation != handleGeneration(handle)) {
+            return npos;
+        }
+        return s.dense_index;
+    }
+
+    T * find(unsigned int handle)
+    {
+        const size_t index = indexOf(handle);
+        return index != npos ? &values_[index] : nullptr;
+    }
+
+    const T * find(unsigned int handle) const
+    {
+        const size_t index = indexOf(handle);
+        return index != npos ? &values_[index] : nullptr;
+    }
+
+    /**
+     * Returns the value for a live handle.
+     * @throws std::out_of_range if the handle is not live.
+     */
+    T& at(unsigned int handle)
+    {
+        T * value = find(handle);
+        if (value == nullptr) throw std::out_of_range("stale or invalid handle");
+        return *value;
+    }
+
+    const T& at(unsigned int handle) const
+    {
+        const T * value = find(handle);
+        if (value == nullptr) throw std::out_of_range("stale or invalid handle");
+        return *value;
+    }
+
+    size_t size() const { return values_.size(); }
+
+    bool empty() const { return values_.empty(); }
+
+    /**
+     * The values in dense order, for iteration.
+     */
+    const std::vector<T>& values() const { return values_; }
+
+    typename std::vector<T>::iterator begin() { return values_.begin(); }
+    typename std::vector<T>::iterator end() { return values_.end(); }
+    typename std::vector<T>::const_iterator begin() const { return values_.begin(); }
+    typename std::vector<T>::const_iterator end() const { return values_.end(); }
+
+    T& valueAt(size_t index) { return values_[index]; }
+
+    const T& valueAt(size_t index) const { return values_[index]; }
+
+    unsigned int handleAt(size_t index) const { return handles_[index]; }
+
+private:
+    static const unsigned int kFree = ~0u;
+
+    struct Slot
+    {
+        unsigned int dense_index{ kFree };
+        unsigned int generation{ 1 };
+    };
+
+    unsigned int peekFreeSlot() const
+    {
+        return free_slots_.empty() ? (unsigned int)slots_.size() : free_slots_.back();
+    }
+
+    void occupy(unsigned int slot, unsigned int generation, const T& value)
+    {
+        slots_[slot].dense_index = (unsigned int)values_.size();
+        slots_[slot].generation = generation;
+        values_.push_back(value);
+        handles_.push_back(makeHandle(slot, generation));
+        dropOccupiedFreeSlots();
+    }
+
+    // insertWithHandle can occupy a slot still on the free list, such
+    // entries are dropped once they reach the top
+    void dropOccupiedFreeSlots()
+    {
+        while (!free_slots_.empty()
+               && slots_[free_slots_.back()].dense_index != kFree) {
+            free_slots_.pop_back();
+        }
+    }
+
+    std::vector<T> values_;
+    std::vector<unsigned int> handles_;
+    std::vector<Slot> slots_;
+    std::vector<unsigned int> free_slots_;
+
+};
+
+} // end namespace sponza
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "sponza_fwd.hpp"
+#include <vector>
+
+namespace sponza {
+
+typedef unsigned int TransformNodeId;
+
+/**
+ * A parent/child tree of affine transforms stored in flat arrays.
+ * Nodes can only be parented to nodes that already exist, so the arrays
+ * are always in topological order (a parent precedes its children) and
+ * world matrices can be recomputed in a single forward pass.
+ */
+class TransformHierarchy
+{
+public:
+    static const TransformNodeId kNoParent = ~0u;
+
+    TransformNodeId createNode(TransformNodeId parent,
+                               const Matrix4x3& local_xform);
+
+    size_t getNodeCount() const;
+
+    TransformNodeId getParent(TransformNodeId node) const;
+
+    const Matrix4x3& getLocalTransform(TransformNodeId node) const;
+
+    /**
+     * Replaces a node's local transform. The world transforms of the node
+     * and everything below it are stale until updateWorldTransforms().
+     */
+    void setLocalTransform(TransformNodeId node, const Matrix4x3& local_xform);
+
+    const Matrix4x3& getWorldTransform(TransformNodeId node) const;
+
+    /**
+     * Recomputes the world transform of every changed node and its
+     * descendants, and nothing else.
+     * @return  The recomputed nodes in ascending order, valid until the
+     *          next call.
+     */
+    const std::vector<TransformNodeId>& updateWorldTransforms();
+
+private:
+    std::vector<TransformNodeId> parents_;
+    std::vector<Matrix4x3> local_xforms_;
+    std::vector<Matrix4x3> world_xforms_;
+    std::vector<unsigned char> dirty_;
+    size_t first_dirty_{ 0 };
+    std::vector<TransformNodeId> updated_nodes_;
+
+};
+
+} // end namespace sponza
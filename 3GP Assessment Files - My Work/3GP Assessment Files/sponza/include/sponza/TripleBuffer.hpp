@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+
+namespace sponza {
+
+/**
+ * Wait-free handoff of values from one producer thread to one consumer
+ * thread. The producer fills the write buffer and publishes it; the
+ * consumer acquires the most recently published buffer. Neither side ever
+ * blocks and a buffer is never touched by both threads at once.
+ */
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    /**
+     * The buffer owned by the producer. Producer thread only.
+     */
+    T& getWriteBuffer()
+    {
+        return buffers_[back_];
+    }
+
+    /**
+     * Makes the write buffer the latest value and hands the producer an
+     * unused buffer to write next. Producer thread only.
+     */
+    void publish()
+    {
+        const unsigned int old_middle
+            = middle_.exchange(back_ | kFreshBit, std::memory_order_acq_rel);
+        back_ = old_middle & kIndexMask;
+    }
+
+    /**
+     * Returns the most recently published value, which stays valid and
+     * unchanged until the next call to acquire(). Consumer thread only.
+     */
+    const T& acquire()
+    {
+        if (middle_.load(std::memory_order_relaxed) & kFreshBit) {
+            const unsigned int old_middle
+                = middle_.exchange(front_, std::memory_order_acq_rel);
+            front_ = old_middle & kIndexMask;
+        }
+        return buffers_[front_];
+    }
+
+private:
+    static const unsigned int kIndexMask = 3;
+    static const unsigned int kFreshBit = 4;
+
+    T buffers_[3];
+    unsigned int back_{ 0 };
+    std::atomic<unsigned int> middle_{ 1 };
+    unsigned int front_{ 2 };
+
+};
+
+} // end namespace sponza
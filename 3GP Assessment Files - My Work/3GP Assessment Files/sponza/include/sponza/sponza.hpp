@@ -1,10 +1,18 @@
 #pragma once
 
 #include "sponza_fwd.hpp"
+#include "BoundingVolumeHierarchy.hpp"
 #include "Camera.hpp"
+#include "Clock.hpp"
 #include "Context.hpp"
 #include "GeometryBuilder.hpp"
 #include "Instance.hpp"
+#include "JobSystem.hpp"
 #include "Light.hpp"
+#include "LightGrid.hpp"
 #include "Material.hpp"
 #include "Mesh.hpp"
+#include "SceneSnapshot.hpp"
+#include "SlotMap.hpp"
+#include "TransformHierarchy.hpp"
+#include "TripleBuffer.hpp"
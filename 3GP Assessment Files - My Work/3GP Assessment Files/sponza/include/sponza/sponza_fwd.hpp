@@ -11,18 +11,32 @@ typedef unsigned int LightId;
 
 class FirstPersonMovement;
 
+class BoundingVolumeHierarchy;
+
+class Clock;
+
+class JobSystem;
+
 class Camera;
 
 class Light;
 
+class LightGrid;
+
 class Material;
 
 class Mesh;
 
 class Instance;
 
+class SceneSnapshot;
+
+class TransformHierarchy;
+
 class GeometryBuilder;
 
+struct SceneSettings;
+
 class Context;
 
 } // end namespace sponza
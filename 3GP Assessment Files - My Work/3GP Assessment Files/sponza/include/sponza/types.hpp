@@ -182,6 +182,81 @@ public:
 
 };
 
+
+/**
+ * A utility class to specify axis aligned bounding boxes.
+ * A default constructed box is empty and grows to fit whatever is added.
+ */
+class SPONZA_API Aabb
+{
+public:
+
+    Vector3 min, max;
+
+public:
+
+    Aabb() : min(1e30f, 1e30f, 1e30f), max(-1e30f, -1e30f, -1e30f) {}
+
+    Aabb(const Vector3& Min, const Vector3& Max) : min(Min), max(Max) {}
+
+    bool isEmpty() const
+    {
+        return min.x > max.x || min.y > max.y || min.z > max.z;
+    }
+
+    void grow(const Vector3& p)
+    {
+        min.x = p.x < min.x ? p.x : min.x;
+        min.y = p.y < min.y ? p.y : min.y;
+        min.z = p.z < min.z ? p.z : min.z;
+        max.x = p.x > max.x ? p.x : max.x;
+        max.y = p.y > max.y ? p.y : max.y;
+        max.z = p.z > max.z ? p.z : max.z;
+    }
+
+    void grow(const Aabb& b)
+    {
+        if (b.isEmpty()) return;
+        grow(b.min);
+        grow(b.max);
+    }
+
+    Vector3 centre() const
+    {
+        return Vector3(0.5f * (min.x + max.x),
+                       0.5f * (min.y + max.y),
+                       0.5f * (min.z + max.z));
+    }
+
+    bool overlaps(const Aabb& b) const
+    {
+        return min.x <= b.max.x && max.x >= b.min.x
+            && min.y <= b.max.y && max.y >= b.min.y
+            && min.z <= b.max.z && max.z >= b.min.z;
+    }
+
+};
+
+
+/**
+ * A utility class to specify planes as n.p + d = 0.
+ * Points with n.p + d >= 0 are on the inside (positive) half.
+ */
+class SPONZA_API Plane
+{
+public:
+
+    Vector3 normal;
+    float distance;
+
+public:
+
+    Plane() : normal(0, 1, 0), distance(0) {}
+
+    Plane(const Vector3& N, float D) : normal(N), distance(D) {}
+
+};
+
 } // end namespace sponza
 
 #endif // __SPONZA_TYPES__
@@ -0,0 +1,416 @@
+#include <sponza/sponza.hpp>
+
+#include <algorithm>
+#include <cassert>
+
+using namespace sponza;
+
+namespace {
+
+const unsigned int kBinCount = 16;
+const unsigned int kMinLeafSize = 2;
+const unsigned int kMaxLeafSize = 8;
+// past this depth splits fall back to halving, which bounds the tree depth
+// (and the traversal stack) even for badly clustered input
+const unsigned int kMaxSahDepth = 64;
+const int kMaxStackDepth = 128;
+
+float surfaceArea(const Aabb& b)
+{
+    if (b.isEmpty()) return 0.f;
+    const float dx = b.max.x - b.min.x;
+    const float dy = b.max.y - b.min.y;
+    const float dz = b.max.z - b.min.z;
+    return 2.f * (dx * dy + dy * dz + dz * dx);
+}
+
+float axisOf(const Vector3& v, int axis)
+{
+    return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+}
+
+bool overlapsSphere(const Aabb& b, const Vector3& c, float radius_sq)
+{
+    const float dx = std::max(std::max(b.min.x - c.x, 0.f), c.x - b.max.x);
+    const float dy = std::max(std::max(b.min.y - c.y, 0.f), c.y - b.max.y);
+    const float dz = std::max(std::max(b.min.z - c.z, 0.f), c.z - b.max.z);
+    return dx * dx + dy * dy + dz * dz <= radius_sq;
+}
+
+enum FrustumResult { kOutside, kIntersecting, kInside };
+
+FrustumResult classifyFrustum(const Aabb& b, const Plane * planes, int plane_count)
+{
+    FrustumResult result = kInside;
+    for (int i = 0; i < plane_count; ++i) {
+        const Vector3& n = planes[i].normal;
+        // the corners furthest along and against the plane normal
+        const float far_dist = n.x * (n.x >= 0 ? b.max.x : b.min.x)
+                             + n.y * (n.y >= 0 ? b.max.y : b.min.y)
+                             + n.z * (n.z >= 0 ? b.max.z : b.min.z)
+                             + planes[i].distance;
+        if (far_dist < 0) return kOutside;
+        const float near_dist = n.x * (n.x >= 0 ? b.min.x : b.max.x)
+                              + n.y * (n.y >= 0 ? b.min.y : b.max.y)
+                              + n.z * (n.z >= 0 ? b.min.z : b.max.z)
+                              + planes[i].distance;
+        if (near_dist < 0) result = kIntersecting;
+    }
+    return result;
+}
+
+bool intersectRay(const Aabb& b,
+                  const Vector3& origin,
+                  const Vector3& inv_dir,
+                  float max_distance,
+                  float& entry)
+{
+    float t0 = 0.f;
+    float t1 = max_distance;
+    const float lo[3] = { b.min.x, b.min.y, b.min.z };
+    const float hi[3] = { b.max.x, b.max.y, b.max.z };
+    const float o[3] = { origin.x, origin.y, origin.z };
+    const float inv[3] = { inv_dir.x, inv_dir.y, inv_dir.z };
+    for (int a = 0; a < 3; ++a) {
+        float near_t = (lo[a] - o[a]) * inv[a];
+        float far_t = (hi[a] - o[a]) * inv[a];
+        if (near_t > far_t) std::swap(near_t, far_t);
+        t0 = near_t > t0 ? near_t : t0;
+        t1 = far_t < t1 ? far_t : t1;
+        if (t0 > t1) return false;
+    }
+    entry = t0;
+    return true;
+}
+
+} // end anonymous namespace
+
+void BoundingVolumeHierarchy::build(const std::vector<Aabb>& item_bounds)
+{
+    const unsigned int item_count = (unsigned int)item_bounds.size();
+
+    nodes_.clear();
+    item_indices_.resize(item_count);
+    for (unsigned int i = 0; i < item_count; ++i) {
+        item_indices_[i] = i;
+    }
+    if (item_count == 0) {
+        item_bounds_.clear();
+        return;
+    }
+
+    std::vector<Vector3> centres;
+    centres.reserve(item_count);
+    for (const auto& b : item_bounds) {
+        centres.push_back(b.centre());
+    }
+
+    nodes_.reserve(2 * item_count);
+    nodes_.push_back(Node());
+    buildNode(0, 0, item_count, 0, item_bounds, centres);
+
+    item_bounds_.resize(item_count);
+    for (unsigned int i = 0; i < item_count; ++i) {
+        item_bounds_[i] = item_bounds[item_indices_[i]];
+    }
+}
+
+void BoundingVolumeHierarchy::buildNode(unsigned int node_index,
+                                        unsigned int first,
+                                        unsigned int count,
+                                        unsigned int depth,
+                                        const std::vector<Aabb>& item_bounds,
+                                        const std::vector<Vector3>& centres)
+{
+    Aabb bounds;
+    Aabb centre_bounds;
+    for (unsigned int i = first; i < first + count; ++i) {
+        bounds.grow(item_bounds[item_indices_[i]]);
+        centre_bounds.grow(centres[item_indices_[i]]);
+    }
+    nodes_[node_index].bounds = bounds;
+    nodes_[node_index].offset = first;
+    nodes_[node_index].count = count;
+
+    if (count <= kMinLeafSize) return;
+
+    const Vector3 extent(centre_bounds.max.x - centre_bounds.min.x,
+                         centre_bounds.max.y - centre_bounds.min.y,
+                         centre_bounds.max.z - centre_bounds.min.z);
+    int axis = 0;
+    if (extent.y > extent.x) axis = 1;
+    if (extent.z > axisOf(extent, axis)) axis = 2;
+    const float axis_min = axisOf(centre_bounds.min, axis);
+    const float axis_extent = axisOf(extent, axis);
+
+    unsigned int split = first + count / 2;
+
+    if (axis_extent > 0.f && depth < kMaxSahDepth) {
+        // bin the centroids along the widest axis and sweep the bins to
+        // find the split with the lowest surface area cost
+        unsigned int bin_counts[kBinCount] = {};
+        Aabb bin_bounds[kBinCount];
+        const float bin_scale = kBinCount * (1.f - 1e-5f) / axis_extent;
+        auto binOf = [&](unsigned int item) {
+            const float c = axisOf(centres[item], axis);
+            return std::min((unsigned int)((c - axis_min) * bin_scale),
+                            kBinCount - 1);
+        };
+        for (unsigned int i = first; i < first + count; ++i) {
+            const unsigned int b = binOf(item_indices_[i]);
+            bin_counts[b]++;
+            bin_bounds[b].grow(item_bounds[item_indices_[i]]);
+        }
+
+        float right_area[kBinCount];
+        unsigned int right_count[kBinCount];
+        Aabb accumulated;
+        unsigned int accumulated_count = 0;
+        for (unsigned int b = kBinCount - 1; b > 0; --b) {
+            accumulated.grow(bin_bounds[b]);
+            accumulated_count += bin_counts[b];
+            right_area[b] = surfaceArea(accumulated);
+            right_count[b] = accumulated_count;
+        }
+
+        float best_cost = 1e30f;
+        unsigned int best_bin = 0;
+        accumulated = Aabb();
+        accumulated_count = 0;
+        for (unsigned int b = 0; b < kBinCount - 1; ++b) {
+            accumulated.grow(bin_bounds[b]);
+            accumulated_count += bin_counts[b];
+            if (accumulated_count == 0 || right_count[b + 1] == 0) continue;
+            const float cost = accumulated_count * surfaceArea(accumulated)
+                             + right_count[b + 1] * right_area[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_bin = b;
+            }
+        }
+
+        // traversal cost relative to one item test, in units of node area
+        const float traversal_cost = 1.f;
+        const float leaf_cost = (float)count;
+        const float split_cost
+            = traversal_cost + best_cost / std::max(surfaceArea(bounds), 1e-20f);
+        if (leaf_cost <= split_cost && count <= kMaxLeafSize) return;
+
+        if (best_cost < 1e30f) {
+            auto middle = std::partition(
+                item_indices_.begin() + first,
+                item_indices_.begin() + first + count,
+                [&](unsigned int item) { return binOf(item) <= best_bin; });
+            split = (unsigned int)(middle - item_indices_.begin());
+        }
+    }
+    else if (axis_extent <= 0.f && count <= kMaxLeafSize) {
+        return;
+    }
+
+    // all centroids coincide or binning failed to separate them
+    if (split == first || split == first + count) {
+        split = first + count / 2;
+    }
+
+    const unsigned int left_index = (unsigned int)nodes_.size();
+    assert(left_index == node_index + 1);
+    nodes_.push_back(Node());
+    buildNode(left_index, first, split - first, depth + 1,
+              item_bounds, centres);
+
+    const unsigned int right_index = (unsigned int)nodes_.size();
+    nodes_.push_back(Node());
+    buildNode(right_index, split, first + count - split, depth + 1,
+              item_bounds, centres);
+
+    nodes_[node_index].offset = right_index;
+    nodes_[node_index].count = 0;
+}
+
+void BoundingVolumeHierarchy::refit(const std::vector<Aabb>& item_bounds)
+{
+    assert(item_bounds.size() == item_indices_.size());
+
+    for (size_t i = 0; i < item_indices_.size(); ++i) {
+        item_bounds_[i] = item_bounds[item_indices_[i]];
+    }
+
+    // children always follow their parent, so a reverse sweep sees both
+    // children of a node before the node itself
+    for (size_t n = nodes_.size(); n-- > 0;) {
+        Node& node = nodes_[n];
+        Aabb bounds;
+        if (node.count > 0) {
+            for (unsigned int i = node.offset; i < node.offset + node.count; ++i) {
+                bounds.grow(item_bounds_[i]);
+            }
+        } else {
+            bounds.grow(nodes_[n + 1].bounds);
+            bounds.grow(nodes_[node.offset].bounds);
+        }
+        node.bounds = bounds;
+    }
+}
+
+size_t BoundingVolumeHierarchy::getItemCount() const
+{
+    return item_indices_.size();
+}
+
+size_t BoundingVolumeHierarchy::getNodeCount() const
+{
+    return nodes_.size();
+}
+
+void BoundingVolumeHierarchy::collectSubtree(unsigned int node_index,
+                                             std::vector<unsigned int>& items) const
+{
+    // a subtree's leaves cover a contiguous run of item_indices_, from its
+    // leftmost leaf to its rightmost leaf
+    unsigned int first = node_index;
+    while (nodes_[first].count == 0) first = first + 1;
+    unsigned int last = node_index;
+    while (nodes_[last].count == 0) last = nodes_[last].offset;
+    const unsigned int begin = nodes_[first].offset;
+    const unsigned int end = nodes_[last].offset + nodes_[last].count;
+    items.insert(items.end(),
+                 item_indices_.begin() + begin,
+                 item_indices_.begin() + end);
+}
+
+void BoundingVolumeHierarchy::queryAabb(const Aabb& box,
+                                        std::vector<unsigned int>& items) const
+{
+    if (nodes_.empty()) return;
+
+    unsigned int stack[kMaxStackDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const unsigned int node_index = stack[--top];
+        const Node& node = nodes_[node_index];
+        if (!node.bounds.overlaps(box)) continue;
+        if (node.count > 0) {
+            for (unsigned int i = node.offset; i < node.offset + node.count; ++i) {
+                if (item_bounds_[i].overlaps(box)) items.push_back(item_indices_[i]);
+            }
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = node_index + 1;
+        }
+    }
+}
+
+void BoundingVolumeHierarchy::querySphere(const Vector3& centre,
+                                          float radius,
+                                          std::vector<unsigned int>& items) const
+{
+    if (nodes_.empty()) return;
+
+    const float radius_sq = radius * radius;
+    unsigned int stack[kMaxStackDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const unsigned int node_index = stack[--top];
+        const Node& node = nodes_[node_index];
+        if (!overlapsSphere(node.bounds, centre, radius_sq)) continue;
+        if (node.count > 0) {
+            for (unsigned int i = node.offset; i < node.offset + node.count; ++i) {
+                if (overlapsSphere(item_bounds_[i], centre, radius_sq)) {
+                    items.push_back(item_indices_[i]);
+                }
+            }
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = node_index + 1;
+        }
+    }
+}
+
+void BoundingVolumeHierarchy::queryFrustum(const Plane * planes,
+                                           int plane_count,
+                                           std::vector<unsigned int>& items) const
+{
+    if (nodes_.empty()) return;
+
+    unsigned int stack[kMaxStackDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const unsigned int node_index = stack[--top];
+        const Node& node = nodes_[node_index];
+        const FrustumResult result
+            = classifyFrustum(node.bounds, planes, plane_count);
+        if (result == kOutside) continue;
+        if (result == kInside) {
+            collectSubtree(node_index, items);
+        } else if (node.count > 0) {
+            for (unsigned int i = node.offset; i < node.offset + node.count; ++i) {
+                if (classifyFrustum(item_bounds_[i], planes, plane_count) != kOutside) {
+                    items.push_back(item_indices_[i]);
+                }
+            }
+        } else {
+            stack[top++] = node.offset;
+            stack[top++] = node_index + 1;
+        }
+    }
+}
+
+bool BoundingVolumeHierarchy::queryRay(const Vector3& origin,
+                                       const Vector3& direction,
+                                       float max_distance,
+                                       unsigned int& item,
+                                       float& distance) const
+{
+    if (nodes_.empty()) return false;
+
+    const Vector3 inv_dir(direction.x != 0 ? 1.f / direction.x : 1e30f,
+                          direction.y != 0 ? 1.f / direction.y : 1e30f,
+                          direction.z != 0 ? 1.f / direction.z : 1e30f);
+    float closest = max_distance;
+    bool hit = false;
+
+    unsigned int stack[kMaxStackDepth];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const unsigned int node_index = stack[--top];
+        const Node& node = nodes_[node_index];
+        float entry;
+        if (!intersectRay(node.bounds, origin, inv_dir, closest, entry)) continue;
+        if (node.count > 0) {
+            for (unsigned int i = node.offset; i < node.offset + node.count; ++i) {
+                if (intersectRay(item_bounds_[i], origin, inv_dir, closest, entry)) {
+                    closest = entry;
+                    item = item_indices_[i];
+                    hit = true;
+                }
+            }
+        } else {
+            // visit the nearer child first so the far one is often culled
+            const unsigned int left = node_index + 1;
+            const unsigned int right = node.offset;
+            float left_entry = 1e30f;
+            float right_entry = 1e30f;
+            const bool hit_left = intersectRay(nodes_[left].bounds, origin,
+                                               inv_dir, closest, left_entry);
+            const bool hit_right = intersectRay(nodes_[right].bounds, origin,
+                                                inv_dir, closest, right_entry);
+            if (hit_left && hit_right) {
+                const bool left_first = left_entry <= right_entry;
+                stack[top++] = left_first ? right : left;
+                stack[top++] = left_first ? left : right;
+            } else if (hit_left) {
+                stack[top++] = left;
+            } else if (hit_right) {
+                stack[top++] = right;
+            }
+        }
+    }
+
+    if (hit) distance = closest;
+    return hit;
+}
@@ -0,0 +1,68 @@
+#include <sponza/sponza.hpp>
+
+using namespace sponza;
+
+RealTimeClock::RealTimeClock()
+{
+    reset();
+}
+
+void RealTimeClock::reset()
+{
+    start_time_ = std::chrono::steady_clock::now();
+}
+
+double RealTimeClock::tick()
+{
+    const auto clock_time = std::chrono::steady_clock::now() - start_time_;
+    const auto clock_nanosecs
+        = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_time);
+    return 1e-9 * clock_nanosecs.count();
+}
+
+FixedStepClock::FixedStepClock(double step_seconds)
+    : step_seconds_(step_seconds)
+{
+}
+
+double FixedStepClock::getStepInSeconds() const
+{
+    return step_seconds_;
+}
+
+void FixedStepClock::reset()
+{
+    frame_index_ = 0;
+}
+
+double FixedStepClock::tick()
+{
+    // multiply rather than accumulate so no rounding error builds up
+    return step_seconds_ * frame_index_++;
+}
+
+ScriptedClock::ScriptedClock(std::vector<double> frame_times)
+    : frame_times_(std::move(frame_times))
+{
+}
+
+bool ScriptedClock::isFinished() const
+{
+    return frame_index_ >= frame_times_.size();
+}
+
+void ScriptedClock::reset()
+{
+    frame_index_ = 0;
+}
+
+double ScriptedClock::tick()
+{
+    if (frame_times_.empty()) {
+        return 0;
+    }
+    if (isFinished()) {
+        return frame_times_.back();
+    }
+    return frame_times_[frame_index_++];
+}
@@ -4,6 +4,9 @@
 #include <tcf/tcf.hpp>
 #include <tcf/SimpleScene.hpp>
 
+#include <algorithm>
+#include <istream>
+#include <ostream>
 #include <random>
 #include <cmath>
 
@@ -25,6 +28,8 @@ using namespace sponza;
 *
 *****************************************************************************/
 
+static const InstanceId kNoInstance = 0;
+
 Vector3 normalize(const Vector3& v)
 {
     float norm = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
@@ -36,14 +41,111 @@ Vector3 operator-(const Vector3& lhs, const Vector3& rhs)
     return Vector3(lhs.x - rhs.x, lhs.y - rhs.y, lhs.z - rhs.z);
 }
 
-Context::Context()
+// bounds of a transformed box, from the extents of each matrix column
+Aabb transformAabb(const Aabb& b, const Matrix4x3& m)
+{
+    Aabb out(Vector3(m.m30, m.m31, m.m32), Vector3(m.m30, m.m31, m.m32));
+    const float rows[3][3] = {
+        { m.m00, m.m10, m.m20 },
+        { m.m01, m.m11, m.m21 },
+        { m.m02, m.m12, m.m22 } };
+    const float lo[3] = { b.min.x, b.min.y, b.min.z };
+    const float hi[3] = { b.max.x, b.max.y, b.max.z };
+    float * out_min = &out.min.x;
+    float * out_max = &out.max.x;
+    for (int r = 0; r < 3; ++r) {
+        for (int c = 0; c < 3; ++c) {
+            const float e = rows[r][c] * lo[c];
+            const float f = rows[r][c] * hi[c];
+            out_min[r] += e < f ? e : f;
+            out_max[r] += e < f ? f : e;
+        }
+    }
+    return out;
+}
+
+// m turned by yaw radians about a vertical axis through pivot, then moved
+Matrix4x3 turnAbout(const Matrix4x3& m, float yaw, Vector3 pivot, Vector3 offset)
+{
+    const float c = cosf(yaw);
+    const float s = sinf(yaw);
+    Matrix4x3 out = m;
+    float * columns = &out.m00;
+    for (int k = 0; k < 4; ++k) {
+        float * column = columns + 3 * k;
+        const bool is_position = k == 3;
+        const float x = is_position ? column[0] - pivot.x : column[0];
+        const float z = is_position ? column[2] - pivot.z : column[2];
+        column[0] = c * x + s * z;
+        column[2] = c * z - s * x;
+        if (is_position) {
+            column[0] += pivot.x + offset.x;
+            column[1] += offset.y;
+            column[2] += pivot.z + offset.z;
+        }
+    }
+    return out;
+}
+
+/*
+ * Snapshot records are a header followed by plain little endian fields.
+ * Strings are a 16 bit length and the characters, arrays a 32 bit count
+ * and the elements.
+ */
+static const char kSnapshotMagic[4] = { 'S', 'P', 'Z', 'S' };
+static const unsigned int kSnapshotVersion = 2;
+
+template<typename T>
+static void writeValue(std::ostream& out, const T& value)
+{
+    out.write((const char *)&value, sizeof(T));
+}
+
+template<typename T>
+static bool readValue(std::istream& in, T& value)
 {
-    start_time_ = std::chrono::system_clock::now();
+    return (bool)in.read((char *)&value, sizeof(T));
+}
 
+static void writeString(std::ostream& out, const std::string& s)
+{
+    const unsigned short length = (unsigned short)std::min<size_t>(s.size(), 0xffff);
+    writeValue(out, length);
+    out.write(s.data(), length);
+}
+
+static bool readString(std::istream& in, std::string& s)
+{
+    unsigned short length = 0;
+    if (!readValue(in, length)) return false;
+    s.resize(length);
+    return length == 0 || (bool)in.read(&s[0], length);
+}
+
+Context::Context() : Context(std::make_unique<RealTimeClock>())
+{
+}
+
+Context::Context(std::unique_ptr<Clock> clock)
+    : Context(std::move(clock), SceneSettings())
+{
+}
+
+Context::Context(std::unique_ptr<Clock> clock, const SceneSettings& settings)
+    : jobs_(&JobSystem::shared()), clock_(std::move(clock))
+{
     if (!readFile("sponza.tcf")) {
         throw std::runtime_error("Failed to read sponza.tcf data file");
     }
 
+    addReplicas(settings);
+    addAnimatedInstanceCopies(settings.animated_instance_copies);
+    buildTransformHierarchy();
+
+    rebuildInstanceBvh();
+
+    placeOrbLights(settings);
+
     camera_movement_ = std::make_unique<FirstPersonMovement>();
     camera_movement_->init(Vector3(80, 50, 0), 1.5f, 0.5f);
 
@@ -58,6 +160,171 @@ Context::~Context()
 {
 }
 
+void Context::setJobSystem(JobSystem * jobs)
+{
+    jobs_ = jobs != nullptr ? jobs : &JobSystem::shared();
+}
+
+void Context::addReplicas(const SceneSettings& settings)
+{
+    replica_origins_.assign(1, Vector3(0, 0, 0));
+
+    const unsigned int rows = settings.replica_rows;
+    const unsigned int columns = settings.replica_columns;
+    if (rows * columns <= 1) return;
+
+    Aabb scene_bounds;
+    for (const auto& instance : instances_) {
+        scene_bounds.grow(
+            transformAabb(meshes_.at(instance.getMeshId()).bounds,
+                          instance.getTransformationMatrix()));
+    }
+    const Vector3 pivot = scene_bounds.centre();
+
+    // the footprint's diagonal leaves room for a copy at any angle
+    float spacing = settings.replica_spacing;
+    if (spacing <= 0.f) {
+        const float dx = scene_bounds.max.x - scene_bounds.min.x;
+        const float dz = scene_bounds.max.z - scene_bounds.min.z;
+        spacing = 1.1f * sqrtf(dx * dx + dz * dz);
+    }
+    const float jitter = 0.04f * spacing;
+
+    const bool randomize = settings.randomize_replicas;
+    auto r = std::default_random_engine(settings.seed);
+    auto unit = std::uniform_real_distribution<float>(0.f, 1.f);
+
+    // random materials keep a stock material's textures so that every
+    // texture combination the renderer sees is one it already handles.
+    // Draws are made one per statement to fix their order.
+    const size_t stock_material_count = materials_.size();
+    const unsigned int random_material_count
+        = randomize ? settings.random_material_count : 0;
+    for (unsigned int i = 0; i < random_material_count; ++i) {
+        float draws[8];
+        for (float& draw : draws) {
+            draw = unit(r);
+        }
+        const Material& base = materials_.valueAt(i % stock_material_count);
+        Material material(materials_.nextHandle());
+        material.setAmbientColour(base.getAmbientColour());
+        material.setDiffuseColour(Vector3(0.2f + 0.8f * draws[0],
+                                          0.2f + 0.8f * draws[1],
+                                          0.2f + 0.8f * draws[2]));
+        material.setDiffuseTexture(base.getDiffuseTexture());
+        material.setSpecularColour(Vector3(0.5f + 0.5f * draws[3],
+                                           0.5f + 0.5f * draws[4],
+                                           0.5f + 0.5f * draws[5]));
+        material.setShininess(draws[6] < 0.5f ? 0.f : 128.f * draws[7]);
+        material.setSpecularTexture(base.getSpecularTexture());
+        materials_.insert(material);
+    }
+
+    const size_t stock_instance_count = instances_.size();
+    instances_.reserve(stock_instance_count * rows * columns);
+    for (auto& mesh : meshes_) {
+        mesh.instances.reserve(mesh.instances.size() * rows * columns);
+    }
+
+    for (unsigned int row = 0; row < rows; ++row) {
+        for (unsigned int column = 0; column < columns; ++column) {
+            if (row == 0 && column == 0) continue;
+
+            Vector3 offset(spacing * column, 0, spacing * row);
+            float yaw = 0.f;
+            if (randomize) {
+                yaw = 6.2831853f * unit(r);
+                offset.x += jitter * (unit(r) - 0.5f);
+                offset.z += jitter * (unit(r) - 0.5f);
+            }
+            const Matrix4x3 origin = turnAbout(Matrix4x3(), yaw, pivot, offset);
+            replica_origins_.push_back(Vector3(origin.m30, origin.m31, origin.m32));
+
+            for (size_t i = 0; i < stock_instance_count; ++i) {
+                const Instance original = instances_.valueAt(i);
+                Instance copy(instances_.nextHandle());
+                copy.setMeshId(original.getMeshId());
+                copy.setStatic(original.isStatic());
+                copy.setTransformationMatrix(
+                    turnAbout(original.getTransformationMatrix(), yaw, pivot, offset));
+                if (randomize) {
+                    const size_t material = std::min(
+                        (size_t)(unit(r) * materials_.size()), materials_.size() - 1);
+                    copy.setMaterialId(materials_.valueAt(material).getId());
+                } else {
+                    copy.setMaterialId(original.getMaterialId());
+                }
+                meshes_.at(copy.getMeshId()).instances.push_back(copy.getId());
+                instances_.insert(copy);
+            }
+        }
+    }
+}
+
+void Context::placeOrbLights(const SceneSettings& settings)
+{
+    // draw the orb colours up front, in light order, so that update() can
+    // assign them from any thread and still match the serial sequence
+    orb_light_count_ = settings.orb_light_count;
+    orb_light_intensities_.reserve(orb_light_count_);
+    auto r = std::default_random_engine(0);
+    auto rand = std::uniform_real_distribution<float>(0.6f, 1.f);
+    for (unsigned int i = 0; i < orb_light_count_; ++i) {
+        const float red = rand(r);
+        const float green = rand(r);
+        const float blue = rand(r);
+        orb_light_intensities_.push_back(Vector3(red, green, blue));
+    }
+
+    // stock orbs share one ring around the middle of the scene, with
+    // replicas each orb circles a random copy on a ring of random size
+    const Vector3 stock_radii(120.f, 10.f, 40.f);
+    orb_light_centres_.assign(orb_light_count_, Vector3(0, 0, 0));
+    orb_light_radii_.assign(orb_light_count_, stock_radii);
+    if (!settings.randomize_replicas || replica_origins_.size() <= 1) return;
+
+    // a stream of its own so the replica layout doesn't shift the lights
+    auto placement = std::default_random_engine(settings.seed + 1);
+    auto unit = std::uniform_real_distribution<float>(0.f, 1.f);
+    const size_t replica_count = replica_origins_.size();
+    for (unsigned int i = 0; i < orb_light_count_; ++i) {
+        const size_t replica = std::min(
+            (size_t)(unit(placement) * replica_count), replica_count - 1);
+        const float scale = 0.25f + 0.75f * unit(placement);
+        orb_light_centres_[i] = replica_origins_[replica];
+        orb_light_radii_[i] = Vector3(stock_radii.x * scale,
+                                      stock_radii.y,
+                                      stock_radii.z * scale);
+    }
+}
+
+void Context::addAnimatedInstanceCopies(unsigned int count)
+{
+    if (count == 0) return;
+
+    auto& bounce_mesh = meshes_.at(bounce_mesh_id_);
+    const Instance original = getInstanceById(bounce_mesh.instances[0]);
+    const Matrix4x3 original_xform = original.getTransformationMatrix();
+
+    const unsigned int columns = (unsigned int)ceilf(sqrtf((float)count));
+    const float spacing = 10.f;
+
+    instances_.reserve(instances_.size() + count);
+    bounce_mesh.instances.reserve(bounce_mesh.instances.size() + count);
+    for (unsigned int i = 0; i < count; ++i) {
+        Instance copy(instances_.nextHandle());
+        copy.setMeshId(original.getMeshId());
+        copy.setMaterialId(original.getMaterialId());
+        copy.setStatic(false);
+        Matrix4x3 xform = original_xform;
+        xform.m30 += spacing * (i % columns);
+        xform.m32 += spacing * (i / columns);
+        copy.setTransformationMatrix(xform);
+        bounce_mesh.instances.push_back(copy.getId());
+        instances_.insert(copy);
+    }
+}
+
 bool Context::readFile(std::string filepath)
 {
     tcf::Reader * reader = tcf::createReader();
@@ -80,33 +347,44 @@ bool Context::readFile(std::string filepath)
     }
 
     instances_.clear();
-    instances_by_mesh_.clear();
+    meshes_.clear();
+    materials_.clear();
 
-    instances_by_mesh_.reserve(tcf_scene->meshCount());
+    // every instance starts with the first material made below
+    const MaterialId default_material_id = materials_.nextHandle();
+
+    meshes_.reserve(tcf_scene->meshCount());
     for (unsigned int i = 0; i < tcf_scene->meshCount(); ++i) {
         const auto * mesh = tcf_scene->findMeshByIndex(i);
-        std::vector<InstanceId> instances;
-        instances.reserve(mesh->instanceCount());
+        const MeshId mesh_id = meshes_.nextHandle();
+        MeshRecord record;
+        const Vector3 * positions = (const Vector3 *)mesh->positionArray();
+        for (unsigned int v = 0; positions && v < mesh->vertexCount(); ++v) {
+            record.bounds.grow(positions[v]);
+        }
+        record.instances.reserve(mesh->instanceCount());
         instances_.reserve(instances_.size() + mesh->instanceCount());
         for (unsigned int j = 0; j < mesh->instanceCount(); ++j) {
             const auto& model = mesh->transformationArray()[j];
-            Instance new_model(100 + (InstanceId)instances_.size());
-            new_model.setMeshId(300 + (MeshId)instances_by_mesh_.size());
-            new_model.setMaterialId(200);
+            Instance new_model(instances_.nextHandle());
+            new_model.setMeshId(mesh_id);
+            new_model.setMaterialId(default_material_id);
             new_model.setTransformationMatrix(
                 Matrix4x3(model.m00, model.m01, model.m02,
                 model.m10, model.m11, model.m12,
                 model.m20, model.m21, model.m22,
                 model.m30, model.m31, model.m32));
-            instances.push_back(new_model.getId());
-            instances_.push_back(new_model);
+            record.instances.push_back(new_model.getId());
+            instances_.insert(new_model);
         }
-        instances_by_mesh_.push_back(std::move(instances));
+        meshes_.insert(record);
     }
 
+    // only the first mesh's instances move
+    bounce_mesh_id_ = meshes_.handleAt(0);
     for (auto& instance : instances_)
     {
-        instance.setStatic(instance.getMeshId() != 300);
+        instance.setStatic(instance.getMeshId() != bounce_mesh_id_);
     }
 
     int redShapes[] = { 35, 36, 37, 38, 39, 40, 41, 42, 69, 70, 71, 72, 73, 74,
@@ -140,23 +418,23 @@ bool Context::readFile(std::string filepath)
         "spec2.png",
         ""
     };
-	Material new_material(200);
+	Material new_material(default_material_id);
 	new_material.setAmbientColour(Vector3(0.8f, 0.8f, 1));
 	new_material.setDiffuseColour(Vector3(0.8f, 0.8f, 0.8f));
 	new_material.setDiffuseTexture("diff0.png");
-    materials_.push_back(new_material);
+    materials_.insert(new_material);
     for (int j = 0; j<3; ++j) {
-        Material new_material(200 + j + 1);
+        Material new_material(materials_.nextHandle());
 		new_material.setAmbientColour(Vector3(0.8f, 0.8f, 1));
         new_material.setDiffuseColour(diffuse_colours[j]);
 		new_material.setDiffuseTexture(diffuse_textures[j]);
         new_material.setSpecularColour(specular_colours[j]);
         new_material.setShininess(shininess[j]);
 		new_material.setSpecularTexture(specular_textures[j]);
-		materials_.push_back(new_material);
+		materials_.insert(new_material);
         for (int i = 0; i<numberOfShapes[j]; ++i) {
             int index = shapes[j][i];
-            instances_[index].setMaterialId(new_material.getId());
+            instances_.valueAt(index).setMaterialId(new_material.getId());
         }
     }
 
@@ -166,14 +444,32 @@ bool Context::readFile(std::string filepath)
     return true;
 }
 
+void Context::buildTransformHierarchy()
+{
+    // the bouncing instances move as one group: a parent node carries the
+    // bounce and each instance keeps its resting transform as a child
+    const float rest_y = 6.6f;
+    bounce_group_node_ = transforms_.createNode(TransformHierarchy::kNoParent,
+                                                Matrix4x3());
+    instance_by_transform_node_.push_back(kNoInstance);
+
+    for (const auto& instance : instances_)
+    {
+        if (instance.getMeshId() != bounce_mesh_id_) continue;
+
+        auto xform = instance.getTransformationMatrix();
+        xform.m31 = rest_y;
+        transforms_.createNode(bounce_group_node_, xform);
+        instance_by_transform_node_.push_back(instance.getId());
+    }
+}
+
 void Context::update()
 {
-    const auto clock_time = std::chrono::system_clock::now() - start_time_;
-    const auto clock_millisecs
-        = std::chrono::duration_cast<std::chrono::milliseconds>(clock_time);
-    const float prev_time = time_seconds_;
-    time_seconds_ = 0.001f * clock_millisecs.count();
-    const float dt = time_seconds_ - prev_time;
+    const double prev_time = clock_seconds_;
+    clock_seconds_ = clock_->tick();
+    time_seconds_ = (float)clock_seconds_;
+    const float dt = (float)(clock_seconds_ - prev_time);
 
     if (animate_camera_) {
         const float t = -0.3f * time_seconds_;
@@ -205,46 +501,392 @@ void Context::update()
 	const bool off_phase = fmodf(time_seconds_, 5) > 3.f;
 
     const size_t num_of_point_lights = 2;
-	const size_t num_of_orb_lights = off_phase ? 10 : 20;
+	const size_t num_of_orb_lights
+        = off_phase ? orb_light_count_ / 2 : orb_light_count_;
 	const size_t num_of_lights = num_of_point_lights + num_of_orb_lights;
-    if (lights_.capacity() < num_of_lights)
-    {
-		lights_.reserve(num_of_lights);
+
+    // lights that switch off are removed and come back as new lights,
+    // always at the end so the others keep their order and ids
+    while (lights_.size() > num_of_lights) {
+        lights_.erase(lights_.handleAt(lights_.size() - 1));
+    }
+    while (lights_.size() < num_of_lights) {
+        lights_.insert(Light(lights_.nextHandle()));
     }
 
-    lights_.clear();
-    const LightId base_id = 407;
-	for (size_t i = 0; i < num_of_lights; ++i)
-	{
-		auto light = Light(LightId(base_id + i));
-		lights_.push_back(light);
-	}
+    const size_t light_grain_size = 256;
+    jobs_->parallelFor(num_of_lights, light_grain_size,
+                       [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i) {
+            Light& light = lights_.valueAt(i);
+            if (i == 0) {
+                light.setPosition(Vector3(75.f, 110.f, -5.f + 15.f * cosf(t)));
+                light.setRange(250.f);
+            } else if (i == 1) {
+                light.setPosition(Vector3(-75.f, 110.f, -5.f + 15.f * cosf(1 + t)));
+                light.setRange(250.f);
+            } else {
+                const size_t orb = i - num_of_point_lights;
+                const Vector3& centre = orb_light_centres_[orb];
+                const Vector3& radii = orb_light_radii_[orb];
+                float A = time_seconds_ + i * 6.28f / num_of_orb_lights;
+                light.setPosition(Vector3(centre.x + radii.x * cosf(A),
+                                          centre.y + radii.y,
+                                          centre.z + radii.z * sinf(A)));
+                light.setRange(20.f);
+                light.setIntensity(orb_light_intensities_[orb]);
+            }
+        }
+    });
 
-	lights_[0].setPosition(Vector3(75.f, 110.f, -5.f + 15.f * cosf(t)));
-    lights_[0].setRange(250.f);
+    updateLightIndex();
 
-	lights_[1].setPosition(Vector3(-75.f, 110.f, -5.f + 15.f * cosf(1 + t)));
-	lights_[1].setRange(250.f);
+    auto bounce_xform = Matrix4x3();
+    const float bounce_y = 4;
+    bounce_xform.m31 = bounce_y * (0.5f + 0.5f * cosf(t));
+    transforms_.setLocalTransform(bounce_group_node_, bounce_xform);
 
-	auto r = std::default_random_engine(0);
-	auto rand = std::uniform_real_distribution<float>(0.6f, 1.f);
-	for (size_t i = num_of_point_lights; i < num_of_lights; ++i) {
-		auto& light = lights_[i];
-		float A = time_seconds_ + i * 6.28f / num_of_orb_lights;
-        light.setPosition(Vector3(120.f * cosf(A), 10.f, 40.f * sinf(A)));
-		light.setRange(20.f);
-		light.setIntensity(Vector3(rand(r), rand(r), rand(r)));
-	}
+    const auto& moved_nodes = transforms_.updateWorldTransforms();
 
-    for (auto& instance : instances_)
+    const size_t instance_grain_size = 1024;
+    jobs_->parallelFor(moved_nodes.size(), instance_grain_size,
+                       [&](size_t begin, size_t end)
     {
-        if (instance.getMeshId() != 300) continue;
+        for (size_t i = begin; i < end; ++i) {
+            const TransformNodeId node = moved_nodes[i];
+            // nodes without an instance, or whose instance was removed
+            const size_t index = instances_.indexOf(instance_by_transform_node_[node]);
+            if (index == SlotMap<Instance>::npos) continue;
 
-        auto xform = instance.getTransformationMatrix();
-        const float bounce_y = 4;
-        xform.m31 = 6.6f + bounce_y * (0.5f + 0.5f * cosf(t));
+            auto& instance = instances_.valueAt(index);
+            instance.setTransformationMatrix(transforms_.getWorldTransform(node));
+            instance_bounds_[index]
+                = transformAabb(meshes_.at(instance.getMeshId()).bounds,
+                                instance.getTransformationMatrix());
+        }
+    });
+
+    if (!moved_nodes.empty()) {
+        instance_bvh_.refit(instance_bounds_);
+    }
+
+    frame_index_++;
+    publishSnapshot();
+}
+
+void Context::updateLightIndex()
+{
+    // lights only move a little each frame, so most of these stay in their
+    // cell and the grid is updated in place
+    for (size_t i = 0; i < lights_.size(); ++i) {
+        const Light& light = lights_.valueAt(i);
+        light_index_.setLight((unsigned int)i,
+                              light.getPosition(),
+                              light.getRange());
+    }
+    light_index_.truncate(lights_.size());
+}
+
+void Context::rebuildInstanceBvh()
+{
+    instance_bounds_.resize(instances_.size());
+    for (size_t i = 0; i < instances_.size(); ++i) {
+        const Instance& instance = instances_.valueAt(i);
+        instance_bounds_[i]
+            = transformAabb(meshes_.at(instance.getMeshId()).bounds,
+                            instance.getTransformationMatrix());
+    }
+    instance_bvh_.build(instance_bounds_);
+}
+
+InstanceId Context::addInstance(MeshId mesh_id,
+                                MaterialId material_id,
+                                const Matrix4x3& xform)
+{
+    if (!meshes_.contains(mesh_id) || !materials_.contains(material_id)) {
+        throw std::out_of_range("addInstance given a stale or invalid id");
+    }
+
+    Instance instance(instances_.nextHandle());
+    instance.setMeshId(mesh_id);
+    instance.setMaterialId(material_id);
+    instance.setTransformationMatrix(xform);
+    const InstanceId id = instances_.insert(instance);
+    meshes_.at(mesh_id).instances.push_back(id);
+
+    // dense indices are what the BVH stores, so it is rebuilt rather than
+    // patched; edits are rare next to queries
+    rebuildInstanceBvh();
+    publishSnapshot();
+    return id;
+}
+
+bool Context::removeInstance(InstanceId id)
+{
+    const Instance * instance = instances_.find(id);
+    if (instance == nullptr) return false;
+
+    auto& instances_of_mesh = meshes_.at(instance->getMeshId()).instances;
+    instances_of_mesh.erase(std::find(instances_of_mesh.begin(),
+                                      instances_of_mesh.end(),
+                                      id));
+    // a transform node left pointing at the id no longer resolves, so the
+    // update skips it without the hierarchy being touched
+    instances_.erase(id);
+
+    rebuildInstanceBvh();
+    publishSnapshot();
+    return true;
+}
+
+void Context::publishSnapshot()
+{
+    SceneSnapshot& snapshot = snapshots_.getWriteBuffer();
+    snapshot.frame_index_ = frame_index_;
+    snapshot.time_seconds_ = time_seconds_;
+    snapshot.up_direction_ = getUpDirection();
+    snapshot.ambient_light_intensity_ = getAmbientLightIntensity();
+    snapshot.camera_ = camera_;
+    snapshot.lights_ = lights_.values();
+    snapshot.instances_ = instances_;
+
+    // copied into the slots the buffer already has, so once warmed up a
+    // publish only allocates when a mesh gains instances
+    for (auto& entry : snapshot.mesh_instances_) {
+        entry.mesh = 0;
+        entry.instances.clear();
+    }
+    for (size_t i = 0; i < meshes_.size(); ++i) {
+        const MeshId mesh = meshes_.handleAt(i);
+        const unsigned int slot = handleSlot(mesh);
+        if (slot >= snapshot.mesh_instances_.size()) {
+            snapshot.mesh_instances_.resize(slot + 1);
+        }
+        snapshot.mesh_instances_[slot].mesh = mesh;
+        snapshot.mesh_instances_[slot].instances = meshes_.valueAt(i).instances;
+    }
+    snapshots_.publish();
+}
+
+bool Context::writeSnapshot(std::ostream& out) const
+{
+    out.write(kSnapshotMagic, sizeof(kSnapshotMagic));
+    writeValue(out, kSnapshotVersion);
+    writeValue(out, frame_index_);
+    writeValue(out, time_seconds_);
+    writeValue(out, up_direction_);
+    writeValue(out, ambient_light_intensity_);
+
+    writeValue(out, camera_.getPosition());
+    writeValue(out, camera_.getDirection());
+    writeValue(out, camera_.getVerticalFieldOfViewInDegrees());
+    writeValue(out, camera_.getNearPlaneDistance());
+    writeValue(out, camera_.getFarPlaneDistance());
+
+    writeValue(out, (unsigned int)materials_.size());
+    for (const auto& material : materials_) {
+        writeValue(out, material.getId());
+        writeValue(out, material.getAmbientColour());
+        writeValue(out, material.getDiffuseColour());
+        writeValue(out, material.getSpecularColour());
+        writeValue(out, material.getShininess());
+        writeString(out, material.getDiffuseTexture());
+        writeString(out, material.getSpecularTexture());
+    }
+
+    writeValue(out, (unsigned int)lights_.size());
+    for (const auto& light : lights_) {
+        writeValue(out, light.getId());
+        writeValue(out, (unsigned char)light.isStatic());
+        writeValue(out, light.getPosition());
+        writeValue(out, light.getRange());
+        writeValue(out, light.getIntensity());
+    }
+
+    writeValue(out, (unsigned int)instances_.size());
+    for (const auto& instance : instances_) {
+        writeValue(out, instance.getId());
+        writeValue(out, (unsigned char)instance.isStatic());
+        writeValue(out, instance.getMeshId());
+        writeValue(out, instance.getMaterialId());
+        writeValue(out, instance.getTransformationMatrix());
+    }
+
+    return (bool)out;
+}
+
+bool Context::readSnapshot(std::istream& in)
+{
+    char magic[sizeof(kSnapshotMagic)];
+    unsigned int version = 0;
+    if (!in.read(magic, sizeof(magic))
+        || !std::equal(magic, magic + sizeof(magic), kSnapshotMagic)
+        || !readValue(in, version) || version != kSnapshotVersion) {
+        return false;
+    }
+
+    // read everything before touching the scene, so a short or bad
+    // record leaves it as it was
+    unsigned long long frame_index = 0;
+    float time_seconds = 0;
+    Vector3 up_direction;
+    Vector3 ambient_light_intensity;
+    Vector3 camera_position;
+    Vector3 camera_direction;
+    float field_of_view = 0;
+    float near_distance = 0;
+    float far_distance = 0;
+    if (!readValue(in, frame_index)
+        || !readValue(in, time_seconds)
+        || !readValue(in, up_direction)
+        || !readValue(in, ambient_light_intensity)
+        || !readValue(in, camera_position)
+        || !readValue(in, camera_direction)
+        || !readValue(in, field_of_view)
+        || !readValue(in, near_distance)
+        || !readValue(in, far_distance)) {
+        return false;
+    }
+
+    unsigned int material_count = 0;
+    if (!readValue(in, material_count) || material_count == 0) return false;
+    SlotMap<Material> materials;
+    materials.reserve(material_count);
+    for (unsigned int i = 0; i < material_count; ++i) {
+        MaterialId id = 0;
+        Vector3 ambient, diffuse, specular;
+        float shininess = 0;
+        std::string diffuse_texture, specular_texture;
+        if (!readValue(in, id)
+            || !readValue(in, ambient)
+            || !readValue(in, diffuse)
+            || !readValue(in, specular)
+            || !readValue(in, shininess)
+            || !readString(in, diffuse_texture)
+            || !readString(in, specular_texture)) {
+            return false;
+        }
+        Material material(id);
+        material.setAmbientColour(ambient);
+        material.setDiffuseColour(diffuse);
+        material.setSpecularColour(specular);
+        material.setShininess(shininess);
+        material.setDiffuseTexture(diffuse_texture);
+        material.setSpecularTexture(specular_texture);
+        if (!materials.insertWithHandle(id, material)) return false;
+    }
+
+    unsigned int light_count = 0;
+    if (!readValue(in, light_count)) return false;
+    SlotMap<Light> lights;
+    lights.reserve(light_count);
+    for (unsigned int i = 0; i < light_count; ++i) {
+        LightId id = 0;
+        unsigned char is_static = 0;
+        Vector3 position, intensity;
+        float range = 0;
+        if (!readValue(in, id)
+            || !readValue(in, is_static)
+            || !readValue(in, position)
+            || !readValue(in, range)
+            || !readValue(in, intensity)) {
+            return false;
+        }
+        Light light(id);
+        light.setStatic(is_static != 0);
+        light.setPosition(position);
+        light.setRange(range);
+        light.setIntensity(intensity);
+        if (!lights.insertWithHandle(id, light)) return false;
+    }
+
+    // instances must refer to meshes in this scene's file
+    unsigned int instance_count = 0;
+    if (!readValue(in, instance_count)) return false;
+    SlotMap<Instance> instances;
+    instances.reserve(instance_count);
+    for (unsigned int i = 0; i < instance_count; ++i) {
+        InstanceId id = 0;
+        unsigned char is_static = 0;
+        MeshId mesh_id = 0;
+        MaterialId material_id = 0;
+        Matrix4x3 xform;
+        if (!readValue(in, id)
+            || !readValue(in, is_static)
+            || !readValue(in, mesh_id) || !meshes_.contains(mesh_id)
+            || !readValue(in, material_id) || !materials.contains(material_id)
+            || !readValue(in, xform)) {
+            return false;
+        }
+        Instance instance(id);
+        instance.setStatic(is_static != 0);
+        instance.setMeshId(mesh_id);
+        instance.setMaterialId(material_id);
         instance.setTransformationMatrix(xform);
+        if (!instances.insertWithHandle(id, instance)) return false;
     }
+
+    bool same_instance_set = instances.size() == instances_.size();
+    for (size_t i = 0; same_instance_set && i < instances.size(); ++i) {
+        same_instance_set = instances.handleAt(i) == instances_.handleAt(i)
+            && instances.valueAt(i).getMeshId() == instances_.valueAt(i).getMeshId();
+    }
+
+    frame_index_ = frame_index;
+    time_seconds_ = time_seconds;
+    up_direction_ = up_direction;
+    ambient_light_intensity_ = ambient_light_intensity;
+    camera_.setPosition(camera_position);
+    camera_.setDirection(camera_direction);
+    camera_.setVerticalFieldOfViewInDegrees(field_of_view);
+    camera_.setNearPlaneDistance(near_distance);
+    camera_.setFarPlaneDistance(far_distance);
+    materials_ = std::move(materials);
+    material_revision_++;
+    lights_ = std::move(lights);
+    instances_ = std::move(instances);
+
+    if (!same_instance_set) {
+        for (auto& mesh : meshes_) {
+            mesh.instances.clear();
+        }
+        for (const auto& instance : instances_) {
+            meshes_.at(instance.getMeshId()).instances.push_back(instance.getId());
+        }
+        // the transform tree's nodes no longer match these instances
+        std::fill(instance_by_transform_node_.begin(),
+                  instance_by_transform_node_.end(),
+                  kNoInstance);
+        instance_bounds_.resize(instances_.size());
+    }
+
+    const size_t instance_grain_size = 1024;
+    jobs_->parallelFor(instances_.size(), instance_grain_size,
+                       [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i) {
+            const Instance& instance = instances_.valueAt(i);
+            instance_bounds_[i]
+                = transformAabb(meshes_.at(instance.getMeshId()).bounds,
+                                instance.getTransformationMatrix());
+        }
+    });
+
+    if (same_instance_set) {
+        instance_bvh_.refit(instance_bounds_);
+    } else {
+        instance_bvh_.build(instance_bounds_);
+    }
+
+    updateLightIndex();
+    publishSnapshot();
+    return true;
+}
+
+const SceneSnapshot& Context::acquireSnapshot() const
+{
+    return snapshots_.acquire();
 }
 
 bool Context::toggleCameraAnimation()
@@ -259,12 +901,12 @@ float Context::getTimeInSeconds() const
 
 Vector3 Context::getUpDirection() const
 {
-    return Vector3(0.f, 1.f, 0.f);
+    return up_direction_;
 }
 
 Vector3 Context::getAmbientLightIntensity() const
 {
-    return Vector3(0.2f, 0.2f, 0.f);
+    return ambient_light_intensity_;
 }
 
 const Camera& Context::getCamera() const
@@ -279,30 +921,121 @@ Camera& Context::getCamera()
 
 const std::vector<Light>& Context::getAllLights() const
 {
-    return lights_;
+    return lights_.values();
 }
 
 const std::vector<Material>& Context::getAllMaterials() const
 {
-    return materials_;
+    return materials_.values();
+}
+
+unsigned int Context::getMaterialRevision() const
+{
+    return material_revision_;
 }
 
 const Material& Context::getMaterialById(MaterialId id) const
 {
-    return materials_[id - 200];
+    return materials_.at(id);
 }
 
 const std::vector<Instance>& Context::getAllInstances() const
 {
-    return instances_;
+    return instances_.values();
 }
 
 const Instance& Context::getInstanceById(InstanceId id) const
 {
-    return instances_[id - 100];
+    return instances_.at(id);
+}
+
+const std::vector<InstanceId>& Context::getInstancesByMeshId(MeshId id) const
+{
+    return meshes_.at(id).instances;
+}
+
+const TransformHierarchy& Context::getTransformHierarchy() const
+{
+    return transforms_;
+}
+
+Aabb Context::getMeshBoundsById(MeshId id) const
+{
+    return meshes_.at(id).bounds;
+}
+
+Aabb Context::getInstanceBoundsById(InstanceId id) const
+{
+    const size_t index = instances_.indexOf(id);
+    if (index == SlotMap<Instance>::npos) {
+        throw std::out_of_range("stale or invalid instance id");
+    }
+    return instance_bounds_[index];
+}
+
+// the BVH reports dense instance indices, swap the new results for ids
+template<typename T>
+static void indicesToHandles(const SlotMap<T>& map,
+                             std::vector<unsigned int>& results,
+                             size_t first_new)
+{
+    for (size_t i = first_new; i < results.size(); ++i) {
+        results[i] = map.handleAt(results[i]);
+    }
+}
+
+void Context::findInstancesInFrustum(const Plane * planes,
+                                     int plane_count,
+                                     std::vector<InstanceId>& instances) const
+{
+    const size_t first_new = instances.size();
+    instance_bvh_.queryFrustum(planes, plane_count, instances);
+    indicesToHandles(instances_, instances, first_new);
+}
+
+void Context::findInstancesInSphere(Vector3 centre,
+                                    float radius,
+                                    std::vector<InstanceId>& instances) const
+{
+    const size_t first_new = instances.size();
+    instance_bvh_.querySphere(centre, radius, instances);
+    indicesToHandles(instances_, instances, first_new);
+}
+
+void Context::findInstancesInAabb(const Aabb& box,
+                                  std::vector<InstanceId>& instances) const
+{
+    const size_t first_new = instances.size();
+    instance_bvh_.queryAabb(box, instances);
+    indicesToHandles(instances_, instances, first_new);
+}
+
+bool Context::findFirstInstanceOnRay(Vector3 origin,
+                                     Vector3 direction,
+                                     float max_distance,
+                                     InstanceId& instance,
+                                     float& distance) const
+{
+    unsigned int index = 0;
+    if (!instance_bvh_.queryRay(origin, direction, max_distance, index, distance)) {
+        return false;
+    }
+    instance = instances_.handleAt(index);
+    return true;
+}
+
+void Context::findLightsInAabb(const Aabb& box, std::vector<LightId>& lights) const
+{
+    const size_t first_new = lights.size();
+    light_index_.queryAabb(box, lights);
+    indicesToHandles(lights_, lights, first_new);
 }
 
-const std::vector<InstanceId> Context::getInstancesByMeshId(MeshId id) const
+void Context::findLightsInSphere(Vector3 centre,
+                                 float radius,
+                                 std::vector<LightId>& lights) const
 {
-    return instances_by_mesh_[id - 300];
+    const size_t first_new = lights.size();
+    light_index_.querySphere(centre, radius, lights);
+    indicesToHandles(lights_, lights, first_new);
 }
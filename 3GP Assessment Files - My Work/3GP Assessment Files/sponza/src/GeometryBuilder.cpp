@@ -31,12 +31,12 @@ GeometryBuilder::~GeometryBuilder()
 
 const std::vector<Mesh>& GeometryBuilder::getAllMeshes() const
 {
-    return meshes_;
+    return meshes_.values();
 }
 
 const Mesh& GeometryBuilder::getMeshById(MeshId id) const
 {
-    return meshes_[id - 300];
+    return meshes_.at(id);
 }
 
 bool GeometryBuilder::readFile(std::string filepath)
@@ -66,7 +66,9 @@ bool GeometryBuilder::readFile(std::string filepath)
     meshes_.reserve(tcf_scene->meshCount());
     for (unsigned int i = 0; i < tcf_scene->meshCount(); ++i) {
         const auto * mesh = tcf_scene->findMeshByIndex(i);
-        Mesh new_mesh(300 + (MeshId)meshes_.size());
+        // the Context numbers the same file's meshes the same way, so
+        // both hand out matching ids
+        Mesh new_mesh(meshes_.nextHandle());
         if (mesh->indexArray() != nullptr) {
             new_mesh.assignElementArray(std::vector<unsigned int>(
                 mesh->indexArray(),
@@ -92,7 +94,7 @@ bool GeometryBuilder::readFile(std::string filepath)
                 (const Vector2 *)mesh->uvArray(),
                 (const Vector2 *)mesh->uvArray() + mesh->vertexCount()));
         }
-        meshes_.push_back(new_mesh);
+        meshes_.insert(new_mesh);
     }
 
     reader->release();
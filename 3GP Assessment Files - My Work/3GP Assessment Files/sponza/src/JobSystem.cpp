@@ -0,0 +1,124 @@
+#include <sponza/sponza.hpp>
+
+#include <algorithm>
+
+using namespace sponza;
+
+JobSystem::JobSystem(unsigned int worker_count)
+{
+    workers_.reserve(worker_count);
+    for (unsigned int i = 0; i < worker_count; ++i) {
+        workers_.emplace_back(&JobSystem::workerMain, this);
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        quit_ = true;
+    }
+    work_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+unsigned int JobSystem::getWorkerCount() const
+{
+    return (unsigned int)workers_.size();
+}
+
+unsigned int JobSystem::getConcurrency() const
+{
+    return getWorkerCount() + 1;
+}
+
+JobSystem& JobSystem::shared()
+{
+    static JobSystem shared_jobs(
+        std::max(std::thread::hardware_concurrency(), 1u) - 1);
+    return shared_jobs;
+}
+
+void JobSystem::parallelFor(size_t count,
+                            size_t grain_size,
+                            const RangeTask& task)
+{
+    if (count == 0) {
+        return;
+    }
+    grain_size = std::max<size_t>(grain_size, 1);
+
+    if (workers_.empty() || count <= grain_size) {
+        for (size_t begin = 0; begin < count; begin += grain_size) {
+            task(begin, std::min(begin + grain_size, count));
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit_lock(submit_mutex_);
+
+    Batch batch;
+    batch.task = &task;
+    batch.count = count;
+    batch.grain_size = grain_size;
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        batch_ = &batch;
+        ++generation_;
+    }
+    work_ready_.notify_all();
+
+    runRanges(batch);
+
+    // a worker claims ranges only while counted as active, so once none
+    // are active every range has been completed and the batch can go
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this] { return active_workers_ == 0; });
+    batch_ = nullptr;
+}
+
+void JobSystem::workerMain()
+{
+    unsigned long long seen_generation = 0;
+    for (;;) {
+        Batch * batch = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            work_ready_.wait(lock, [&] {
+                return quit_ || generation_ != seen_generation;
+            });
+            if (quit_) {
+                return;
+            }
+            seen_generation = generation_;
+            batch = batch_;
+            if (batch == nullptr) {
+                continue;
+            }
+            ++active_workers_;
+        }
+
+        runRanges(*batch);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (--active_workers_ == 0) {
+                work_done_.notify_all();
+            }
+        }
+    }
+}
+
+void JobSystem::runRanges(Batch& batch)
+{
+    for (;;) {
+        const size_t begin = batch.next_begin.fetch_add(batch.grain_size);
+        if (begin >= batch.count) {
+            break;
+        }
+        (*batch.task)(begin, std::min(begin + batch.grain_size, batch.count));
+    }
+}
@@ -0,0 +1,226 @@
+#include <sponza/sponza.hpp>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+using namespace sponza;
+
+namespace {
+
+// cell coordinates are packed 21 bits per axis, centred on zero
+const int kCoordBits = 21;
+const int kCoordBias = 1 << (kCoordBits - 1);
+const unsigned long long kCoordMask = (1ull << kCoordBits) - 1;
+
+int cellCoord(float v, float inverse_cell_size)
+{
+    const float c = floorf(v * inverse_cell_size);
+    return (int)std::max(std::min(c, (float)(kCoordBias - 1)), (float)-kCoordBias);
+}
+
+unsigned long long packCell(int x, int y, int z)
+{
+    return ((unsigned long long)(x + kCoordBias) & kCoordMask)
+         | (((unsigned long long)(y + kCoordBias) & kCoordMask) << kCoordBits)
+         | (((unsigned long long)(z + kCoordBias) & kCoordMask) << (2 * kCoordBits));
+}
+
+float distanceSquared(const Aabb& b, const Vector3& p)
+{
+    const float dx = std::max(std::max(b.min.x - p.x, 0.f), p.x - b.max.x);
+    const float dy = std::max(std::max(b.min.y - p.y, 0.f), p.y - b.max.y);
+    const float dz = std::max(std::max(b.min.z - p.z, 0.f), p.z - b.max.z);
+    return dx * dx + dy * dy + dz * dz;
+}
+
+} // end anonymous namespace
+
+LightGrid::LightGrid(float cell_size)
+    : cell_size_(cell_size), inverse_cell_size_(1.f / cell_size)
+{
+    assert(cell_size > 0.f);
+}
+
+float LightGrid::getCellSize() const
+{
+    return cell_size_;
+}
+
+size_t LightGrid::getLightCount() const
+{
+    return light_count_;
+}
+
+size_t LightGrid::getCellCount() const
+{
+    return cells_.size();
+}
+
+unsigned long long LightGrid::cellKeyOf(Vector3 position) const
+{
+    return packCell(cellCoord(position.x, inverse_cell_size_),
+                    cellCoord(position.y, inverse_cell_size_),
+                    cellCoord(position.z, inverse_cell_size_));
+}
+
+void LightGrid::setLight(unsigned int light, Vector3 position, float range)
+{
+    if (light >= records_.size()) {
+        records_.resize(light + 1);
+    }
+    Record& record = records_[light];
+
+    const unsigned long long key
+        = range > cell_size_ ? Record::kOversized : cellKeyOf(position);
+
+    const Entry entry = { position, range, light };
+
+    // the common case, a light moving within its cell, is a plain store
+    if (record.cell == key) {
+        if (key == Record::kOversized) {
+            oversized_[record.slot] = entry;
+        } else {
+            Entry& stored = cells_[key][record.slot];
+            if (range < stored.range && stored.range >= max_cell_range_) {
+                max_cell_range_stale_ = true;
+            }
+            stored = entry;
+            max_cell_range_ = std::max(max_cell_range_, range);
+        }
+        return;
+    }
+
+    if (record.cell == Record::kAbsent) {
+        light_count_++;
+    } else {
+        unlink(record);
+    }
+
+    std::vector<Entry>& entries
+        = key == Record::kOversized ? oversized_ : cells_[key];
+    if (key != Record::kOversized) {
+        max_cell_range_ = std::max(max_cell_range_, range);
+    }
+    record.cell = key;
+    record.slot = (unsigned int)entries.size();
+    entries.push_back(entry);
+}
+
+void LightGrid::removeLight(unsigned int light)
+{
+    if (light >= records_.size()) return;
+    Record& record = records_[light];
+    if (record.cell == Record::kAbsent) return;
+    unlink(record);
+    record.cell = Record::kAbsent;
+    light_count_--;
+}
+
+void LightGrid::truncate(size_t count)
+{
+    for (size_t i = count; i < records_.size(); ++i) {
+        removeLight((unsigned int)i);
+    }
+    if (count < records_.size()) {
+        records_.resize(count);
+    }
+
+    // the largest light has shrunk or left the cells, so the margin
+    // queries search is wider than it needs to be
+    if (max_cell_range_stale_) {
+        max_cell_range_ = 0.f;
+        for (const auto& cell : cells_) {
+            for (const Entry& entry : cell.second) {
+                max_cell_range_ = std::max(max_cell_range_, entry.range);
+            }
+        }
+        max_cell_range_stale_ = false;
+    }
+}
+
+void LightGrid::unlink(Record& record)
+{
+    std::vector<Entry>& entries
+        = record.cell == Record::kOversized ? oversized_ : cells_[record.cell];
+    if (record.cell != Record::kOversized
+        && entries[record.slot].range >= max_cell_range_) {
+        max_cell_range_stale_ = true;
+    }
+
+    // swap the last entry into the hole and repoint its record
+    const Entry& last = entries.back();
+    entries[record.slot] = last;
+    records_[last.light].slot = record.slot;
+    entries.pop_back();
+}
+
+template<typename Test>
+void LightGrid::query(const Aabb& region,
+                      Test test,
+                      std::vector<unsigned int>& lights) const
+{
+    for (const Entry& entry : oversized_) {
+        if (test(entry)) lights.push_back(entry.light);
+    }
+
+    if (cells_.empty() || region.isEmpty()) return;
+
+    // any light reaching the region has its centre within this margin of it
+    const float margin = max_cell_range_;
+    const int x0 = cellCoord(region.min.x - margin, inverse_cell_size_);
+    const int y0 = cellCoord(region.min.y - margin, inverse_cell_size_);
+    const int z0 = cellCoord(region.min.z - margin, inverse_cell_size_);
+    const int x1 = cellCoord(region.max.x + margin, inverse_cell_size_);
+    const int y1 = cellCoord(region.max.y + margin, inverse_cell_size_);
+    const int z1 = cellCoord(region.max.z + margin, inverse_cell_size_);
+
+    const double span = (double)(x1 - x0 + 1) * (y1 - y0 + 1) * (z1 - z0 + 1);
+
+    // a region covering more cells than exist is cheaper to answer by
+    // walking the cells than by looking up every coordinate in range
+    if (span > (double)cells_.size()) {
+        for (const auto& cell : cells_) {
+            for (const Entry& entry : cell.second) {
+                if (test(entry)) lights.push_back(entry.light);
+            }
+        }
+        return;
+    }
+
+    for (int z = z0; z <= z1; ++z) {
+        for (int y = y0; y <= y1; ++y) {
+            for (int x = x0; x <= x1; ++x) {
+                const auto cell = cells_.find(packCell(x, y, z));
+                if (cell == cells_.end()) continue;
+                for (const Entry& entry : cell->second) {
+                    if (test(entry)) lights.push_back(entry.light);
+                }
+            }
+        }
+    }
+}
+
+void LightGrid::queryAabb(const Aabb& box, std::vector<unsigned int>& lights) const
+{
+    query(box, [&box](const Entry& entry)
+    {
+        return distanceSquared(box, entry.position) <= entry.range * entry.range;
+    }, lights);
+}
+
+void LightGrid::querySphere(Vector3 centre,
+                            float radius,
+                            std::vector<unsigned int>& lights) const
+{
+    const Aabb region(Vector3(centre.x - radius, centre.y - radius, centre.z - radius),
+                      Vector3(centre.x + radius, centre.y + radius, centre.z + radius));
+    query(region, [&centre, radius](const Entry& entry)
+    {
+        const float dx = entry.position.x - centre.x;
+        const float dy = entry.position.y - centre.y;
+        const float dz = entry.position.z - centre.z;
+        const float reach = entry.range + radius;
+        return dx * dx + dy * dy + dz * dz <= reach * reach;
+    }, lights);
+}
@@ -0,0 +1,57 @@
+#include <sponza/sponza.hpp>
+
+using namespace sponza;
+
+unsigned long long SceneSnapshot::getFrameIndex() const
+{
+    return frame_index_;
+}
+
+float SceneSnapshot::getTimeInSeconds() const
+{
+    return time_seconds_;
+}
+
+Vector3 SceneSnapshot::getUpDirection() const
+{
+    return up_direction_;
+}
+
+Vector3 SceneSnapshot::getAmbientLightIntensity() const
+{
+    return ambient_light_intensity_;
+}
+
+const Camera& SceneSnapshot::getCamera() const
+{
+    return camera_;
+}
+
+const std::vector<Light>& SceneSnapshot::getAllLights() const
+{
+    return lights_;
+}
+
+const std::vector<Instance>& SceneSnapshot::getAllInstances() const
+{
+    return instances_.values();
+}
+
+const Instance& SceneSnapshot::getInstanceById(InstanceId id) const
+{
+    return instances_.at(id);
+}
+
+const Instance * SceneSnapshot::findInstanceById(InstanceId id) const
+{
+    return instances_.find(id);
+}
+
+const std::vector<InstanceId>& SceneSnapshot::getInstancesByMeshId(MeshId id) const
+{
+    const unsigned int slot = handleSlot(id);
+    if (id == 0 || slot >= mesh_instances_.size() || mesh_instances_[slot].mesh != id) {
+        throw std::out_of_range("getInstancesByMeshId given a stale or invalid id");
+    }
+    return mesh_instances_[slot].instances;
+}
@@ -0,0 +1,124 @@
+#include <sponza/sponza.hpp>
+
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cassert>
+
+using namespace sponza;
+
+namespace {
+
+/*
+ * out = parent * local for affine 4x3 matrices, one SSE lane per row.
+ * Columns are stored as consecutive float triples (m00 m01 m02 is the
+ * first column, m30 m31 m32 the translation) so the first three columns
+ * can be loaded four floats at a time without reading past the matrix.
+ */
+void multiplyAffine(const Matrix4x3& parent,
+                    const Matrix4x3& local,
+                    Matrix4x3& out)
+{
+    const __m128 p0 = _mm_loadu_ps(&parent.m00);
+    const __m128 p1 = _mm_loadu_ps(&parent.m10);
+    const __m128 p2 = _mm_loadu_ps(&parent.m20);
+    const __m128 p3 = _mm_setr_ps(parent.m30, parent.m31, parent.m32, 0.f);
+
+    const float * l = &local.m00;
+    __m128 columns[4];
+    for (int c = 0; c < 4; ++c) {
+        __m128 column = _mm_add_ps(
+            _mm_add_ps(_mm_mul_ps(p0, _mm_set1_ps(l[3 * c + 0])),
+                       _mm_mul_ps(p1, _mm_set1_ps(l[3 * c + 1]))),
+            _mm_mul_ps(p2, _mm_set1_ps(l[3 * c + 2])));
+        columns[c] = column;
+    }
+    columns[3] = _mm_add_ps(columns[3], p3);
+
+    // each 4-wide store spills into the next column, which is then
+    // overwritten, so write in order and finish the last column by hand
+    float * o = &out.m00;
+    _mm_storeu_ps(o + 0, columns[0]);
+    _mm_storeu_ps(o + 3, columns[1]);
+    _mm_storeu_ps(o + 6, columns[2]);
+    float last[4];
+    _mm_storeu_ps(last, columns[3]);
+    o[9] = last[0];
+    o[10] = last[1];
+    o[11] = last[2];
+}
+
+} // end anonymous namespace
+
+TransformNodeId TransformHierarchy::createNode(TransformNodeId parent,
+                                               const Matrix4x3& local_xform)
+{
+    assert(parent == kNoParent || parent < parents_.size());
+    const TransformNodeId node = (TransformNodeId)parents_.size();
+    parents_.push_back(parent);
+    local_xforms_.push_back(local_xform);
+    world_xforms_.push_back(local_xform);
+    dirty_.push_back(1);
+    first_dirty_ = std::min<size_t>(first_dirty_, node);
+    return node;
+}
+
+size_t TransformHierarchy::getNodeCount() const
+{
+    return parents_.size();
+}
+
+TransformNodeId TransformHierarchy::getParent(TransformNodeId node) const
+{
+    return parents_[node];
+}
+
+const Matrix4x3& TransformHierarchy::getLocalTransform(TransformNodeId node) const
+{
+    return local_xforms_[node];
+}
+
+void TransformHierarchy::setLocalTransform(TransformNodeId node,
+                                           const Matrix4x3& local_xform)
+{
+    local_xforms_[node] = local_xform;
+    dirty_[node] = 1;
+    first_dirty_ = std::min<size_t>(first_dirty_, node);
+}
+
+const Matrix4x3& TransformHierarchy::getWorldTransform(TransformNodeId node) const
+{
+    return world_xforms_[node];
+}
+
+const std::vector<TransformNodeId>& TransformHierarchy::updateWorldTransforms()
+{
+    updated_nodes_.clear();
+
+    // parents precede children, so one forward sweep from the first changed
+    // node both spreads the dirty flags down the subtrees and collects them
+    const size_t node_count = parents_.size();
+    for (size_t i = first_dirty_; i < node_count; ++i) {
+        const TransformNodeId parent = parents_[i];
+        if (!dirty_[i] && (parent == kNoParent || !dirty_[parent])) continue;
+        dirty_[i] = 1;
+        updated_nodes_.push_back((TransformNodeId)i);
+    }
+
+    for (const TransformNodeId node : updated_nodes_) {
+        const TransformNodeId parent = parents_[node];
+        if (parent == kNoParent) {
+            world_xforms_[node] = local_xforms_[node];
+        } else {
+            multiplyAffine(world_xforms_[parent],
+                           local_xforms_[node],
+                           world_xforms_[node]);
+        }
+    }
+
+    for (const TransformNodeId node : updated_nodes_) {
+        dirty_[node] = 0;
+    }
+    first_dirty_ = node_count;
+
+    return updated_nodes_;
+}